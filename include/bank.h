@@ -10,6 +10,19 @@
 #include <iostream> /* for cout */
 #include <list>
 #include <string>
+#include <vector>
+
+#include "fx.h"
+#include "history.h"
+#include "hold.h"
+#include "logfmt.h"
+#include "logio.h"
+#include "logsink.h"
+#include "mvcc.h"
+#include "replica.h"
+#include "report.h"
+#include "segment.h"
+#include "table.h"
 
 using namespace std;
 
@@ -26,24 +39,108 @@ using namespace std;
       ", Acc: " + std::to_string(a) + " TRANSFER $" + std::to_string(m) + \
       " TO Acc: " + std::to_string(o)
 
+#define FX_TRANSFER_MSG(level, w, l, a, o, m, c, n, t)                    \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) +   \
+      ", Acc: " + std::to_string(a) + " TRANSFER $" + std::to_string(m) + \
+      " " + c + " TO Acc: " + std::to_string(o) + " AS $" +              \
+      std::to_string(n) + " " + t
+
+#define TENANT_TRANSFER_MSG(level, w, l, a, m, t, o)                      \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) +   \
+      ", Acc: " + std::to_string(a) + " TRANSFER $" + std::to_string(m) + \
+      " TO TEN: " + std::to_string(t) + ", Acc: " + std::to_string(o)
+
+#define TENANT_MSG(level, w, l, t)                                      \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", UNKNOWN TEN: " + std::to_string(t)
+
+#define OPEN_MSG(level, w, l, a, m)                                     \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " OPEN $" + std::to_string(m)
+
+#define CLOSE_MSG(level, w, l, a)                                       \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " CLOSE"
+
+#define QUERY_MSG(level, w, l, a, q, m)                                      \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) +      \
+      ", Acc: " + std::to_string(a) + " BALANCE AS OF LID: " +               \
+      std::to_string(q) + " $" + std::to_string(m)
+
+#define AUTHORIZE_MSG(level, w, l, a, m)                                \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " AUTHORIZE $" + std::to_string(m)
+
+#define CAPTURE_MSG(level, w, l, a, h, m)                               \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " CAPTURE $" + std::to_string(m) + \
+      " OF HOLD LID: " + std::to_string(h)
+
+#define RELEASE_MSG(level, w, l, a, h, m)                               \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " RELEASE $" + std::to_string(m) + \
+      " OF HOLD LID: " + std::to_string(h)
+
+#define EXPIRE_MSG(level, w, h, a, m)                                   \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(h) + \
+      ", Acc: " + std::to_string(a) + " HOLD EXPIRED $" + std::to_string(m)
+
+#define DUPLICATE_MSG(level, w, l, t)                                   \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", TXN: " + std::to_string(t)
+
+#define LIMIT_MSG(level, w, l, a, m, t)                                 \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " VELOCITY LIMIT $" +              \
+      std::to_string(m) + " PER " + std::to_string(t)
+
+#define DENIED_MSG(level, w, l, a, r)                                   \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) + \
+      ", Acc: " + std::to_string(a) + " DENIED BY RULE " + std::to_string(r)
+
+// appended to a failed withdraw or transfer that broke the velocity limit
+#define LIMIT_REASON " (VELOCITY LIMIT)"
+// appended to a failed transfer between shards that cannot be split
+#define SHARD_REASON " (CROSS-SHARD)"
+
+#define BULK_MSG(level, w, l, k, v, n, s, t)                                 \
+  level + "TID: " + std::to_string(w) + ", LID: " + std::to_string(l) +      \
+      ", BULK " + k + " " + std::to_string(v) +                              \
+      " Accounts: " + std::to_string(n) + " Skipped: " + std::to_string(s) + \
+      " Total: $" + std::to_string(t)
+
 using namespace std;
 
 #define SUCC \
   std::string { "[ SUCCESS ] " }
 #define ERR \
   std::string { "[ FAIL ] " }
+#define DUP \
+  std::string { "[ DUPLICATE ] " }
+
+#define BULK_INTEREST 0
+#define BULK_FEE 1
 
-struct Account {
-  unsigned int accountID;
-  long balance;
-  pthread_mutex_t lock;
+/**
+ * @brief an end-of-day job applied to every selected account at once.
+ */
+struct BulkJob {
+  int kind;          // BULK_INTEREST (value in basis points) or BULK_FEE
+  long value;
+  long min_balance;  // only accounts with at least this balance
+  int first;         // only account IDs in [first, last]
+  int last;
+  int ledgerID;      // tags the job's versions, history and log record
 };
 
 class Bank {
  private:
-  int num;
   int num_succ;
   int num_fail;
+  int num_dup;
+
+  void log(LogRecord r, int status, int *counter);
+  void log_message(const string &message, int status, int *counter);
 
  public:
   Bank(int N);
@@ -53,13 +150,72 @@ class Bank {
   int withdraw(int workerID, int ledgerID, int accountID, int amount);
   int transfer(int workerID, int ledgerID, int src_id, int dest_id,
                unsigned int amount);
+  int open(int workerID, int ledgerID, int accountID, int amount);
+  int close(int workerID, int ledgerID, int accountID);
+  int query(int workerID, int ledgerID, int accountID, int asof);
+  int authorize(int workerID, int ledgerID, int accountID, int amount,
+                long expires);
+  int capture(int workerID, int ledgerID, int accountID, int holdID,
+              int amount);
+  int release(int workerID, int ledgerID, int accountID, int holdID);
+  int set_limit(int workerID, int ledgerID, int accountID, int window,
+                int limit);
+  int deposit_fx(int workerID, int ledgerID, int accountID, int amount,
+                 int cur);
+  int withdraw_fx(int workerID, int ledgerID, int accountID, int amount,
+                  int cur);
+  int transfer_fx(int workerID, int ledgerID, int srcID, int destID,
+                  unsigned int amount, int cur, int to, long credit);
+  int transfer_to(Bank *dest, int workerID, int ledgerID, int srcID,
+                  int destID, unsigned int amount);
+  int prepare_transfer(int workerID, int ledgerID, int srcID, int destID,
+                       unsigned int amount, bool source);
+  int commit_transfer(int workerID, int ledgerID, int srcID, int destID,
+                      unsigned int amount, bool source);
+  int abort_transfer(int workerID, int ledgerID, int srcID, int destID,
+                     unsigned int amount, bool source);
+  void advance_clock(int workerID, long now);
+  long bulk(int workerID, const BulkJob &job, int num_threads);
+  bool check_invariant(const char *where);
+  int write_report(int fd, int format, int num_threads, int last_ledgerID);
+  int write_state(int fd, const vector<ScheduleRecord> &schedules);
+  int load_checkpoint(const char *path, int *last_ledgerID,
+                      vector<ScheduleRecord> *schedules);
+  int merge_report(const char *data, size_t size);
+
+  void enable_versions(int retain);
+  void enable_history();
+  int load_fx(const char *path);
+  void share_log(Bank *first, int id);
+  string currency(int cur);
 
   void print_account();
+  void print_counts();
   void recordSucc(string message);
   void recordFail(string message);
+  void recordSucc(const LogRecord &r);
+  void recordFail(const LogRecord &r, bool limited = false);
+  void recordQuery(const LogRecord &r, bool ok = true);
+  void recordDuplicate(const LogRecord &r);
+  int duplicates();
+  void counts(int *succ, int *fail, int *dup);
+  void add_counts(int succ, int fail, int dup);
 
   pthread_mutex_t bank_lock;
-  struct Account *accounts;
+  pthread_mutex_t *log_lock;  // guards the counters and log output
+  int tenant;                 // 0 unless the process hosts several banks
+  AccountTable accounts;
+  VersionStore *versions;  // NULL unless MVCC is enabled
+  HistoryIndex *history;   // NULL unless the history index is enabled
+  Replicator *replica;     // NULL unless a standby is attached
+  LogSink *log_sink;       // where the record functions log, cout unless
+                           // chosen at startup
+  LogHeader log_codes;     // currency codes for rendering records
+  HoldTable holds;         // open authorization holds
+  FxTable *fx;             // NULL unless FX rates are loaded
+  atomic<long> net_flow;   // money in minus money out, successful ops only
+  atomic<long> fx_flow[FX_CURRENCIES - 1];  // the same for currencies 1..
+  atomic<long> clock;      // ledger clock: the largest ts dequeued so far
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#ifndef _DEDUP_H
+#define _DEDUP_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+
+using namespace std;
+
+// exact-set shards (top bits of the hash) and Bloom filter geometry: each
+// ID sets DEDUP_BLOOM_K bits inside one 512-bit (cache line) block
+const int DEDUP_SHARD_BITS = 6;
+const int DEDUP_SHARDS = 1 << DEDUP_SHARD_BITS;
+const int DEDUP_BLOOM_K = 6;
+const int DEDUP_BLOOM_BITS_PER_ID = 12;
+
+/**
+ * @brief one shard of the filter: a linear-probing table plus a ring of the
+ *        IDs in insertion order, which picks the one to evict, behind two
+ *        generations of a blocked Bloom filter.
+ *
+ * Every ID in the table went into `bloom[gen]` or `bloom[gen ^ 1]`:
+ * `bloom[gen]` takes the IDs added since it was last cleared, and once it
+ * has taken `cap` of them the other generation is cleared and takes over,
+ * which only forgets IDs the ring has evicted since.
+ */
+struct DedupShard {
+  pthread_mutex_t lock;
+  uint64_t *slots;  // 0 = empty
+  uint64_t mask;
+  uint64_t *ring;
+  long cap;
+  long head;
+  long count;
+  uint64_t *bloom[2];
+  uint64_t bloom_blocks;  // power of two, 8 words each
+  int gen;     // the generation new IDs go into
+  long fresh;  // IDs added to bloom[gen] since it was cleared
+};
+
+/**
+ * @brief duplicate filter for external transaction IDs.
+ *
+ * @details
+ * IDs are spread over DEDUP_SHARDS shards by hash, each behind its own
+ * lock. seen() tests the ID against the shard's Bloom filter first; a miss
+ * proves the ID new, so it is only added, and only a Bloom positive probes
+ * the exact set, which has the final say, so false positives never drop an
+ * entry. `maybe` against `duplicates` shows how often the filter had to be
+ * confirmed.
+ *
+ * Memory is fixed by `window`: the exact set keeps the most recent `window`
+ * IDs (per shard, oldest evicted first) and each Bloom generation is sized
+ * for that many, so the filter ages with the window and its false positive
+ * rate does not grow with the number of IDs checked. A duplicate arriving
+ * after its ID was evicted is accepted.
+ */
+class DedupFilter {
+ private:
+  DedupShard shards[DEDUP_SHARDS];
+
+  bool bloom_test(DedupShard &s, uint64_t h);
+  void bloom_set(DedupShard &s, uint64_t h);
+  bool contains(DedupShard &s, uint64_t id, uint64_t h);
+  void add(DedupShard &s, uint64_t id, uint64_t h);
+  void erase(DedupShard &s, uint64_t id);
+
+ public:
+  atomic<long> checked;
+  atomic<long> maybe;  // Bloom filter positives
+  atomic<long> duplicates;
+
+  DedupFilter(long window);
+  ~DedupFilter();
+
+  bool seen(uint64_t id);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+// thread slots available to the epoch domain
+const int EPOCH_MAX_THREADS = 1024;
+// retired objects a thread collects before it tries to reclaim a batch
+const int EPOCH_BATCH = 64;
+
+/**
+ * @brief an object waiting until no reader can still hold a reference.
+ */
+struct Retired {
+  void *ptr;
+  void (*free_fn)(void *);
+  unsigned long epoch;
+};
+
+/**
+ * @brief per-thread epoch state, padded to its own cache line.
+ *
+ * `state` is 0 while the thread is outside a critical section, otherwise
+ * the global epoch it entered in shifted left by one with the low bit set.
+ */
+struct alignas(64) EpochSlot {
+  atomic<unsigned long> state;
+  atomic<int> in_use;
+  int depth;
+  vector<Retired> retired;
+};
+
+/**
+ * @brief epoch-based memory reclamation.
+ *
+ * @details
+ * Readers enter a critical section (see EpochGuard) before loading shared
+ * pointers and leave it when they no longer use them. Writers unlink an
+ * object and retire() it instead of deleting it. A retired object is freed
+ * once the global epoch has advanced twice since it was retired, which can
+ * only happen after every thread that might have seen it has left its
+ * critical section. Freeing happens in batches of EPOCH_BATCH per thread,
+ * so the cost is amortised and nothing takes a global lock on the read
+ * path.
+ */
+class EpochDomain {
+ private:
+  atomic<unsigned long> global;
+  EpochSlot slots[EPOCH_MAX_THREADS];
+
+  pthread_mutex_t orphan_lock;
+  vector<Retired> orphans;  // left behind by threads that exited
+
+  EpochSlot *my_slot();
+  bool try_advance();
+  void reclaim(vector<Retired> &list, unsigned long safe);
+
+ public:
+  EpochDomain();
+  ~EpochDomain();
+
+  void enter();
+  void exit();
+  void retire(void *ptr, void (*free_fn)(void *));
+  void release_slot(int slot);
+  void drain();
+
+  template <typename T>
+  void retire(T *ptr) {
+    retire(ptr, [](void *p) { delete (T *)p; });
+  }
+
+  template <typename T>
+  void retire_array(T *ptr) {
+    retire(ptr, [](void *p) { delete[] (T *)p; });
+  }
+};
+
+extern EpochDomain epochs;
+
+/**
+ * @brief RAII critical section on the global epoch domain.
+ */
+class EpochGuard {
+ public:
+  EpochGuard() { epochs.enter(); }
+  ~EpochGuard() { epochs.exit(); }
+  EpochGuard(const EpochGuard &) = delete;
+  EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _FX_H
+#define _FX_H
+
+#include <stdint.h>
+#include <string>
+
+#include "table.h"
+
+using namespace std;
+
+struct Ledger;
+
+// rates carry 8 decimal places
+const long FX_SCALE = 100000000;
+// longest currency code
+const int FX_CODE_MAX = 7;
+// currency index of a code the table does not list
+const int FX_NONE = -1;
+// entries converted per pass; the columns are always this long so the
+// compiler can vectorize the multiply loop
+const int FX_BATCH = 256;
+
+/**
+ * @brief the FX rate table loaded at startup.
+ *
+ * @details
+ * Each currency has a rate in base currency units per unit, in fixed point
+ * scaled by FX_SCALE. For every pair of currencies the table precomputes a
+ * 32.32 fixed-point cross rate, rounded up, split into its integer and
+ * fraction words, so estimating a conversion is two 32 x 32 -> 64 bit
+ * products and a shift:
+ *   amount * hi + (amount * lo >> 32)
+ * convert() gathers a batch's cross rates into columns and runs that over
+ * all of them in one loop the compiler vectorizes. Because the cross rate
+ * is rounded up by less than 2^-32 and amounts fit 32 bits, the estimate is
+ * the exact result amount * rates[from] / rates[to] rounded down, or one
+ * more; a second pass checks each estimate against the exact product and
+ * corrects it.
+ */
+class FxTable {
+ private:
+  string codes[FX_CURRENCIES];
+  long rates[FX_CURRENCIES];
+  uint32_t cross_hi[FX_CURRENCIES * FX_CURRENCIES];  // [from * N + to]
+  uint32_t cross_lo[FX_CURRENCIES * FX_CURRENCIES];
+  uint32_t amounts[FX_BATCH];
+  uint32_t his[FX_BATCH];
+  uint32_t los[FX_BATCH];
+  long froms[FX_BATCH];  // rates[from] and rates[to], for the correction
+  long tos[FX_BATCH];
+  long credits[FX_BATCH];
+
+  void convert_batch(Ledger *entries, int n);
+
+ public:
+  int num;  // currencies listed, the base first
+
+  FxTable();
+
+  int load(const char *path);
+  int find(const string &code);
+  string code(int cur);
+  void convert(Ledger *entries, size_t n);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// entries a thread buffers before handing its segment to the merger
+const int HISTORY_SEGMENT = 4096;
+// entries between restart points in an account's compressed list
+const int HISTORY_MARK = 64;
+
+struct HistoryEntry {
+  int acc;
+  int ledgerID;
+  long amount;
+};
+
+/**
+ * @brief compressed history of one account, in ledgerID order.
+ *
+ * Each entry is two zigzag varints: the ledgerID as a delta from the
+ * previous entry's ledgerID, and the signed amount. Every HISTORY_MARK
+ * entries a mark records the previous entry's ledgerID and the entry's byte
+ * offset, so decoding can restart there.
+ */
+struct AccountHistory {
+  vector<uint8_t> bytes;
+  vector<pair<int, size_t>> marks;
+  int last_lid = 0;
+  long count = 0;
+};
+
+/**
+ * @brief per-account transaction history built while the ledger runs.
+ *
+ * @details
+ * Bank operations append (account, ledgerID, signed amount) to a segment
+ * owned by the calling thread, so recording takes no shared lock. Full
+ * segments are handed to a background merger thread that sorts them by
+ * account and ledgerID and merges them into each account's compressed list.
+ * Segments from different threads overlap in ledgerID, so a run that does
+ * not start after an account's last entry is merged into the list's tail
+ * from the last mark before it; lists always stay in ledgerID order.
+ * Queries may run at any time and see the merged segments; finish() merges
+ * everything that is still buffered.
+ */
+class HistoryIndex {
+ private:
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  vector<vector<HistoryEntry> *> pending;
+  bool stopping;
+  pthread_t merger_thread;
+
+  pthread_mutex_t index_lock;
+  unordered_map<int, AccountHistory> index;
+
+  void hand_off(vector<HistoryEntry> *segment);
+  void merge(vector<HistoryEntry> *segment);
+  static void *merger(void *self);
+
+ public:
+  HistoryIndex();
+  ~HistoryIndex();
+
+  void record(int acc, int ledgerID, long amount);
+  void flush();
+  void finish();
+  long query(int acc, vector<pair<int, long>> &out);
+};
+
+#endif
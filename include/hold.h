@@ -0,0 +1,50 @@
+#ifndef _HOLD_H
+#define _HOLD_H
+
+#include <pthread.h>
+#include <unordered_map>
+#include <vector>
+
+#include "wheel.h"
+
+using namespace std;
+
+/**
+ * @brief an authorized amount reserved on an account until it is captured,
+ *        released or expires.
+ *
+ * A hold is named by the ledgerID of the entry that authorized it. Holds
+ * with an expiry time sit in the HoldTable's timing wheel; `expires` is
+ * unused otherwise.
+ */
+struct Hold : Timer {
+  int ledgerID;
+  int accountID;
+  long amount;
+};
+
+/**
+ * @brief open holds by ID, with a timing wheel for their expiry times.
+ *
+ * Expiry follows the ledger clock: expire() advances the wheel and hands
+ * back only the holds that came due, so releasing them never scans the
+ * open holds. The table has its own lock, which is never held while an
+ * account lock is taken.
+ */
+class HoldTable {
+ private:
+  pthread_mutex_t lock;
+  unordered_map<int, Hold *> by_id;
+  TimingWheel expiry;
+
+ public:
+  HoldTable();
+  ~HoldTable();
+
+  bool add(Hold *h, bool expires);
+  Hold *take(int ledgerID, int accountID, long amount);
+  Hold *expire(long now);
+  void list(vector<Hold *> &out);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _INDEX_H
+#define _INDEX_H
+
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// one index entry per this many ledgerIDs
+const int LEDGER_INDEX_BLOCK = 4096;
+
+const char INDEX_MAGIC[8] = {'L', 'E', 'D', 'G', 'I', 'D', 'X', '1'};
+
+/**
+ * @brief header of a ledger sidecar index (`<ledger>.idx`).
+ *
+ * The size and modification time of the ledger the index was built from
+ * let a stale index be detected and rebuilt. The header is followed by
+ * `count` int64 byte offsets; offset k is where the line with ledgerID
+ * k * `block` starts.
+ */
+struct IndexHeader {
+  char magic[8];
+  int64_t ledger_size;
+  int64_t ledger_mtime;
+  int32_t block;
+  int32_t count;
+};
+
+int build_ledger_index(const char *filename);
+int load_ledger_index(const char *filename, vector<int64_t> &offsets);
+
+#endif
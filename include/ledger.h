@@ -3,6 +3,9 @@
 
 #include "../include/bank.h"
 
+#include <limits.h> /* for INT_MAX */
+#include <vector>
+
 #ifdef DEBUGMODE
 #define debug(msg) \
   std::cout << "[" << __FILE__ << ":" << __LINE__ << "] " << msg << std::endl;
@@ -15,6 +18,30 @@ using namespace std;
 #define D 0
 #define W 1
 #define T 2
+#define O 3
+#define C 4
+#define Q 5
+#define AUTHORIZE 6
+#define CAPTURE 7
+#define RELEASE 8
+#define LIMIT 9
+
+// scheduled modes: SCHED_AT + op runs op once at `at`, SCHED_EVERY + op
+// runs it every `every` ticks of ledger time
+#define SCHED_AT 10
+#define SCHED_EVERY 20
+
+// internal modes of a transfer between accounts on different shards (see
+// shard.h): the coordinator prepares each side, then commits or aborts it
+#define PREPARE_SRC 30
+#define PREPARE_DST 31
+#define COMMIT_SRC 32
+#define COMMIT_DST 33
+#define ABORT_SRC 34
+#define ABORT_DST 35
+// a transfer between shards that is not split (other currencies, or
+// scheduled): the source's shard fails it with SHARD_REASON
+#define CROSS_SHARD 36
 
 const int SEED_RANDOM = 377;
 
@@ -24,13 +51,86 @@ struct Ledger {
   int amount;
   int mode;
   int ledgerID;
+  long ts = 0;  // optional `ts=` column, orders entries across ledger files
+  long at = -1;    // `at=`: first execution time of a scheduled entry
+  long every = 0;  // `every=`: period of a recurring entry
+  int count = 0;   // `count=`: executions of a recurring entry, 0 = no limit
+  long exp = -1;   // `exp=`: expiry time of an authorization hold
+  unsigned long txn = 0;  // `txn=`: external transaction ID, 0 = none
+  int rule = 0;  // line of the --rules rule that denied the entry, 0 = none
+  int cur = 0;     // `cur=`: currency of the amount, FX_NONE if unknown
+  int to = 0;      // `to=`: currency credited by a transfer, default `cur`
+  long credit = 0; // amount credited by a transfer, converted into `to`
+  int tenant = 0;  // `tenant=`: the bank that runs the entry
+  int peer = 0;    // `peer=`: the bank of a transfer's destination
+};
+
+// most entries a streaming loader keeps queued ahead of the workers
+const size_t LEDGER_QUEUE_MAX = 65536;
+
+/**
+ * @brief run options parsed from the optional flags after the ledger file.
+ */
+struct RunOptions {
+  bool adaptive = false;  // --adaptive: resize the pool, argv[1] is the max
+  int accounts = 10;      // --accounts N: accounts opened at startup
+  int mvcc = -1;          // --mvcc N: keep N ledger IDs of balance history
+  vector<int> history;    // --history ACC: print the account's history
+  int history_ms = 0;     // --history-ms N: also query it every N ms
+  long interest = 0;      // --interest BP: end-of-day interest
+  long fee = 0;           // --fee AMOUNT: end-of-day flat fee
+  long bulk_min = 0;      // --bulk-min BAL: bulk jobs skip smaller balances
+  int bulk_first = 0;     // --bulk-accounts A-B: bulk jobs only touch [A, B]
+  int bulk_last = MAX_ACCOUNTS;
+  bool check = false;     // --check: check money conservation at exit
+  int check_ms = 0;       // --check-ms N: also check every N ms while running
+  int report = REPORT_TEXT;  // --report text|csv|bin: final balances format
+  string report_file;        // --report-file PATH: instead of stdout
+  int range_first = -1;   // --range A:B: only replay ledgerIDs A..B
+  int range_last = INT_MAX;
+  string checkpoint;      // --checkpoint PATH: binary report to start from
+  string progress;        // --progress PATH: binary report written at exit,
+                          // finished or cancelled
+  vector<string> ledgers; // further ledger files, merged by timestamp
+  long dedup = 0;         // --dedup N: reject repeated txn= IDs among the
+                          // last N
+  int top = 0;            // --top K: print the K most accessed accounts
+  string rules;           // --rules PATH: screen entries before they run
+  string fx;              // --fx PATH: FX rates, enables cur= and to=
+  int tenants = 1;        // --tenants N: banks hosted, routed by tenant=
+  int shards = 1;         // --shards N: processes the accounts are
+                          // partitioned across
+  int replica = REPLICA_OFF;  // --replica sync|async: ship changes to a
+                              // standby process
+  string log_file;        // --log-file PATH: the log goes there, not stdout
+  int log_io = LOG_IO_URING;  // --log-io uring|pwrite: how it is written
+  bool log_sync = false;  // --log-sync: fsync every log buffer
+  int log_format = LOG_TEXT;  // --log-format text|bin: of the log file
+  string log_segments;    // --log-segments DIR: the log goes to compressed
+                          // segments there, not stdout
+  long log_segment_mb = SEG_DEFAULT_MB;  // --log-segment-mb N: segment size
+  long log_rotate_ms = 0;  // --log-rotate-ms T: also rotate every T ms
+  int log_sink = LOG_SINK_ALL;  // --log-sink all|none|failures|sample:N:
+  long log_sample = 0;          // which lines are logged, N for sample
 };
 
 extern list<struct Ledger> ledger;
 extern Bank *bank;
+extern vector<Bank *> banks;
+extern RunOptions opts;
+extern int next_ledgerID;
+extern int exit_status;
 
 void InitBank(int num_workers, char *filename);
 int load_ledger(char *filename);
+void *merge_loader(void *merge);
+void *shard_loader(void *unused);
+bool parse_ledger_line(const string &line, Ledger &entry);
 void *worker(void *unused);
+void print_history(int acc);
+void *history_reporter(void *unused);
+void run_bulk_jobs(int num_threads);
+void *checker(void *unused);
+void write_final_report();
 
 #endif
\ No newline at end of file
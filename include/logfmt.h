@@ -0,0 +1,161 @@
+#ifndef _LOGFMT_H
+#define _LOGFMT_H
+
+#include <stdint.h>
+#include <string>
+
+#include "fx.h"
+
+using namespace std;
+
+#define LOG_TEXT 0  // log lines as the *_MSG macros format them
+#define LOG_BIN 1   // a LogHeader followed by packed LogEntry units
+
+const char LOG_MAGIC[8] = {'B', 'A', 'N', 'K', 'L', 'O', 'G', '2'};
+
+// record status, the level of the line
+#define LOG_SUCC 0
+#define LOG_FAIL 1
+#define LOG_DUP 2
+
+// record operations, one per *_MSG macro; the comments name the fields
+// each uses besides tid and lid
+#define LOG_DEPOSIT 0          // acc, amount
+#define LOG_WITHDRAW 1         // acc, amount
+#define LOG_TRANSFER 2         // acc, other (destination), amount
+#define LOG_DEPOSIT_FX 3       // acc, amount, cur
+#define LOG_WITHDRAW_FX 4      // acc, amount, cur
+#define LOG_TRANSFER_FX 5      // acc, other, amount, cur, to, extra (credit)
+#define LOG_TENANT_TRANSFER 6  // acc, other, amount, extra (peer tenant)
+#define LOG_TENANT 7           // other (the unknown tenant)
+#define LOG_OPEN 8             // acc, amount
+#define LOG_CLOSE 9            // acc
+#define LOG_QUERY 10           // acc, other (as of), amount (balance)
+#define LOG_AUTHORIZE 11       // acc, amount
+#define LOG_CAPTURE 12         // acc, other (hold), amount
+#define LOG_RELEASE 13         // acc, other (hold), amount
+#define LOG_EXPIRE 14          // acc, amount; lid is the hold's
+#define LOG_DUPLICATE 15       // amount (txn ID)
+#define LOG_LIMIT 16           // acc, other (window), amount (limit)
+#define LOG_DENIED 17          // acc, other (rule line)
+#define LOG_BULK 18            // acc (applied), other (skipped), amount
+                               // (value), extra (total), cur (kind)
+
+// record flags
+#define LOG_LIMITED 1  // failed on the velocity limit (LIMIT_REASON)
+#define LOG_CROSS_SHARD 2  // not split between shards (SHARD_REASON)
+
+/**
+ * @brief one log line as the banks build it and render_log() formats it.
+ *
+ * A binary log stores it packed as a LogEntry (see pack_log()).
+ */
+struct LogRecord {
+  uint8_t status;   // LOG_SUCC, LOG_FAIL or LOG_DUP
+  uint8_t op;       // LOG_DEPOSIT, ...
+  uint8_t flags;    // LOG_LIMITED, LOG_CROSS_SHARD
+  int8_t cur;       // currency of the amount, FX_NONE if unknown
+  int8_t to;        // currency a transfer credits
+  uint8_t reserved;
+  uint16_t tenant;  // tags the line with `TEN: {tenant}, ` if not 0
+  int32_t tid;
+  int32_t lid;
+  int32_t acc;
+  int32_t other;
+  int64_t amount;
+  int64_t extra;
+};
+
+// LogEntry `bits`: the status, then flags
+#define LOG_STATUS_MASK 3
+#define LOG_BIT_LIMITED 4  // LOG_LIMITED
+#define LOG_BIT_EXT 8      // a LogExtension follows
+#define LOG_BIT_CROSS_SHARD 16  // LOG_CROSS_SHARD
+// LogExtension `mark`, never a valid op, so a reader can resynchronise
+#define LOG_EXT_MARK 0xff
+
+/**
+ * @brief a LogRecord as a binary log stores it: 24 bytes, enough for the
+ *        common operations, whose amount fits 32 bits and which use no
+ *        currencies or extra field.
+ */
+struct LogEntry {
+  uint8_t op;
+  uint8_t bits;     // status | LOG_BIT_* flags
+  uint16_t tenant;
+  int32_t tid;
+  int32_t lid;
+  int32_t acc;
+  int32_t other;
+  int32_t amount;   // the low half when a LogExtension follows
+};
+
+/**
+ * @brief the second LogEntry-sized unit of a record whose amount needs 64
+ *        bits or that sets `extra`, `cur` or `to`.
+ */
+struct LogExtension {
+  uint8_t mark;  // LOG_EXT_MARK
+  int8_t cur;
+  int8_t to;
+  uint8_t reserved[5];
+  int64_t amount;
+  int64_t extra;
+};
+
+static_assert(sizeof(LogEntry) == 24 && sizeof(LogExtension) == 24,
+              "a binary log is a sequence of 24-byte units");
+
+/**
+ * @brief header of a binary log: what a renderer needs besides the records.
+ */
+struct LogHeader {
+  char magic[8];
+  int32_t record_size;  // sizeof(LogEntry)
+  int32_t currencies;   // codes listed, 0 without FX rates
+  char codes[FX_CURRENCIES][FX_CODE_MAX + 1];
+};
+
+/**
+ * @brief builds a record; the caller's recordSucc(), recordFail() and so on
+ *        set the status.
+ */
+inline LogRecord log_record(int op, int tid, int lid, int acc, long other,
+                            long amount, long extra = 0, int cur = 0,
+                            int to = 0) {
+  LogRecord r = {0, (uint8_t)op, 0, (int8_t)cur, (int8_t)to, 0, 0,
+                 tid, lid, acc, (int32_t)other, amount, extra};
+  return r;
+}
+
+#define DEPOSIT_LOG(w, l, a, m) log_record(LOG_DEPOSIT, w, l, a, 0, m)
+#define WITHDRAW_LOG(w, l, a, m) log_record(LOG_WITHDRAW, w, l, a, 0, m)
+#define TRANSFER_LOG(w, l, a, o, m) log_record(LOG_TRANSFER, w, l, a, o, m)
+#define DEPOSIT_FX_LOG(w, l, a, m, c) \
+  log_record(LOG_DEPOSIT_FX, w, l, a, 0, m, 0, c)
+#define WITHDRAW_FX_LOG(w, l, a, m, c) \
+  log_record(LOG_WITHDRAW_FX, w, l, a, 0, m, 0, c)
+#define FX_TRANSFER_LOG(w, l, a, o, m, c, n, t) \
+  log_record(LOG_TRANSFER_FX, w, l, a, o, m, n, c, t)
+#define TENANT_TRANSFER_LOG(w, l, a, m, t, o) \
+  log_record(LOG_TENANT_TRANSFER, w, l, a, o, m, t)
+#define TENANT_LOG(w, l, t) log_record(LOG_TENANT, w, l, 0, t, 0)
+#define OPEN_LOG(w, l, a, m) log_record(LOG_OPEN, w, l, a, 0, m)
+#define CLOSE_LOG(w, l, a) log_record(LOG_CLOSE, w, l, a, 0, 0)
+#define QUERY_LOG(w, l, a, q, m) log_record(LOG_QUERY, w, l, a, q, m)
+#define AUTHORIZE_LOG(w, l, a, m) log_record(LOG_AUTHORIZE, w, l, a, 0, m)
+#define CAPTURE_LOG(w, l, a, h, m) log_record(LOG_CAPTURE, w, l, a, h, m)
+#define RELEASE_LOG(w, l, a, h, m) log_record(LOG_RELEASE, w, l, a, h, m)
+#define EXPIRE_LOG(w, h, a, m) log_record(LOG_EXPIRE, w, h, a, 0, m)
+#define DUPLICATE_LOG(w, l, t) log_record(LOG_DUPLICATE, w, l, 0, 0, (long)t)
+#define LIMIT_LOG(w, l, a, m, t) log_record(LOG_LIMIT, w, l, a, t, m)
+#define DENIED_LOG(w, l, a, r) log_record(LOG_DENIED, w, l, a, r, 0)
+#define BULK_LOG(w, l, k, v, n, s, t) \
+  log_record(LOG_BULK, w, l, n, s, v, t, k)
+
+void log_header(LogHeader *header, FxTable *fx);
+string render_log(const LogRecord &r, const LogHeader &header);
+size_t pack_log(const LogRecord &r, LogEntry out[2]);
+size_t unpack_log(const LogEntry *in, size_t units, LogRecord *r);
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef _LOGIO_H
+#define _LOGIO_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "logsink.h"
+
+using namespace std;
+
+#define LOG_IO_URING 0   // io_uring, falling back to LOG_IO_PWRITE
+#define LOG_IO_PWRITE 1  // a pool of pwrite() threads
+
+// buffers the log is staged in; one is filled while the others are written
+const int LOG_BUFFERS = 8;
+const size_t LOG_BUFFER_SIZE = 256 << 10;
+// threads of the pwrite backend
+const int LOG_PWRITE_THREADS = 4;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * @brief one staging buffer of the log and the write it is part of.
+ */
+struct LogBuffer {
+  char *data;
+  size_t used;
+  long offset;   // file offset of data[0] once submitted
+  int inflight;  // operations submitted and not yet completed
+};
+
+/**
+ * @brief asynchronous writer of the transaction log to a file.
+ *
+ * @details
+ * Lines are copied into one of LOG_BUFFERS buffers; a full buffer is
+ * submitted at the next file offset and the writer moves on to the next
+ * buffer, waiting only if that one is still being written. With io_uring the
+ * buffers are registered with the ring once and written with
+ * IORING_OP_WRITE_FIXED; with `sync` each write is linked to a data fsync,
+ * so a buffer is reused only once it is on disk. Completions are reaped in
+ * batches, only when a buffer is needed or at close(), so the writer
+ * usually enters the kernel once per buffer. Without io_uring (an old
+ * kernel, or one that disables it) LOG_PWRITE_THREADS threads take full
+ * buffers from a queue and pwrite() them, with fdatasync() for `sync`.
+ *
+ * As a LogSink it takes records if opened with a header (a binary log) and
+ * their text otherwise.
+ *
+ * @attention
+ * - append() is not thread safe; the banks call it under their log lock.
+ */
+class LogWriter : public LogSink {
+ private:
+  int fd;
+  bool sync;
+  long offset;  // where the next submitted buffer goes
+  vector<LogBuffer> buffers;
+  int current;  // the buffer being filled
+  bool failed;
+  long started_ns;
+  // io_uring backend
+  int ring;
+  bool fixed;  // buffers registered with the ring
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_size;
+  size_t cq_map_size;
+  size_t sqes_size;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  io_uring_sqe *sqes;
+  io_uring_cqe *cqes;
+  // pwrite backend
+  pthread_t threads[LOG_PWRITE_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t queued_cond;  // a buffer was queued, or closing
+  pthread_cond_t done_cond;    // a buffer was written
+  vector<int> queue;
+  bool closing;
+
+  int setup_ring();
+  void submit();
+  void reap(bool wait);
+  void wait_free(int b);
+  void copy(const char *p, size_t size);
+  static void *write_loop(void *arg);
+
+ public:
+  int backend;
+  long lines;   // lines, or records of a binary log
+  long bytes;
+  long writes;  // buffers submitted
+  long stalls;  // times append() waited for a buffer
+
+  LogWriter(int backend, bool sync);
+  ~LogWriter();
+
+  int open(const char *path, const void *header = NULL,
+           size_t header_size = 0);
+  void append(const string &line);
+  void append(const void *data, size_t size);
+  void write(const LogRecord &r, const string &line);
+  int close();
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _LOGSINK_H
+#define _LOGSINK_H
+
+#include <atomic>
+#include <string>
+
+#include "logfmt.h"
+
+using namespace std;
+
+#define LOG_SINK_ALL 0       // every line
+#define LOG_SINK_NONE 1      // no lines, only the counters
+#define LOG_SINK_SAMPLE 2    // one line in N
+#define LOG_SINK_FAILURES 3  // failed operations only
+
+/**
+ * @brief where the banks' record functions send their log lines.
+ *
+ * @details
+ * Bank::log() asks accept() first, outside the log lock and before the
+ * record is rendered, so a line a sink drops costs neither; the counters
+ * are updated either way. Accepted records are then passed to write()
+ * under the log lock, rendered to `line` unless the sink is `binary`.
+ */
+class LogSink {
+ public:
+  bool binary;  // takes records as they are, not their text
+
+  LogSink() : binary(false) {}
+  virtual ~LogSink() {}
+
+  virtual bool accept(const LogRecord &r) {
+    (void)r;
+    return true;
+  }
+  virtual void write(const LogRecord &r, const string &line) = 0;
+};
+
+/**
+ * @brief the default sink: each line to cout, flushed.
+ */
+class CoutSink : public LogSink {
+ public:
+  void write(const LogRecord &r, const string &line);
+};
+
+/**
+ * @brief a sink that passes some records on to another and counts them.
+ */
+class LogFilter : public LogSink {
+ protected:
+  LogSink *out;
+
+ public:
+  string name;  // the mode as --log-sink gives it
+  atomic<long> seen;
+  atomic<long> passed;
+
+  LogFilter(const string &name, LogSink *out);
+
+  bool accept(const LogRecord &r);
+  void write(const LogRecord &r, const string &line);
+  virtual bool keep(const LogRecord &r, long n) = 0;
+  void print_stats();
+};
+
+/**
+ * @brief drops every line.
+ */
+class NullSink : public LogFilter {
+ public:
+  NullSink() : LogFilter("none", NULL) {}
+  bool keep(const LogRecord &r, long n);
+};
+
+/**
+ * @brief keeps the first of every `every` lines.
+ */
+class SampleSink : public LogFilter {
+ public:
+  long every;
+
+  SampleSink(LogSink *out, long every)
+      : LogFilter("sample:" + to_string(every), out), every(every) {}
+  bool keep(const LogRecord &r, long n);
+};
+
+/**
+ * @brief keeps the lines of failed operations.
+ */
+class FailureSink : public LogFilter {
+ public:
+  FailureSink(LogSink *out) : LogFilter("failures", out) {}
+  bool keep(const LogRecord &r, long n);
+};
+
+extern CoutSink log_cout;
+
+LogFilter *make_log_filter(int mode, long every, LogSink *out);
+
+#endif
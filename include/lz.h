@@ -0,0 +1,19 @@
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <stddef.h>
+
+// positions remembered by the match finder, one per hash of 4 bytes
+const int LZ_HASH_BITS = 12;
+// matches reach back at most this far (a 16-bit offset)
+const size_t LZ_WINDOW = 65535;
+
+/**
+ * @brief worst-case size of lz_compress() output for `size` input bytes.
+ */
+inline size_t lz_bound(size_t size) { return size + size / 255 + 16; }
+
+size_t lz_compress(const char *src, size_t size, char *dst, size_t capacity);
+int lz_decompress(const char *src, size_t size, char *dst, size_t raw_size);
+
+#endif
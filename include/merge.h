@@ -0,0 +1,45 @@
+#ifndef _MERGE_H
+#define _MERGE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../include/ledger.h"
+
+using namespace std;
+
+/**
+ * @brief one ledger file being merged and its next unconsumed entry.
+ */
+struct LedgerStream {
+  ifstream file;
+  Ledger next;
+  int index;  // position on the command line, breaks timestamp ties
+};
+
+/**
+ * @brief k-way merge of several ledger files by timestamp.
+ *
+ * Each file must be in time order on its own. Only one pending entry per
+ * file is held in memory: a binary min-heap keyed on (ts, index) picks the
+ * earliest one, and popping it reads the next line of the same file.
+ */
+class LedgerMerge {
+ private:
+  vector<LedgerStream *> heap;
+
+  bool advance(LedgerStream *s);
+  void sift_down(size_t i);
+  void sift_up(size_t i);
+
+ public:
+  string failed;  // the file open() could not open, if any
+
+  ~LedgerMerge();
+
+  int open(const vector<string> &files);
+  bool next(Ledger &entry);
+};
+
+#endif
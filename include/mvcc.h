@@ -0,0 +1,55 @@
+#ifndef _MVCC_H
+#define _MVCC_H
+
+#include <atomic>
+
+#include "table.h"
+
+using namespace std;
+
+// concurrent historical readers that can pin versions at once
+const int MVCC_READERS = 64;
+// a chain is trimmed after every this many versions pushed onto it
+const int MVCC_TRIM_EVERY = 64;
+
+/**
+ * @brief multi-version balance store.
+ *
+ * @details
+ * Every committed change to an account pushes a Version onto the account's
+ * chain while the account lock is held. Readers walk the chain without
+ * locks (inside an EpochGuard) and return the newest version whose ledgerID
+ * is not after the requested one, so they never block deposit, withdraw or
+ * transfer.
+ *
+ * Every MVCC_TRIM_EVERY versions pushed onto an account's chain, the writer
+ * trims the versions older than the horizon and retires them to the epoch
+ * domain, so a chain holds at most that many versions beyond the ones a
+ * reader may still need. The horizon is the oldest ledgerID any active
+ * reader has pinned, or `retain` ledger IDs behind the newest commit when
+ * that is older. Queries behind the horizon report that the version is no
+ * longer retained.
+ *
+ * A chain is in the order changes committed, which is the order workers
+ * took the account lock. Two workers that dequeued entries for the same
+ * account can take it in either order, so a chain is not necessarily in
+ * ledgerID order: "as of L" is the balance after the most recently
+ * committed change to the account with a ledgerID <= L.
+ */
+class VersionStore {
+ private:
+  int retain;
+  atomic<int> newest;
+  atomic<int> readers[MVCC_READERS];  // pinned ledgerID, or -1 if free
+
+  int horizon();
+  void trim(Account *acc, int below);
+
+ public:
+  VersionStore(int retain);
+
+  void record(Account *acc, int ledgerID);
+  bool read(Account *acc, int asof, long *balance);
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <pthread.h>
+#include <time.h> /* for clock_gettime() */
+#include <atomic>
+
+using namespace std;
+
+// controller sampling period and the lock wait share (per active worker)
+// above which adding workers is considered counterproductive
+const int POOL_SAMPLE_MS = 20;
+const double POOL_HIGH_WAIT = 0.5;
+// how long throughput must stay within 3% before the controller probes
+// one level further
+const int POOL_PROBE_MS = 500;
+
+// total nanoseconds workers spent blocked on ledger_lock and account locks
+extern atomic<long> lock_wait_ns;
+
+/**
+ * @brief lock a mutex, charging any time spent blocked to `lock_wait_ns`.
+ *
+ * The uncontended case is a single trylock, so the clock is only read when
+ * the caller actually has to wait.
+ */
+inline void timed_lock(pthread_mutex_t *m) {
+  if (pthread_mutex_trylock(m) == 0) { return; }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_mutex_lock(m);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  lock_wait_ns.fetch_add((end.tv_sec - start.tv_sec) * 1000000000L +
+                             (end.tv_nsec - start.tv_nsec),
+                         memory_order_relaxed);
+}
+
+/**
+ * @brief worker pool whose active size can change while the ledger runs.
+ *
+ * All `max_workers` threads are created up front. Workers with an ID at or
+ * above the current level park on a condition variable before taking the
+ * next entry. In adaptive mode a controller thread samples throughput and
+ * lock wait time and hill-climbs the level towards the best concurrency.
+ *
+ * pause() parks every worker after its current entry and returns once none
+ * is between wait_turn() and entry_done(), giving callers a quiescent point
+ * while the ledger is still running.
+ */
+class WorkerPool {
+ private:
+  int max_workers;
+  bool adaptive;
+  atomic<int> level;
+  atomic<long> processed;
+  atomic<bool> done;
+  atomic<bool> paused;
+  atomic<int> busy;  // workers between wait_turn() and entry_done()/leave()
+
+  pthread_mutex_t park_lock;
+  pthread_cond_t park_cond;
+  pthread_t controller_thread;
+
+  void set_level(int next, const char *reason, double tput, double wait);
+  static void *controller(void *self);
+
+ public:
+  WorkerPool(int max_workers, bool adaptive);
+  ~WorkerPool();
+
+  void start();
+  void finish();
+  void pause();
+  void resume();
+
+  /**
+   * @brief blocks the calling worker while its ID is above the active level
+   *        or the pool is paused, then marks it busy.
+   */
+  inline void wait_turn(int workerID) {
+    while (true) {
+      busy.fetch_add(1, memory_order_seq_cst);
+      if (workerID < level.load(memory_order_relaxed) &&
+          !paused.load(memory_order_seq_cst)) {
+        return;
+      }
+      busy.fetch_sub(1, memory_order_seq_cst);
+      park(workerID);
+      if (done) { busy.fetch_add(1, memory_order_seq_cst); return; }
+    }
+  }
+  void park(int workerID);
+
+  inline void entry_done() {
+    processed.fetch_add(1, memory_order_relaxed);
+    leave();
+  }
+  inline void leave() { busy.fetch_sub(1, memory_order_seq_cst); }
+  int active_workers() { return level.load(memory_order_relaxed); }
+};
+
+extern WorkerPool *pool;
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef _REPLICA_H
+#define _REPLICA_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <unordered_set>
+#include <vector>
+
+#include "hold.h"
+#include "table.h"
+
+using namespace std;
+
+class Bank;
+
+#define REPLICA_OFF 0
+#define REPLICA_ASYNC 1  // workers never wait for the standby
+#define REPLICA_SYNC 2   // an entry's changes are acknowledged before its
+                         // worker takes the next one
+
+// most records an async primary lets the standby fall behind by before
+// its workers wait
+const long REPLICA_WINDOW = 1 << 20;
+
+// ReplRecord kinds
+#define REPL_ACCOUNT 0  // an account's state after a change
+#define REPL_HOLD 1     // a hold was placed
+#define REPL_UNHOLD 2   // a hold was captured, released or expired
+
+/**
+ * @brief the state of one account after a change, or a hold placed or
+ *        closed, as shipped to the standby.
+ *
+ * Account records carry the account's change number, so the standby
+ * applies them in any order across accounts and in change order per
+ * account. A hold record names the hold by its ledgerID in `lsn`, with its
+ * amount in `balance`, expiry in `held` and the change number of the
+ * account record that goes with it in `pending`. Every record carries the
+ * ledgerID of the entry whose changes it ships.
+ */
+struct ReplRecord {
+  uint32_t accountID;
+  uint32_t lsn;
+  int32_t kind;      // REPL_ACCOUNT, REPL_HOLD or REPL_UNHOLD
+  int32_t ledgerID;
+  int32_t open;
+  int32_t pending;
+  int64_t balance;
+  int64_t held;
+  int64_t wallet[FX_CURRENCIES - 1];
+};
+
+/**
+ * @brief header of a batch of records on the replication socket, or with
+ *        `count` -1 the primary's last one.
+ */
+struct ReplBatch {
+  int64_t upto;      // records shipped so far, this batch included
+  int64_t count;     // records in this batch
+  int64_t since_ns;  // when the batch's first record was published
+  int64_t ledgerID;  // every entry up to this one has been shipped
+};
+
+/**
+ * @brief the standby's acknowledgement of a batch, or with `upto` -1 its
+ *        final digest.
+ */
+struct ReplAck {
+  int64_t upto;
+  int64_t since_ns;
+  int64_t accounts;  // final: open accounts
+  uint64_t digest;   // final: digest of their balances
+};
+
+/**
+ * @brief primary/backup replication of account state to a standby process.
+ *
+ * @details
+ * start() forks a hot standby holding a copy of the bank, connected by a
+ * Unix socket pair. On the primary every change records the account's new
+ * state, under its lock, in a per-thread buffer; commit() publishes the
+ * buffer once per ledger entry. A shipper thread sends whatever has been
+ * published as one batch per write, so workers publishing while a batch is
+ * in flight share the next one (group commit). The standby applies each
+ * batch to its own bank and acknowledges it; a reader thread on the primary
+ * measures the lag from publication to acknowledgement. In sync mode
+ * commit() waits until the standby has acknowledged the caller's records;
+ * in async mode it only waits if the standby is REPLICA_WINDOW records
+ * behind.
+ *
+ * Workers take entries in ledgerID order but finish them in any order, so
+ * each batch also names the last ledgerID up to which every entry taken
+ * has been committed. The standby holds back the records of later entries
+ * until that point passes them, and applies each account's records in
+ * change order. If the primary goes away before finish(), run_standby()
+ * returns so the standby can take over from that point. No account then
+ * shows the effect of a later entry. With one worker the state is exactly
+ * that of the entries up to the point. With several, an account changed
+ * first by a later entry and then by an earlier one keeps neither change.
+ * The account record of the earlier change is the account's whole state,
+ * which includes the later entry's change, so it stays held back.
+ */
+class Replicator {
+ private:
+  int mode;
+  int fd;
+  pid_t pid;
+  pthread_t shipper;
+  pthread_t reader;
+  pthread_mutex_t lock;
+  pthread_cond_t published_cond;  // records published, or closing
+  pthread_cond_t acked_cond;      // acknowledgement, or standby lost
+  vector<ReplRecord> pending;     // published, not yet shipped
+  long pending_since;             // when the first pending record came
+  long published;                 // records published
+  long acked;                     // records acknowledged
+  deque<pair<int, bool>> running;  // entries taken, whether committed
+  int upto;                       // every entry up to this one committed
+  bool closing;
+  bool lost;
+  ReplAck final_ack;
+  unordered_set<int> closed;      // standby: holds closed before placed
+
+  static void *ship(void *arg);
+  static void *collect(void *arg);
+  void apply(Bank *b, const ReplRecord &r);
+
+ public:
+  bool standby;     // true in the standby process
+  long batches;     // batches acknowledged
+  long lag_sum_ns;  // publication to acknowledgement, summed over batches
+  long lag_max_ns;
+
+  Replicator(int mode, int ledgerID);
+  ~Replicator();
+
+  int start();
+  void record(Account *acc);
+  void record_hold(const Account *acc, const Hold *h, bool placed);
+  void take(int ledgerID);
+  void commit(int ledgerID);
+  int run_standby(Bank *b, int *last);
+  bool finish(Bank *b);
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef _REPORT_H
+#define _REPORT_H
+
+#include <stdint.h>
+
+#define REPORT_TEXT 0  // "ID# {id} | {balance}" lines plus the counts line
+#define REPORT_CSV 1   // "account,balance" header and one row per account
+#define REPORT_BIN 2   // ReportHeader followed by ReportRecords
+
+const char REPORT_MAGIC[8] = {'B', 'A', 'N', 'K', 'R', 'P', 'T', '1'};
+
+/**
+ * @brief header of a binary report.
+ *
+ * `last_ledgerID` is the last ledger entry reflected in the balances, so a
+ * binary report doubles as a checkpoint to replay from.
+ */
+struct ReportHeader {
+  char magic[8];
+  int32_t last_ledgerID;
+  int32_t reserved;
+  int64_t count;
+};
+
+/**
+ * @brief one balance of an open account in a binary report.
+ *
+ * Every open account has a record for the base currency (0), followed by
+ * one per other currency it holds a non-zero balance in, numbered as in the
+ * FX rate table.
+ */
+struct ReportRecord {
+  uint32_t accountID;
+  int32_t currency;
+  int64_t balance;
+};
+
+const char STATE_MAGIC[8] = {'B', 'A', 'N', 'K', 'S', 'T', 'A', '1'};
+
+/**
+ * @brief header of the state section a --progress marker carries after its
+ *        ReportRecords: what a resumed run needs besides the balances.
+ *
+ * `clock` is the ledger clock; `holds` HoldRecords, `limits` LimitRecords
+ * and `schedules` ScheduleRecords follow, in that order. A report without
+ * the section restores with no holds, limits or schedules.
+ */
+struct StateHeader {
+  char magic[8];
+  int64_t clock;
+  int64_t holds;
+  int64_t limits;
+  int64_t schedules;
+};
+
+/**
+ * @brief one open authorization hold, named by the entry that placed it.
+ */
+struct HoldRecord {
+  int32_t ledgerID;
+  uint32_t accountID;
+  int64_t amount;
+  int64_t expires;  // ledger time, -1 = never
+};
+
+/**
+ * @brief the velocity window of an account with a limit.
+ */
+struct LimitRecord {
+  uint32_t accountID;
+  int32_t limit;
+  int32_t bucket_ticks;
+  int32_t outflow[4];  // VELOCITY_BUCKETS
+  int32_t reserved;
+  int64_t bucket;
+};
+
+/**
+ * @brief a scheduled entry still waiting, or an execution of one that came
+ *        due but had not run when the run was cancelled (`every` 0).
+ */
+struct ScheduleRecord {
+  int32_t acc;
+  int32_t other;
+  int32_t amount;
+  int32_t mode;  // the plain mode it runs with
+  int32_t ledgerID;
+  int32_t cur;
+  int32_t to;
+  int32_t remaining;  // executions left, 0 = no limit
+  int64_t exp;
+  int64_t credit;
+  int64_t expires;  // next execution on the ledger clock
+  int64_t every;    // period, 0 for a one-shot entry
+};
+
+#endif
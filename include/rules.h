@@ -0,0 +1,71 @@
+#ifndef _RULES_H
+#define _RULES_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../include/ledger.h"
+
+using namespace std;
+
+// ledger columns a rule can test
+#define RULE_ACC 0
+#define RULE_OTHER 1
+#define RULE_AMOUNT 2
+#define RULE_MODE 3
+const int RULE_FIELDS = 4;
+
+// entries screened per pass; the columns are always this long so the
+// compiler can vectorize the match loop
+const int RULE_BATCH = 256;
+
+/**
+ * @brief one row of the decision table: an entry matches when every column
+ *        lies in [lo, lo + span].
+ *
+ * Columns are stored biased (sign bit flipped) so a single unsigned
+ * subtract-and-compare tests both bounds. Columns the rule does not mention
+ * cover the whole range.
+ */
+struct Rule {
+  uint32_t lo[RULE_FIELDS];
+  uint32_t span[RULE_FIELDS];
+  int line;  // line of the rule in its file, reported when it denies
+};
+
+/**
+ * @brief transaction screening rules compiled from a --rules file.
+ *
+ * @details
+ * Every `deny` line becomes one row of a decision table and every account
+ * on a `block` line goes into a hash map. screen() copies a batch of
+ * entries into columns and runs each row as a branch-free loop over them,
+ * then looks the batch's accounts up in the blocklist; the first matching
+ * line of the file decides. Screening runs in the thread that loads the
+ * ledger, before entries are queued, so workers only check the verdict.
+ */
+class RuleSet {
+ private:
+  vector<Rule> table;
+  unordered_map<int, int> blocked;  // account -> line of its first block
+  uint32_t cols[RULE_FIELDS][RULE_BATCH];
+  int verdict[RULE_BATCH];
+
+  bool parse_condition(const string &cond, long lo[], long hi[]);
+  void screen_batch(Ledger *entries, int n);
+
+ public:
+  long screened;  // entries screened
+  long denied;    // entries denied
+  long nanos;     // time spent in screen()
+
+  RuleSet();
+
+  int load(const char *path);
+  void screen(Ledger *entries, size_t n);
+  size_t size();
+};
+
+#endif
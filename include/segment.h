@@ -0,0 +1,148 @@
+#ifndef _SEGMENT_H
+#define _SEGMENT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "logfmt.h"
+#include "logsink.h"
+
+using namespace std;
+
+const char SEG_MAGIC[8] = {'B', 'A', 'N', 'K', 'S', 'E', 'G', '1'};
+// uncompressed bytes per block, the unit of compression and random access
+const size_t SEG_BLOCK_SIZE = 64 << 10;
+// --log-segment-mb default
+const long SEG_DEFAULT_MB = 64;
+
+/**
+ * @brief header of a segment file, followed by its blocks.
+ */
+struct SegmentHeader {
+  char magic[8];
+  int32_t segment;  // its number, from 0
+  int32_t format;   // LOG_TEXT or LOG_BIN
+  LogHeader log;    // currency codes, for rendering LOG_BIN records
+};
+
+/**
+ * @brief header of a block in a segment file, followed by its bytes.
+ */
+struct BlockHeader {
+  uint32_t raw_size;     // bytes of log lines or records
+  uint32_t stored_size;  // bytes that follow; raw_size if stored uncompressed
+  int32_t min_lid;       // smallest and largest ledgerID logged in the
+  int32_t max_lid;       // block; max_lid < min_lid if none
+};
+
+/**
+ * @brief one block in the index file: where it is and what it holds.
+ */
+struct SegmentEntry {
+  int32_t segment;
+  int32_t reserved;
+  int64_t offset;  // of its BlockHeader in the segment file
+  BlockHeader block;
+};
+
+/**
+ * @brief one block of log lines being filled or waiting for compression.
+ */
+struct SegmentBlock {
+  vector<char> data;
+  int min_lid;
+  int max_lid;
+};
+
+/**
+ * @brief writer of the transaction log as compressed, rotating segments.
+ *
+ * @details
+ * Lines (or binary records) are copied into a SEG_BLOCK_SIZE block; a
+ * full block is queued for a compressor thread and the writer carries on
+ * with a spare block, allocating one if every block is queued, so a worker
+ * never waits for compression or the disk. The compressor packs each block
+ * with lz_compress() (kept as is if it does not shrink) and appends it to
+ * the current segment file, `<dir>/segment-NNNNNN.lz`, and an entry to
+ * `<dir>/index`. A segment is closed and the next one started before a
+ * block that would take it past `segment_bytes` on disk, or once it has
+ * been open `rotate_ms` milliseconds; the compressor wakes when that time
+ * comes and takes the partly filled block, so a quiet log rotates on time
+ * too. Each index entry records the range
+ * of ledgerIDs in its block, so SegmentReader reads only the blocks that
+ * may hold a given ledgerID. As a LogSink it takes records or their text
+ * as the format it was opened with says.
+ *
+ * @attention
+ * - append() is not thread safe; the banks call it under their log lock.
+ */
+class SegmentLog : public LogSink {
+ private:
+  string dir;
+  long segment_bytes;
+  long rotate_ms;
+  SegmentHeader header;
+  bool opened;
+  // compressor thread
+  pthread_t compressor;
+  pthread_mutex_t lock;
+  SegmentBlock *current;  // the block being filled, guarded by `lock`
+  pthread_cond_t queued_cond;  // a block was queued, or closing
+  deque<SegmentBlock *> queue;
+  vector<SegmentBlock *> spare;
+  bool closing;
+  // owned by the compressor thread until close() joins it
+  int fd;        // the open segment
+  int index_fd;
+  long offset;   // bytes written to the open segment
+  long opened_ns;
+  bool failed;
+  vector<char> packed;
+
+  SegmentBlock *take_spare();
+  void hand_off();
+  int start_segment();
+  void write_block(SegmentBlock *b);
+  static void *compress_loop(void *arg);
+
+ public:
+  long lines;   // lines, or records of a binary log
+  long raw_bytes;
+  long stored_bytes;
+  long blocks;
+  int segments;
+  long peak_queued;  // most blocks waiting for the compressor at once
+
+  SegmentLog(long segment_bytes, long rotate_ms);
+  ~SegmentLog();
+
+  int open(const char *dir, int format, const LogHeader &codes);
+  void append(const string &line, int lid);
+  void append(const void *data, size_t size, int lid);
+  void write(const LogRecord &r, const string &line);
+  int close();
+};
+
+/**
+ * @brief reader of a directory written by SegmentLog.
+ *
+ * @details
+ * open() loads the index and the first segment's header; read() can then
+ * be called from several threads at once.
+ */
+class SegmentReader {
+ public:
+  string dir;
+  SegmentHeader header;
+  vector<SegmentEntry> entries;
+
+  int open(const char *dir);
+  int read(const SegmentEntry &e, vector<char> *raw) const;
+};
+
+string segment_path(const string &dir, int segment);
+
+#endif
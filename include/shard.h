@@ -0,0 +1,45 @@
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "../include/ledger.h"
+
+using namespace std;
+
+// message kinds on the socket between the coordinator and a shard
+#define SHARD_ENTRY 0  // to a shard: an entry to run
+#define SHARD_END 1    // to a shard: no more entries; entry.ledgerID is the
+                       // next free ledgerID
+#define SHARD_VOTE 2   // from a shard: its vote on a prepared transfer
+#define SHARD_DONE 3   // from a shard: its counts, then its binary report
+
+// entries the coordinator batches per shard before writing them
+const size_t SHARD_BATCH = 256;
+
+/**
+ * @brief one fixed-size message between the coordinator and a shard.
+ *
+ * Both ends are the same binary on the same host, so entries are sent as
+ * they are laid out in memory.
+ */
+struct ShardMsg {
+  int32_t kind;
+  int32_t vote;       // SHARD_VOTE: 1 yes, 0 no
+  int32_t counts[3];  // SHARD_DONE: successes, failures, duplicates
+  Ledger entry;       // SHARD_VOTE: the prepare voted on, mode included
+};
+
+// the shard this process runs, -1 in the coordinator or without --shards
+extern int shard_id;
+
+int shard_of(int acc);
+int start_shards();
+void shard_claim(Bank *b);
+void coordinate();
+bool shard_receive(vector<Ledger> &batch, int *next);
+void shard_vote(const Ledger &entry, bool yes);
+int shard_finish(int last_ledgerID);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef _SKETCH_H
+#define _SKETCH_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// count-min rows and counters per row (each row indexes with 16 bits of one
+// 64-bit hash), and heavy-hitter candidates each thread keeps
+const int SKETCH_DEPTH = 4;
+const int SKETCH_WIDTH = 1 << 12;
+const int SKETCH_CANDIDATES = 32;
+
+struct SketchCandidate {
+  int acc;
+  uint32_t est;
+};
+
+/**
+ * @brief one thread's count-min sketch and heavy-hitter candidates.
+ *
+ * `floor` is the smallest candidate estimate once the list is full, so an
+ * update whose estimate does not beat it costs one comparison.
+ */
+struct ThreadSketch {
+  uint32_t counts[SKETCH_DEPTH][SKETCH_WIDTH];
+  SketchCandidate top[SKETCH_CANDIDATES];
+  int num_top;
+  uint32_t floor;
+  long total;
+};
+
+/**
+ * @brief account access frequencies, estimated with per-thread count-min
+ *        sketches.
+ *
+ * @details
+ * Each thread updates only its own sketch, so touch() takes no lock and
+ * writes SKETCH_DEPTH counters in a 64 KiB table that stays in cache. A
+ * count-min estimate never undercounts, and overcounts by at most a small
+ * share of all accesses. Sketches merge by adding counters; report()
+ * re-estimates every thread's candidates against the merged sketch to rank
+ * the top accounts.
+ */
+class AccessSketch {
+ private:
+  pthread_mutex_t lock;
+  vector<ThreadSketch *> sketches;
+
+  ThreadSketch *attach();
+  void promote(ThreadSketch *s, int acc, uint32_t est);
+
+ public:
+  AccessSketch();
+  ~AccessSketch();
+
+  void touch(int acc);
+  void report(int k);
+};
+
+#endif
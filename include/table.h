@@ -0,0 +1,110 @@
+#ifndef _TABLE_H
+#define _TABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+
+using namespace std;
+
+// accounts live in fixed-size segments that never move once allocated
+const int SEG_SHIFT = 12;
+const int SEG_SIZE = 1 << SEG_SHIFT;
+const int SEG_MASK = SEG_SIZE - 1;
+const int MAX_ACCOUNTS = 1 << 28;
+
+/**
+ * @brief one committed balance of an account (see VersionStore).
+ */
+struct Version {
+  int ledgerID;
+  long balance;
+  atomic<Version *> older;
+};
+
+// buckets in an account's velocity window
+const int VELOCITY_BUCKETS = 4;
+
+// currencies an account can hold; currency 0 is the base currency, kept in
+// `balance`, the others in `wallet`
+const int FX_CURRENCIES = 4;
+
+/**
+ * @brief one account slot.
+ *
+ * Aligned to a cache line, with everything an operation reads or updates
+ * under the lock (balance, holds, velocity window) in the first line and
+ * the lock itself in the second, so neighbouring accounts never share a
+ * line. Balances in other currencies live out of line, so an account that
+ * only ever holds the base currency costs one NULL pointer.
+ */
+struct alignas(64) Account {
+  unsigned int accountID;
+  int open;  // 1 while the account is open, guarded by `lock`
+  long balance;
+  long held;  // authorized but not yet captured, guarded by `lock`
+  int limit;         // most that may leave per window, 0 = no limit
+  int bucket_ticks;  // ledger ticks per velocity bucket
+  long bucket;       // newest bucket: ledger clock / bucket_ticks
+  int outflow[VELOCITY_BUCKETS];  // outflow per bucket, ring indexed by bucket
+  atomic<Version *> versions;  // newest first, NULL unless MVCC is enabled
+  pthread_mutex_t lock;
+  long *wallet;  // currencies 1.. at [cur - 1], NULL until first credited
+  int pending;   // prepared incoming cross-shard transfers, guarded by `lock`
+  uint32_t lsn;  // changes shipped to a standby, guarded by `lock`
+  int untrimmed;  // versions pushed since the chain was last trimmed
+};
+
+/**
+ * @brief top level of the account table: an array of segment pointers.
+ *
+ * A directory is replaced (never resized in place) when the table outgrows
+ * it. The old one is retired to the epoch domain, so readers still holding
+ * it see valid segments until they leave their critical section.
+ */
+struct Directory {
+  int capacity;
+  atomic<Account *> *segs;
+};
+
+/**
+ * @brief two-level account table that can grow while workers are running.
+ *
+ * Lookups are lock-free: they load the published size, the current
+ * directory and the segment pointer, and must run inside an EpochGuard.
+ * The directory is sparse: only segments that hold an opened ID are
+ * allocated, so walks over the table skip NULL segments.
+ * Growth is serialised by `grow_lock`, which only open() and the constructor
+ * take, so deposit, withdraw and transfer never wait on a resize.
+ */
+class AccountTable {
+ private:
+  atomic<int> num;
+  atomic<Directory *> dir;
+  pthread_mutex_t grow_lock;
+
+  static Directory *new_directory(int capacity);
+  static void free_directory(void *d);
+
+ public:
+  AccountTable();
+  ~AccountTable();
+
+  bool grow(int n);
+
+  /**
+   * @brief returns the account slot for `id`, or NULL if the table does not
+   *        cover it or its segment was never allocated. The slot address
+   *        stays valid for the table's lifetime.
+   */
+  inline Account *get(int id) {
+    if (id < 0 || id >= num.load(memory_order_acquire)) { return NULL; }
+    Directory *d = dir.load(memory_order_acquire);
+    Account *seg = d->segs[id >> SEG_SHIFT].load(memory_order_acquire);
+    return seg == NULL ? NULL : seg + (id & SEG_MASK);
+  }
+
+  inline int size() { return num.load(memory_order_acquire); }
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _WHEEL_H
+#define _WHEEL_H
+
+#include <stddef.h> /* for NULL */
+#include <stdint.h>
+#include <vector>
+
+// slots per level (one bit each in a uint64_t occupancy mask) and levels;
+// together they cover 2^(WHEEL_BITS * WHEEL_LEVELS) ticks ahead
+const int WHEEL_BITS = 6;
+const int WHEEL_SIZE = 1 << WHEEL_BITS;
+const int WHEEL_LEVELS = 6;
+
+/**
+ * @brief an entry in a TimingWheel.
+ *
+ * Timers are intrusive: the owner embeds or derives from Timer, sets
+ * `expires` and hands it to the wheel, which links it into a slot without
+ * allocating.
+ */
+struct Timer {
+  long expires;
+  Timer *prev;
+  Timer *next;
+  int level;  // -1 while not in a wheel
+  int slot;
+
+  Timer() : expires(0), prev(NULL), next(NULL), level(-1), slot(0) {}
+  virtual ~Timer() {}
+};
+
+/**
+ * @brief hierarchical timing wheel.
+ *
+ * @details
+ * Level l has WHEEL_SIZE slots of WHEEL_SIZE^l ticks each. A timer goes
+ * into the lowest level whose span covers its distance from `now`, so
+ * insert and remove are O(1). When the clock crosses the start of a
+ * higher-level slot, that slot is cascaded: its timers are re-inserted
+ * closer to the bottom, and level 0 slots expire their timers. An
+ * occupancy mask per level lets advance() jump straight to the next tick
+ * at which a slot is due, so idle stretches of time cost nothing.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+class TimingWheel {
+ private:
+  long now;
+  long pending;
+  Timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+  uint64_t occupied[WHEEL_LEVELS];
+
+  bool link(Timer *t);
+  void unlink(Timer *t);
+  long next_event();
+
+ public:
+  TimingWheel(long start);
+  ~TimingWheel();
+
+  bool insert(Timer *t);
+  void remove(Timer *t);
+  Timer *advance(long to);
+  void list(std::vector<Timer *> &out);
+
+  long time() { return now; }
+  long size() { return pending; }
+};
+
+#endif
@@ -1,19 +1,30 @@
 #include "../include/bank.h"
+#include "../include/epoch.h"
+#include "../include/pool.h"
 
 /**
  * @brief prints account information
  */
 void Bank::print_account() {
+  EpochGuard guard;
+  int num = accounts.size();
   for (int i = 0; i < num; i++) {
-    pthread_mutex_lock(&accounts[i].lock);
-    cout << "ID# " << accounts[i].accountID << " | " << accounts[i].balance
-         << endl;
-    pthread_mutex_unlock(&accounts[i].lock);
+    Account *acc = accounts.get(i);
+    // skip the rest of a segment that was never allocated
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    pthread_mutex_lock(&acc->lock);
+    if (acc->open) {
+      cout << "ID# " << acc->accountID << " | " << acc->balance << endl;
+    }
+    pthread_mutex_unlock(&acc->lock);
   }
 
-  pthread_mutex_lock(&bank_lock);
+  pthread_mutex_lock(log_lock);
   cout << "Success: " << num_succ << " Fails: " << num_fail << endl;
-  pthread_mutex_unlock(&bank_lock);
+  pthread_mutex_unlock(log_lock);
 }
 
 /**
@@ -23,10 +34,7 @@ void Bank::print_account() {
  * @param message
  */
 void Bank::recordFail(string message) {
-  pthread_mutex_lock(&bank_lock);
-  cout << message << endl;
-  num_fail++;
-  pthread_mutex_unlock(&bank_lock);
+  log_message(message, LOG_FAIL, &num_fail);
 }
 
 /**
@@ -36,25 +44,64 @@ void Bank::recordFail(string message) {
  * @param message
  */
 void Bank::recordSucc(string message) {
-  pthread_mutex_lock(&bank_lock);
-  cout << message << endl;
-  num_succ++;
-  pthread_mutex_unlock(&bank_lock);
+  log_message(message, LOG_SUCC, &num_succ);
 }
 
 /***************************************************
  * DO NOT MODIFY ABOVE CODE
  ****************************************************/
 
+/**
+ * @brief returns the success, fail and duplicate counts.
+ */
+void Bank::counts(int *succ, int *fail, int *dup) {
+  pthread_mutex_lock(log_lock);
+  *succ = num_succ;
+  *fail = num_fail;
+  *dup = num_dup;
+  pthread_mutex_unlock(log_lock);
+}
+
+/**
+ * @brief adds counts kept elsewhere, such as by a shard process, to this
+ *        bank's.
+ */
+void Bank::add_counts(int succ, int fail, int dup) {
+  pthread_mutex_lock(log_lock);
+  num_succ += succ;
+  num_fail += fail;
+  num_dup += dup;
+  pthread_mutex_unlock(log_lock);
+}
+
+/**
+ * @brief returns the number of duplicate entries rejected.
+ */
+int Bank::duplicates() {
+  pthread_mutex_lock(log_lock);
+  int n = num_dup;
+  pthread_mutex_unlock(log_lock);
+  return n;
+}
+
+/**
+ * @brief prints the success and fail counts on their own.
+ */
+void Bank::print_counts() {
+  pthread_mutex_lock(log_lock);
+  cout << "Success: " << num_succ << " Fails: " << num_fail << endl;
+  pthread_mutex_unlock(log_lock);
+}
+
 /**
  * @brief Construct a new Bank object.
  *
  * @details
- * This constructor initializes the private variables of the Bank class, creates
- * a new array of type Accounts with a specified size (N), and initializes each
- * account. The accounts are identified by their accountID, and their initial
- * balance is set to 0. Additionally, mutexes are initialized for each account
- * to ensure thread safety during concurrent operations.
+ * This constructor initializes the private variables of the Bank class, grows
+ * the account table to a specified size (N), and opens each account. The
+ * accounts are identified by their accountID, and their initial balance is set
+ * to 0. The table initializes a mutex for each account slot to ensure thread
+ * safety during concurrent operations, and can grow later through open().
  *
  * @attention
  * - The function requires an integer parameter N to specify the number of
@@ -65,20 +112,25 @@ void Bank::recordSucc(string message) {
 Bank::Bank(int N) {
   // initialize bank lock
   pthread_mutex_init(&bank_lock, NULL);
+  log_lock = &bank_lock;
+  tenant = 0;
   // initialize bank fields
-  num = N; 
   num_succ = 0;
   num_fail = 0;
-  // create new array of accounts of size N
-  accounts = new Account[num]; 
-  // initialize each account lock, balance, id
-  for (int i = 0; i < num; i++) {
-    // reference vars
-    Account& current = accounts[i];
-    // initialize fields
-    pthread_mutex_init(&current.lock, NULL);
-    current.balance = 0; 
-    current.accountID = i;
+  num_dup = 0;
+  versions = NULL;
+  replica = NULL;
+  log_sink = &log_cout;
+  log_header(&log_codes, NULL);
+  fx = NULL;
+  history = NULL;
+  net_flow = 0;
+  for (atomic<long> &flow : fx_flow) { flow = 0; }
+  clock = 0;
+  // create account slots 0..N-1 and open them
+  for (int i = 0; i < N; i++) {
+    accounts.grow(i + 1);
+    accounts.get(i)->open = 1;
   }
 }
 
@@ -87,9 +139,10 @@ Bank::Bank(int N) {
  *
  * @details
  * This destructor is responsible for cleaning up the resources used by the Bank
- * object. It ensures that all locks associated with the bank and its accounts
- * are destroyed, and the allocated memory for accounts is freed. Additionally,
- * the bank-wide mutex is destroyed.
+ * object. The bank-wide mutex is destroyed here; the account table destroys
+ * the per-account locks and frees its segments when it goes out of scope.
+ * Workers have joined by now, so everything the bank retired to the epoch
+ * domain is freed immediately.
  *
  * @attention
  * - This destructor is automatically called when a Bank object goes out of
@@ -98,12 +151,11 @@ Bank::Bank(int N) {
 Bank::~Bank() {
   // destroy bank lock
   pthread_mutex_destroy(&bank_lock);
-  // destroy locks associated with all accounts
-  for (int i = 0; i < num; i++) {
-    pthread_mutex_destroy(&accounts[i].lock); 
-  }
-  // destroy accounts
-  delete[] accounts;
+  delete versions;
+  delete history;
+  delete fx;
+  // free retired structures (quiescent point)
+  epochs.drain();
 }
 
 /**
@@ -113,24 +165,80 @@ Bank::~Bank() {
  * This function deposits the specified amount into the specified account and
  * logs the transaction in the following format:
  *   `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} DEPOSIT ${amount}`
- * using the DEPOSIT_MSG() macro for consistent formatting.
+ * using the DEPOSIT_MSG() macro for consistent formatting. Deposits into an
+ * account that does not exist or is closed fail and are logged as `[ FAIL ]`.
  *
  * @param workerID The ID of the worker (thread).
  * @param ledgerID The ID of the ledger entry.
  * @param accountID The account ID to deposit.
  * @param amount The amount to deposit.
- * @return 0 on success.
+ * @return 0 on success, -1 on failure.
  */
 int Bank::deposit(int workerID, int ledgerID, int accountID, int amount) {
+  // table lookups and account state stay valid until the guard is released
+  EpochGuard guard;
   // reference vars
-  Account& current = accounts[accountID];
+  Account *current = accounts.get(accountID);
+  if (current == NULL) {
+    recordFail(DEPOSIT_LOG(workerID, ledgerID, accountID, amount));
+    return -1;
+  }
+  int successful = 0;
   // critical section
-  pthread_mutex_lock(&current.lock);
-  current.balance += amount; 
-  recordSucc(DEPOSITE_MSG(SUCC, workerID, ledgerID, accountID, amount));
-  pthread_mutex_unlock(&current.lock); 
-  // success
-  return 0;
+  timed_lock(&current->lock);
+  if (current->open) {
+    current->balance += amount; 
+    net_flow.fetch_add(amount, memory_order_relaxed);
+    if (versions) { versions->record(current, ledgerID); }
+    if (replica) { replica->record(current); }
+    if (history) { history->record(accountID, ledgerID, amount); }
+    recordSucc(DEPOSIT_LOG(workerID, ledgerID, accountID, amount));
+  } else {
+    recordFail(DEPOSIT_LOG(workerID, ledgerID, accountID, amount));
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock); 
+  return successful;
+}
+
+/**
+ * @brief Checks an outflow against the account's velocity limit.
+ *
+ * @details
+ * The window is VELOCITY_BUCKETS buckets of `bucket_ticks` on the ledger
+ * clock, so it covers between window - bucket_ticks and window ticks.
+ * Buckets that have rotated out are cleared here, lazily, so an account
+ * only pays for the buckets that passed since its last outflow. An account
+ * without a limit returns at the first branch.
+ *
+ * @attention
+ * - The caller holds the account lock.
+ *
+ * @return true if `amount` fits, false if it would exceed the limit.
+ */
+static inline bool velocity_ok(Account *acc, long amount, long now) {
+  if (acc->limit == 0) { return true; }
+  long b = now / acc->bucket_ticks;
+  if (b > acc->bucket) {
+    long stale = b - acc->bucket < VELOCITY_BUCKETS ? b - acc->bucket
+                                                    : VELOCITY_BUCKETS;
+    for (long i = 1; i <= stale; i++) {
+      acc->outflow[(acc->bucket + i) % VELOCITY_BUCKETS] = 0;
+    }
+    acc->bucket = b;
+  }
+  long sum = 0;
+  for (int i = 0; i < VELOCITY_BUCKETS; i++) { sum += acc->outflow[i]; }
+  return sum + amount <= acc->limit;
+}
+
+/**
+ * @brief charges a successful outflow to the account's newest bucket after
+ *        velocity_ok() passed.
+ */
+static inline void velocity_charge(Account *acc, long amount) {
+  if (acc->limit == 0) { return; }
+  acc->outflow[acc->bucket % VELOCITY_BUCKETS] += amount;
 }
 
 /**
@@ -148,7 +256,12 @@ int Bank::deposit(int workerID, int ledgerID, int accountID, int amount) {
  *
  * @attention
  * - The function ensures that the account has a large enough balance for a
- * successful withdrawal.
+ * successful withdrawal. Money reserved by authorization holds is not
+ * available.
+ * - Withdrawals from an account that does not exist or is closed fail.
+ * - A withdrawal that would take more than the account's velocity limit out
+ * within its window fails with ` (VELOCITY LIMIT)` appended to the log line
+ * (LIMIT_REASON).
  *
  * @param workerID The ID of the worker (thread).
  * @param ledgerID The ID of the ledger entry.
@@ -157,24 +270,41 @@ int Bank::deposit(int workerID, int ledgerID, int accountID, int amount) {
  * @return 0 on success, -1 on failure.
  */
 int Bank::withdraw(int workerID, int ledgerID, int accountID, int amount) {
+  EpochGuard guard;
   // reference vars
-  Account& current = accounts[accountID]; 
+  Account *current = accounts.get(accountID); 
   int successful = 0; 
+  if (current == NULL) {
+    recordFail(WITHDRAW_LOG(workerID, ledgerID, accountID, amount));
+    return -1;
+  }
   // lock
-  pthread_mutex_lock(&current.lock);
+  timed_lock(&current->lock);
+  bool funds = current->open && amount <= current->balance - current->held;
   // case 1 valid
-  if (amount <= current.balance) {
+  if (funds && velocity_ok(current, amount, clock.load(memory_order_relaxed))) {
     // withdraw 
-    current.balance -= amount; 
-    recordSucc(WITHDRAW_MSG(SUCC, workerID, ledgerID, accountID, amount));
+    current->balance -= amount; 
+    velocity_charge(current, amount);
+    net_flow.fetch_sub(amount, memory_order_relaxed);
+    if (versions) { versions->record(current, ledgerID); }
+    if (replica) { replica->record(current); }
+    if (history) { history->record(accountID, ledgerID, -(long)amount); }
+    recordSucc(WITHDRAW_LOG(workerID, ledgerID, accountID, amount));
   }
-  // case 2 invalid
+  // case 2 over the velocity limit
+  else if (funds) {
+    recordFail(WITHDRAW_LOG(workerID, ledgerID, accountID, amount),
+               true);
+    successful = -1;
+  }
+  // case 3 invalid
   else { 
-    recordFail(WITHDRAW_MSG(ERR, workerID, ledgerID, accountID, amount));
+    recordFail(WITHDRAW_LOG(workerID, ledgerID, accountID, amount));
     successful = -1;
   }
   // unlock
-  pthread_mutex_unlock(&current.lock);
+  pthread_mutex_unlock(&current->lock);
   return successful;
 }
 
@@ -191,12 +321,16 @@ int Bank::withdraw(int workerID, int ledgerID, int accountID, int amount) {
  * - The function requires careful consideration of the locking order to prevent
  *     deadlock.
  * - It ensures that there is enough money in the source account before
- *     performing the transfer.
+ *     performing the transfer, not counting money reserved by holds.
  * - On success it logs: `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc:
  *      {accountID} TRANSFER ${amount} TO Acc: {destID}`
  * - On faiure it logs: `[ ERROR ] TID: {workerID}, LID: {ledgerID}, Acc:
  *      {accountID} TRANSFER ${amount} TO Acc: {destID}`
  * - Transfer from srcID = n to destID = n is a failure
+ * - Transfer from or to an account that does not exist or is closed is a
+ *     failure
+ * - A transfer over the source account's velocity limit is a failure logged
+ *     with LIMIT_REASON appended
  *
  * @param workerID The ID of the worker (thread).
  * @param ledgerID The ID of the ledger entry.
@@ -206,38 +340,986 @@ int Bank::withdraw(int workerID, int ledgerID, int accountID, int amount) {
  * @return 0 on success, -1 on error.
  */
 int Bank::transfer(int workerID, int ledgerID, int srcID, int destID, unsigned int amount) {
+  EpochGuard guard;
   // reference vars
-  Account& source = accounts[srcID];
-  Account& destination = accounts[destID]; 
+  Account *source = accounts.get(srcID);
+  Account *destination = accounts.get(destID); 
   int successful = 0; 
   // error case
   if (srcID == destID) { return -1; }
+  if (source == NULL || destination == NULL) {
+    recordFail(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount));
+    return -1;
+  }
   // lock based on src and destID
   if (srcID < destID) {
-    pthread_mutex_lock(&source.lock); // 213 locked --> context switch
-    pthread_mutex_lock(&destination.lock); 
+    timed_lock(&source->lock); // 213 locked --> context switch
+    timed_lock(&destination->lock); 
   }
   else {
-    pthread_mutex_lock(&destination.lock); // 213 already locked --> wait
-    pthread_mutex_lock(&source.lock); 
+    timed_lock(&destination->lock); // 213 already locked --> wait
+    timed_lock(&source->lock); 
   }
-  // check if source balance is enough
-  if (amount <= source.balance) {
+  // check both accounts are open and source balance is enough
+  bool funds = source->open && destination->open &&
+               amount <= source->balance - source->held;
+  if (funds && velocity_ok(source, amount, clock.load(memory_order_relaxed))) {
     // transfer amounts
-    source.balance -= amount;
-    destination.balance += amount;
-    recordSucc(TRANSFER_MSG(SUCC, workerID, ledgerID, srcID, destID, amount));
+    source->balance -= amount;
+    destination->balance += amount;
+    velocity_charge(source, amount);
+    if (versions) {
+      versions->record(source, ledgerID);
+      versions->record(destination, ledgerID);
+    }
+    if (replica) {
+      replica->record(source);
+      replica->record(destination);
+    }
+    if (history) {
+      history->record(srcID, ledgerID, -(long)amount);
+      history->record(destID, ledgerID, amount);
+    }
+    recordSucc(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount));
+  } else if (funds) {
+    recordFail(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount),
+               true);
+    successful = -1;
   } else {
-    recordFail(TRANSFER_MSG(ERR, workerID, ledgerID, srcID, destID, amount));
+    recordFail(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount));
     successful = -1; 
   }
   // unlock using same ordering
   if (srcID < destID) {
-    pthread_mutex_unlock(&destination.lock);
-    pthread_mutex_unlock(&source.lock);
+    pthread_mutex_unlock(&destination->lock);
+    pthread_mutex_unlock(&source->lock);
+  } else {
+    pthread_mutex_unlock(&source->lock);
+    pthread_mutex_unlock(&destination->lock);
+  }
+  return successful;
+}
+
+/**
+ * @brief Opens an account, growing the account table if needed.
+ *
+ * @details
+ * Grows the table so that it covers `accountID` and opens the account with
+ * `amount` as its initial balance. Growing only takes the table's grow lock,
+ * so concurrent deposits, withdrawals and transfers keep running. Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} OPEN ${amount}`
+ * using the OPEN_MSG() macro.
+ *
+ * @attention
+ * - Opening an account that is already open is a failure.
+ * - Account IDs must be in [0, MAX_ACCOUNTS).
+ * - A closed account can be opened again.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID to open.
+ * @param amount The initial balance.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::open(int workerID, int ledgerID, int accountID, int amount) {
+  EpochGuard guard;
+  if (accountID < 0 || amount < 0 || !accounts.grow(accountID + 1)) {
+    recordFail(OPEN_LOG(workerID, ledgerID, accountID, amount));
+    return -1;
+  }
+  Account *current = accounts.get(accountID);
+  int successful = 0;
+  timed_lock(&current->lock);
+  if (!current->open) {
+    current->open = 1;
+    current->balance = amount;
+    net_flow.fetch_add(amount, memory_order_relaxed);
+    if (versions) { versions->record(current, ledgerID); }
+    if (replica) { replica->record(current); }
+    if (history) { history->record(accountID, ledgerID, amount); }
+    recordSucc(OPEN_LOG(workerID, ledgerID, accountID, amount));
+  } else {
+    recordFail(OPEN_LOG(workerID, ledgerID, accountID, amount));
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock);
+  return successful;
+}
+
+/**
+ * @brief returns true if an account holds nothing in currencies other than
+ *        the base.
+ */
+static inline bool wallet_empty(const Account *acc) {
+  if (acc->wallet == NULL) { return true; }
+  for (int c = 0; c < FX_CURRENCIES - 1; c++) {
+    if (acc->wallet[c] != 0) { return false; }
+  }
+  return true;
+}
+
+/**
+ * @brief Closes an account.
+ *
+ * @details
+ * An open account with a zero balance is closed; its slot stays in the table
+ * and later operations on it fail until it is opened again. Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} CLOSE`
+ * using the CLOSE_MSG() macro.
+ *
+ * @attention
+ * - Closing an account that does not exist, is already closed, still holds
+ * money in any currency, has open holds or is the destination of a prepared
+ * cross-shard transfer is a failure.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID to close.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::close(int workerID, int ledgerID, int accountID) {
+  EpochGuard guard;
+  Account *current = accounts.get(accountID);
+  if (current == NULL) {
+    recordFail(CLOSE_LOG(workerID, ledgerID, accountID));
+    return -1;
+  }
+  int successful = 0;
+  timed_lock(&current->lock);
+  if (current->open && current->balance == 0 && current->held == 0 &&
+      current->pending == 0 && wallet_empty(current)) {
+    current->open = 0;
+    // the wallet is empty; a reader may still hold it, so it is retired
+    // rather than freed, and a reopened account starts without one
+    if (current->wallet) {
+      long *wallet = current->wallet;
+      current->wallet = NULL;
+      epochs.retire_array(wallet);
+    }
+    if (versions) { versions->record(current, ledgerID); }
+    if (replica) { replica->record(current); }
+    if (history) { history->record(accountID, ledgerID, 0); }
+    recordSucc(CLOSE_LOG(workerID, ledgerID, accountID));
+  } else {
+    recordFail(CLOSE_LOG(workerID, ledgerID, accountID));
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock);
+  return successful;
+}
+/**
+ * @brief Turns on the multi-version balance store.
+ *
+ * @details
+ * Seeds every open account with a version tagged ledgerID -1 holding its
+ * current balance, so reads as of any ledgerID before the account's first
+ * change succeed. Call before the workers start.
+ *
+ * @param retain How many ledger IDs of history to keep when no reader needs
+ * older versions.
+ */
+void Bank::enable_versions(int retain) {
+  EpochGuard guard;
+  versions = new VersionStore(retain);
+  int num = accounts.size();
+  for (int i = 0; i < num; i++) {
+    Account *acc = accounts.get(i);
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    if (acc->open) { versions->record(acc, -1); }
+  }
+}
+
+/**
+ * @brief Turns on the per-account history index. Every successful change is
+ *        recorded with its signed amount (0 for a close). Call before the
+ *        workers start.
+ */
+void Bank::enable_history() {
+  history = new HistoryIndex();
+}
+
+/**
+ * @brief Reads the balance of an account as of a ledgerID while traffic runs.
+ *
+ * @details
+ * Uses the version store only, so it never takes the account lock and never
+ * blocks deposit, withdraw or transfer. Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} BALANCE AS OF LID: {asof} ${balance}`
+ * using the QUERY_MSG() macro. Reads do not change the success or fail
+ * counts.
+ *
+ * @attention
+ * - Fails if MVCC is disabled, the account does not exist, or the version as
+ * of `asof` has already been trimmed.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID to read.
+ * @param asof The ledgerID to read the balance as of.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::query(int workerID, int ledgerID, int accountID, int asof) {
+  EpochGuard guard;
+  Account *current = accounts.get(accountID);
+  long balance = 0;
+  if (versions == NULL || current == NULL ||
+      !versions->read(current, asof, &balance)) {
+    recordQuery(QUERY_LOG(workerID, ledgerID, accountID, asof, 0), false);
+    return -1;
+  }
+  recordQuery(QUERY_LOG(workerID, ledgerID, accountID, asof, balance));
+  return 0;
+}
+
+/**
+ * @brief Reserves money on an account for a later capture.
+ *
+ * @details
+ * Adds `amount` to the account's held funds, which withdraw(), transfer()
+ * and capture() of other holds can no longer use. The hold is named by this
+ * entry's ledgerID. Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} AUTHORIZE ${amount}`
+ * using the AUTHORIZE_MSG() macro. An authorization only reserves money, so
+ * the balance and the net flow do not change.
+ *
+ * @attention
+ * - Fails if the account does not exist or is closed, `amount` is not
+ * positive, or the available funds (balance minus held) are too small.
+ * - With `expires` >= 0 the hold is released automatically once the ledger
+ * clock reaches it (see advance_clock()); a time already passed fails.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry, which names the hold.
+ * @param accountID The account ID to hold funds on.
+ * @param amount The amount to hold.
+ * @param expires The ledger time the hold expires at, or -1 for never.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::authorize(int workerID, int ledgerID, int accountID, int amount,
+                    long expires) {
+  EpochGuard guard;
+  Account *current = accounts.get(accountID);
+  if (current == NULL || amount <= 0) {
+    recordFail(AUTHORIZE_LOG(workerID, ledgerID, accountID, amount));
+    return -1;
+  }
+  Hold *h = new Hold;
+  h->ledgerID = ledgerID;
+  h->accountID = accountID;
+  h->amount = amount;
+  h->expires = expires;
+  int successful = 0;
+  timed_lock(&current->lock);
+  if (current->open && amount <= current->balance - current->held &&
+      holds.add(h, expires >= 0)) {
+    current->held += amount;
+    if (replica) {
+      replica->record(current);
+      replica->record_hold(current, h, true);
+    }
+    recordSucc(AUTHORIZE_LOG(workerID, ledgerID, accountID, amount));
+  } else {
+    recordFail(AUTHORIZE_LOG(workerID, ledgerID, accountID, amount));
+    delete h;
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock);
+  return successful;
+}
+
+/**
+ * @brief Captures an authorized amount, releasing the rest of the hold.
+ *
+ * @details
+ * Closes hold `holdID` on the account and withdraws `amount` of it; any
+ * remainder becomes available again. Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} CAPTURE ${amount} OF HOLD LID: {holdID}`
+ * using the CAPTURE_MSG() macro.
+ *
+ * @attention
+ * - Fails, leaving the hold open, if no hold `holdID` is open on the account
+ * or `amount` exceeds it.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID the hold is on.
+ * @param holdID The ledgerID of the authorization.
+ * @param amount The amount to capture.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::capture(int workerID, int ledgerID, int accountID, int holdID,
+                  int amount) {
+  EpochGuard guard;
+  Hold *h = amount < 0 ? NULL : holds.take(holdID, accountID, amount);
+  if (h == NULL) {
+    recordFail(CAPTURE_LOG(workerID, ledgerID, accountID, holdID, amount));
+    return -1;
+  }
+  // an account with an open hold cannot be closed, so it is still open
+  Account *current = accounts.get(accountID);
+  timed_lock(&current->lock);
+  current->held -= h->amount;
+  current->balance -= amount;
+  net_flow.fetch_sub(amount, memory_order_relaxed);
+  if (versions) { versions->record(current, ledgerID); }
+  if (replica) {
+    replica->record(current);
+    replica->record_hold(current, h, false);
+  }
+  if (history) { history->record(accountID, ledgerID, -(long)amount); }
+  recordSucc(CAPTURE_LOG(workerID, ledgerID, accountID, holdID, amount));
+  pthread_mutex_unlock(&current->lock);
+  delete h;
+  return 0;
+}
+
+/**
+ * @brief Releases a hold without capturing any of it.
+ *
+ * @details
+ * Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} RELEASE ${amount} OF HOLD LID: {holdID}`
+ * using the RELEASE_MSG() macro, where `amount` is the amount that was held.
+ *
+ * @attention
+ * - Fails if no hold `holdID` is open on the account.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID the hold is on.
+ * @param holdID The ledgerID of the authorization.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::release(int workerID, int ledgerID, int accountID, int holdID) {
+  EpochGuard guard;
+  Hold *h = holds.take(holdID, accountID, 0);
+  if (h == NULL) {
+    recordFail(RELEASE_LOG(workerID, ledgerID, accountID, holdID, 0));
+    return -1;
+  }
+  Account *current = accounts.get(accountID);
+  timed_lock(&current->lock);
+  current->held -= h->amount;
+  if (replica) {
+    replica->record(current);
+    replica->record_hold(current, h, false);
+  }
+  recordSucc(RELEASE_LOG(workerID, ledgerID, accountID, holdID,
+                         h->amount));
+  pthread_mutex_unlock(&current->lock);
+  delete h;
+  return 0;
+}
+
+/**
+ * @brief Moves the ledger clock forward and releases every hold whose expiry
+ *        time it has reached.
+ *
+ * @details
+ * The clock only moves forward; velocity windows read it. The HoldTable's
+ * timing wheel returns only the holds that came due, so the
+ * cost is proportional to the number of expired holds. Each is logged as
+ * `[ SUCCESS ] TID: {workerID}, LID: {holdID}, Acc: {accountID} HOLD EXPIRED ${amount}`
+ * using the EXPIRE_MSG() macro; expiries are not ledger entries, so the
+ * success and fail counts do not change.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param now The ledger clock.
+ */
+void Bank::advance_clock(int workerID, long now) {
+  EpochGuard guard;
+  long seen = clock.load(memory_order_relaxed);
+  while (now > seen &&
+         !clock.compare_exchange_weak(seen, now, memory_order_relaxed)) {
+  }
+  Hold *h = holds.expire(now);
+  while (h != NULL) {
+    Hold *next = (Hold *)h->next;
+    Account *current = accounts.get(h->accountID);
+    timed_lock(&current->lock);
+    current->held -= h->amount;
+    if (replica) {
+      replica->record(current);
+      replica->record_hold(current, h, false);
+    }
+    recordQuery(EXPIRE_LOG(workerID, h->ledgerID, h->accountID,
+                           h->amount));
+    pthread_mutex_unlock(&current->lock);
+    delete h;
+    h = next;
+  }
+}
+
+/**
+ * @brief Sets or clears an account's velocity limit.
+ *
+ * @details
+ * From now on withdrawals and outgoing transfers fail once more than
+ * `limit` would leave the account within `window` ticks of the ledger
+ * clock; the window starts empty. A `limit` of 0 removes the limit. Logs
+ * `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} VELOCITY LIMIT ${limit} PER {window}`
+ * using the LIMIT_MSG() macro.
+ *
+ * @attention
+ * - Fails if the account does not exist or is closed, `limit` is negative,
+ * or `window` is shorter than VELOCITY_BUCKETS ticks.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID to limit.
+ * @param window The window length in ledger ticks.
+ * @param limit The most that may leave per window, or 0.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::set_limit(int workerID, int ledgerID, int accountID, int window,
+                    int limit) {
+  EpochGuard guard;
+  Account *current = accounts.get(accountID);
+  if (current == NULL || limit < 0 ||
+      (limit > 0 && window < VELOCITY_BUCKETS)) {
+    recordFail(LIMIT_LOG(workerID, ledgerID, accountID, limit, window));
+    return -1;
+  }
+  int successful = 0;
+  timed_lock(&current->lock);
+  if (current->open) {
+    current->limit = limit;
+    current->bucket_ticks = (window + VELOCITY_BUCKETS - 1) / VELOCITY_BUCKETS;
+    current->bucket = limit > 0 ? clock.load() / current->bucket_ticks : 0;
+    for (int i = 0; i < VELOCITY_BUCKETS; i++) { current->outflow[i] = 0; }
+    recordSucc(LIMIT_LOG(workerID, ledgerID, accountID, limit, window));
+  } else {
+    recordFail(LIMIT_LOG(workerID, ledgerID, accountID, limit, window));
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock);
+  return successful;
+}
+
+/**
+ * @brief Loads the FX rate table, enabling balances in other currencies.
+ *
+ * @attention
+ * - Call before the workers start.
+ *
+ * @param path The rates file (see FxTable::load()).
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::load_fx(const char *path) {
+  FxTable *table = new FxTable();
+  if (table->load(path) != 0) {
+    delete table;
+    return -1;
+  }
+  fx = table;
+  log_header(&log_codes, fx);
+  return 0;
+}
+
+/**
+ * @brief returns the code of a currency for log lines and reports.
+ */
+string Bank::currency(int cur) {
+  return fx ? fx->code(cur) : "?";
+}
+
+/**
+ * @brief returns where an account keeps its balance in currency `cur`.
+ *
+ * The base currency is `balance`; the others are in the account's wallet,
+ * which is allocated on first use when `create` is set. Returns NULL for a
+ * missing wallet, which holds nothing.
+ *
+ * @attention
+ * - The caller holds the account lock.
+ */
+static inline long *balance_in(Account *acc, int cur, bool create) {
+  if (cur == 0) { return &acc->balance; }
+  if (acc->wallet == NULL && create) {
+    acc->wallet = new long[FX_CURRENCIES - 1]();
+  }
+  return acc->wallet ? &acc->wallet[cur - 1] : NULL;
+}
+
+/**
+ * @brief returns true if `cur` is a currency of the rate table.
+ */
+static inline bool valid_currency(FxTable *fx, int cur) {
+  return fx != NULL && cur >= 0 && cur < fx->num;
+}
+
+/**
+ * @brief Adds money in a currency other than the base to an account.
+ *
+ * @details
+ * Logs `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} DEPOSIT ${amount} {code}`.
+ * Balances in other currencies are not versioned or indexed.
+ *
+ * @attention
+ * - Fails if the account does not exist or is closed, or the currency is
+ * not in the rate table.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID to deposit.
+ * @param amount The amount to deposit.
+ * @param cur The currency, 1 or above.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::deposit_fx(int workerID, int ledgerID, int accountID, int amount,
+                     int cur) {
+  EpochGuard guard;
+  Account *current = accounts.get(accountID);
+  if (current == NULL || !valid_currency(fx, cur)) {
+    recordFail(DEPOSIT_FX_LOG(workerID, ledgerID, accountID, amount, cur));
+    return -1;
+  }
+  int successful = 0;
+  timed_lock(&current->lock);
+  if (current->open) {
+    *balance_in(current, cur, true) += amount;
+    fx_flow[cur - 1].fetch_add(amount, memory_order_relaxed);
+    if (replica) { replica->record(current); }
+    recordSucc(DEPOSIT_FX_LOG(workerID, ledgerID, accountID, amount, cur));
+  } else {
+    recordFail(DEPOSIT_FX_LOG(workerID, ledgerID, accountID, amount, cur));
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock);
+  return successful;
+}
+
+/**
+ * @brief Withdraws money in a currency other than the base from an account.
+ *
+ * @details
+ * Logs `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {accountID} WITHDRAW ${amount} {code}`.
+ * Holds and velocity limits only apply to the base currency.
+ *
+ * @attention
+ * - Fails if the account does not exist, is closed or holds less than
+ * `amount` in the currency, or the currency is not in the rate table.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param accountID The account ID to withdraw from.
+ * @param amount The amount to withdraw.
+ * @param cur The currency, 1 or above.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::withdraw_fx(int workerID, int ledgerID, int accountID, int amount,
+                      int cur) {
+  EpochGuard guard;
+  Account *current = accounts.get(accountID);
+  if (current == NULL || !valid_currency(fx, cur)) {
+    recordFail(WITHDRAW_FX_LOG(workerID, ledgerID, accountID, amount, cur));
+    return -1;
+  }
+  int successful = 0;
+  timed_lock(&current->lock);
+  long *balance = balance_in(current, cur, false);
+  if (current->open && balance != NULL && amount <= *balance) {
+    *balance -= amount;
+    fx_flow[cur - 1].fetch_sub(amount, memory_order_relaxed);
+    if (replica) { replica->record(current); }
+    recordSucc(WITHDRAW_FX_LOG(workerID, ledgerID, accountID, amount, cur));
   } else {
-    pthread_mutex_unlock(&source.lock);
-    pthread_mutex_unlock(&destination.lock);
+    recordFail(WITHDRAW_FX_LOG(workerID, ledgerID, accountID, amount, cur));
+    successful = -1;
   }
+  pthread_mutex_unlock(&current->lock);
   return successful;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Transfers money between currencies, and possibly accounts.
+ *
+ * @details
+ * Debits `amount` in currency `cur` from the source and credits `credit`,
+ * the amount converted into currency `to` by the loader (see
+ * FxTable::convert()), to the destination. The source and destination may
+ * be the same account when the currencies differ, which converts money
+ * within it. Logs
+ *   `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, Acc: {srcID} TRANSFER ${amount} {cur} TO Acc: {destID} AS ${credit} {to}`
+ * using the FX_TRANSFER_MSG() macro. Only base currency changes are
+ * versioned and indexed, and only base currency outflows count against the
+ * velocity limit.
+ *
+ * @attention
+ * - Fails like transfer(), or if a currency is not in the rate table.
+ * - Conversion creates or destroys money in each currency, which the
+ * per-currency flows record, so conservation checks keep holding.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param srcID The account ID to transfer money from.
+ * @param destID The account ID to transfer money to.
+ * @param amount The amount debited, in `cur`.
+ * @param cur The source currency.
+ * @param to The destination currency.
+ * @param credit The amount credited, in `to`.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::transfer_fx(int workerID, int ledgerID, int srcID, int destID,
+                      unsigned int amount, int cur, int to, long credit) {
+  EpochGuard guard;
+  Account *source = accounts.get(srcID);
+  Account *destination = accounts.get(destID);
+  if (source == NULL || destination == NULL || !valid_currency(fx, cur) ||
+      !valid_currency(fx, to) || (srcID == destID && cur == to)) {
+    recordFail(FX_TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount,
+                               cur, credit, to));
+    return -1;
+  }
+  int successful = 0;
+  // lock based on src and destID, once for a conversion within an account
+  Account *first = srcID < destID ? source : destination;
+  Account *second = srcID < destID ? destination : source;
+  timed_lock(&first->lock);
+  if (second != first) { timed_lock(&second->lock); }
+  long *debit = balance_in(source, cur, false);
+  long available = debit == NULL ? 0 : cur == 0 ? *debit - source->held : *debit;
+  bool funds = source->open && destination->open && amount <= available;
+  long now = clock.load(memory_order_relaxed);
+  if (funds && (cur != 0 || velocity_ok(source, amount, now))) {
+    *debit -= amount;
+    *balance_in(destination, to, true) += credit;
+    if (cur == 0) {
+      velocity_charge(source, amount);
+      net_flow.fetch_sub(amount, memory_order_relaxed);
+      if (versions) { versions->record(source, ledgerID); }
+      if (history) { history->record(srcID, ledgerID, -(long)amount); }
+    } else {
+      fx_flow[cur - 1].fetch_sub(amount, memory_order_relaxed);
+    }
+    if (to == 0) {
+      net_flow.fetch_add(credit, memory_order_relaxed);
+      if (versions) { versions->record(destination, ledgerID); }
+      if (history) { history->record(destID, ledgerID, credit); }
+    } else {
+      fx_flow[to - 1].fetch_add(credit, memory_order_relaxed);
+    }
+    if (replica) {
+      replica->record(source);
+      if (destination != source) { replica->record(destination); }
+    }
+    recordSucc(FX_TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount,
+                               cur, credit, to));
+  } else {
+    recordFail(FX_TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount,
+                               cur, credit, to),
+               funds);
+    successful = -1;
+  }
+  if (second != first) { pthread_mutex_unlock(&second->lock); }
+  pthread_mutex_unlock(&first->lock);
+  return successful;
+}
+
+/**
+ * @brief Makes this bank tenant `id` of a process hosting several banks.
+ *
+ * @details
+ * The bank logs under the first tenant's lock from now on, so lines from
+ * different tenants never interleave on the shared output, and tags its
+ * lines with `TEN: {id}, ` after the level. Its counters stay its own.
+ *
+ * @attention
+ * - Call before the workers start.
+ *
+ * @param first Tenant 0, which owns the shared lock.
+ * @param id This bank's tenant ID.
+ */
+void Bank::share_log(Bank *first, int id) {
+  log_lock = &first->bank_lock;
+  tenant = id;
+}
+
+/**
+ * @brief logs a record to the bank's sink and counts it.
+ *
+ * @details
+ * The sink is asked first whether it wants the record; one it drops is
+ * only counted. A binary sink takes the record as it is; otherwise it is
+ * rendered to the text of its *_MSG macro before log_lock is taken, so
+ * formatting stays outside the critical section as it was for the text
+ * messages.
+ *
+ * @param r The record, with the fields of its operation set.
+ * @param status LOG_SUCC, LOG_FAIL or LOG_DUP.
+ * @param counter The counter to increment, or NULL.
+ */
+void Bank::log(LogRecord r, int status, int *counter) {
+  r.status = status;
+  r.tenant = tenant;
+  bool kept = log_sink->accept(r);
+  string line;
+  if (kept && !log_sink->binary) { line = render_log(r, log_codes); }
+  pthread_mutex_lock(log_lock);
+  if (kept) { log_sink->write(r, line); }
+  if (counter) { (*counter)++; }
+  pthread_mutex_unlock(log_lock);
+}
+
+/**
+ * @brief logs a preformatted message and counts it.
+ *
+ * @details
+ * The message goes to the sink like a record's line, if the sink wants a
+ * record of that status; a binary sink has no place for free text, so
+ * there it is only counted, without asking the sink.
+ *
+ * @param message The line.
+ * @param status LOG_SUCC or LOG_FAIL.
+ * @param counter The counter to increment.
+ */
+void Bank::log_message(const string &message, int status, int *counter) {
+  LogRecord r = log_record(LOG_DEPOSIT, 0, -1, 0, 0, 0);
+  r.status = status;
+  r.tenant = tenant;
+  // asked first, accept() would spend a sample on a line never written
+  bool kept = !log_sink->binary && log_sink->accept(r);
+  pthread_mutex_lock(log_lock);
+  if (kept) { log_sink->write(r, message); }
+  (*counter)++;
+  pthread_mutex_unlock(log_lock);
+}
+
+/**
+ * @brief logs a success and counts it.
+ */
+void Bank::recordSucc(const LogRecord &r) { log(r, LOG_SUCC, &num_succ); }
+
+/**
+ * @brief logs a failure and counts it; `limited` appends LIMIT_REASON.
+ */
+void Bank::recordFail(const LogRecord &r, bool limited) {
+  LogRecord failed = r;
+  if (limited) { failed.flags |= LOG_LIMITED; }
+  log(failed, LOG_FAIL, &num_fail);
+}
+
+/**
+ * @brief logs an outcome that is not a ledger transaction, so neither
+ *        counter changes.
+ */
+void Bank::recordQuery(const LogRecord &r, bool ok) {
+  log(r, ok ? LOG_SUCC : LOG_FAIL, NULL);
+}
+
+/**
+ * @brief logs a duplicate entry and counts it apart from failures.
+ */
+void Bank::recordDuplicate(const LogRecord &r) {
+  log(r, LOG_DUP, &num_dup);
+}
+
+/**
+ * @brief Transfers money to an account of another tenant.
+ *
+ * @details
+ * Both accounts are locked in (tenant, account ID) order, the same order
+ * transfer() uses within a bank, so the transfer is atomic with respect to
+ * every other operation on either account and cannot deadlock. Each bank's
+ * net flow records its side, so both tenants' conservation checks keep
+ * holding. Logged on this bank, which counts the outcome, as
+ *   `[ SUCCESS ] TEN: {tenant}, TID: {workerID}, LID: {ledgerID}, Acc: {srcID} TRANSFER ${amount} TO TEN: {dest tenant}, Acc: {destID}`
+ * using the TENANT_TRANSFER_MSG() macro (tenant 0 lines carry no tag).
+ *
+ * @attention
+ * - Fails like transfer(), or if `dest` is NULL (no such tenant).
+ * - Moves the base currency only.
+ *
+ * @param dest The destination tenant's bank, not this one.
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param srcID The account ID to transfer money from, in this bank.
+ * @param destID The account ID to transfer money to, in `dest`.
+ * @param amount The amount to transfer.
+ * @return 0 on success, -1 on failure.
+ */
+int Bank::transfer_to(Bank *dest, int workerID, int ledgerID, int srcID,
+                      int destID, unsigned int amount) {
+  EpochGuard guard;
+  Account *source = accounts.get(srcID);
+  Account *destination = dest ? dest->accounts.get(destID) : NULL;
+  int dest_tenant = dest ? dest->tenant : -1;
+  if (source == NULL || destination == NULL || dest == this) {
+    recordFail(TENANT_TRANSFER_LOG(workerID, ledgerID, srcID, amount,
+                                   dest_tenant, destID));
+    return -1;
+  }
+  int successful = 0;
+  bool source_first = tenant < dest->tenant;
+  timed_lock(source_first ? &source->lock : &destination->lock);
+  timed_lock(source_first ? &destination->lock : &source->lock);
+  bool funds = source->open && destination->open &&
+               amount <= source->balance - source->held;
+  if (funds && velocity_ok(source, amount, clock.load(memory_order_relaxed))) {
+    source->balance -= amount;
+    destination->balance += amount;
+    velocity_charge(source, amount);
+    net_flow.fetch_sub(amount, memory_order_relaxed);
+    dest->net_flow.fetch_add(amount, memory_order_relaxed);
+    if (versions) { versions->record(source, ledgerID); }
+    if (dest->versions) { dest->versions->record(destination, ledgerID); }
+    if (replica) { replica->record(source); }
+    if (dest->replica) { dest->replica->record(destination); }
+    if (history) { history->record(srcID, ledgerID, -(long)amount); }
+    if (dest->history) { dest->history->record(destID, ledgerID, amount); }
+    recordSucc(TENANT_TRANSFER_LOG(workerID, ledgerID, srcID, amount,
+                                   dest_tenant, destID));
+  } else {
+    recordFail(TENANT_TRANSFER_LOG(workerID, ledgerID, srcID, amount,
+                                   dest_tenant, destID),
+               funds);
+    successful = -1;
+  }
+  pthread_mutex_unlock(source_first ? &destination->lock : &source->lock);
+  pthread_mutex_unlock(source_first ? &source->lock : &destination->lock);
+  return successful;
+}
+
+/**
+ * @brief First phase of a transfer between accounts on different shards:
+ *        votes on the side this shard owns and reserves it.
+ *
+ * @details
+ * The source side checks the transfer like transfer() does, then reserves
+ * the amount by adding it to the account's `held`, so the money stays put
+ * but nothing else can spend it, and charges the velocity limit. A source
+ * that cannot pay logs the failure (counted) and votes no; the coordinator
+ * then aborts the destination without involving the source again. The
+ * destination side only needs an open account, which it pins by counting
+ * the prepared transfer in `pending` so close() fails until the outcome is
+ * known. A no vote on the destination side is not logged here.
+ *
+ * @attention
+ * - A prepared debit counts against the velocity limit even if the
+ * transfer later aborts.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param srcID The account ID to transfer money from.
+ * @param destID The account ID to receive the money.
+ * @param amount The amount to transfer.
+ * @param source True on the source's shard, false on the destination's.
+ * @return 0 to vote yes, -1 to vote no.
+ */
+int Bank::prepare_transfer(int workerID, int ledgerID, int srcID, int destID,
+                           unsigned int amount, bool source) {
+  EpochGuard guard;
+  Account *current = accounts.get(source ? srcID : destID);
+  if (current == NULL) {
+    if (source) {
+      recordFail(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount));
+    }
+    return -1;
+  }
+  int successful = 0;
+  timed_lock(&current->lock);
+  if (!source) {
+    if (current->open) {
+      current->pending++;
+      if (replica) { replica->record(current); }
+    } else {
+      successful = -1;
+    }
+    pthread_mutex_unlock(&current->lock);
+    return successful;
+  }
+  bool funds = current->open && amount <= current->balance - current->held;
+  if (funds && velocity_ok(current, amount, clock.load(memory_order_relaxed))) {
+    current->held += amount;
+    velocity_charge(current, amount);
+    if (replica) { replica->record(current); }
+  } else {
+    recordFail(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount),
+               funds);
+    successful = -1;
+  }
+  pthread_mutex_unlock(&current->lock);
+  return successful;
+}
+
+/**
+ * @brief Second phase of a cross-shard transfer that both sides voted for:
+ *        moves the money on the side this shard owns.
+ *
+ * @details
+ * The source gives up the reservation and pays, logging the transfer like
+ * transfer() does; it is the side that counts the outcome. The destination
+ * is credited and unpinned without a log line. Each side records its half
+ * in its own net flow, so every shard's conservation check holds on its
+ * own.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param srcID The account ID to transfer money from.
+ * @param destID The account ID to receive the money.
+ * @param amount The amount to transfer.
+ * @param source True on the source's shard, false on the destination's.
+ * @return 0 on success, -1 if the account is missing.
+ */
+int Bank::commit_transfer(int workerID, int ledgerID, int srcID, int destID,
+                          unsigned int amount, bool source) {
+  EpochGuard guard;
+  int accountID = source ? srcID : destID;
+  Account *current = accounts.get(accountID);
+  if (current == NULL) { return -1; }
+  timed_lock(&current->lock);
+  if (source) {
+    current->held -= amount;
+    current->balance -= amount;
+    net_flow.fetch_sub(amount, memory_order_relaxed);
+  } else {
+    current->pending--;
+    current->balance += amount;
+    net_flow.fetch_add(amount, memory_order_relaxed);
+  }
+  if (versions) { versions->record(current, ledgerID); }
+  if (replica) { replica->record(current); }
+  if (history) {
+    history->record(accountID, ledgerID, source ? -(long)amount : amount);
+  }
+  if (source) {
+    recordSucc(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount));
+  }
+  pthread_mutex_unlock(&current->lock);
+  return 0;
+}
+
+/**
+ * @brief Second phase of a cross-shard transfer that the other side voted
+ *        against: undoes this side's prepare.
+ *
+ * The source releases its reservation and logs the transfer as failed
+ * (counted); the destination is unpinned without a log line.
+ *
+ * @param workerID The ID of the worker (thread).
+ * @param ledgerID The ID of the ledger entry.
+ * @param srcID The account ID to transfer money from.
+ * @param destID The account ID to receive the money.
+ * @param amount The amount to transfer.
+ * @param source True on the source's shard, false on the destination's.
+ * @return 0 on success, -1 if the account is missing.
+ */
+int Bank::abort_transfer(int workerID, int ledgerID, int srcID, int destID,
+                         unsigned int amount, bool source) {
+  EpochGuard guard;
+  Account *current = accounts.get(source ? srcID : destID);
+  if (current == NULL) { return -1; }
+  timed_lock(&current->lock);
+  if (source) {
+    current->held -= amount;
+    recordFail(TRANSFER_LOG(workerID, ledgerID, srcID, destID, amount));
+  } else {
+    current->pending--;
+  }
+  if (replica) { replica->record(current); }
+  pthread_mutex_unlock(&current->lock);
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include "../include/bank.h"
+#include "../include/epoch.h"
+
+#include <limits.h> /* for LONG_MAX */
+#include <stdint.h> /* for INT32_MAX */
+
+using namespace std;
+
+/**
+ * @brief one sweep thread's columns for the segment it is on.
+ *
+ * The kernels always run over all SEG_SIZE lanes, lanes past the end of the
+ * table being zero, so their loops have a fixed trip count over distinct
+ * arrays and g++ -O2 vectorises them with the baseline SSE2 instruction set
+ * (check with -fopt-info-vec). 64-bit lanes hold 0 or 1 flags rather than
+ * chars so every column has the same width.
+ */
+struct BulkColumns {
+  alignas(64) long bal[SEG_SIZE];  // balance, or available funds for a fee
+  alignas(64) long sel[SEG_SIZE];  // 1 if the job selects the account
+  alignas(64) int32_t low[SEG_SIZE];  // interest: a selected balance in
+                                      // [1, INT32_MAX], 0 otherwise
+  alignas(64) long delta[SEG_SIZE];
+  alignas(64) long skip[SEG_SIZE];  // 1 if selected but left unchanged
+};
+
+/**
+ * @brief one bulk sweep thread's share of the account table, its columns
+ *        and its totals.
+ */
+struct BulkShard {
+  Bank *bank;
+  const BulkJob *job;
+  int first_seg;
+  int last_seg;  // exclusive
+  BulkColumns *cols;
+  long applied;
+  long skipped;
+  long total;
+};
+
+/**
+ * @brief Interest kernel: `bp` basis points of the balances in `low`,
+ *        rounded down.
+ *
+ * @details
+ * There is no vector 64-bit divide, so with bp = bq * 10000 + br the
+ * interest is b * bq plus b * br / 10000; b < 2^31 and br < 10000 make
+ * b * br exact in a double, and the division by 10000 in doubles rounds
+ * correctly, so truncating it is the exact quotient. Selected balances
+ * outside `low`'s range are computed by the caller.
+ */
+static void interest_kernel(BulkColumns &c, long bp) {
+  const uint32_t bq = (uint32_t)(bp / 10000);
+  const double br = (double)(bp % 10000);
+  for (int i = 0; i < SEG_SIZE; i++) {
+    c.delta[i] = (long)((uint64_t)(uint32_t)c.low[i] * bq) +
+                 (int32_t)((double)c.low[i] * br / 10000.0);
+  }
+}
+
+/**
+ * @brief Fee kernel: selected balances pay a flat `fee`.
+ *
+ * As with withdraw(), a balance smaller than the fee is left unchanged and
+ * the account is skipped. The comparison is the sign bit of bal - fee, as
+ * SSE2 has no 64-bit compare.
+ */
+static void fee_kernel(BulkColumns &c, long fee) {
+  for (int i = 0; i < SEG_SIZE; i++) {
+    long ok = (long)(((uint64_t)(c.bal[i] - fee) >> 63) ^ 1);
+    c.delta[i] = -(c.sel[i] & ok) & -fee;
+    c.skip[i] = c.sel[i] & (ok ^ 1);
+  }
+}
+
+/**
+ * @brief Sweeps a contiguous range of segments.
+ *
+ * @details
+ * For each segment the balances and the selection (open, within the ID
+ * range, at or above the minimum balance) are gathered from the account
+ * slots into the thread's columns, one cache line per account, the job's
+ * kernel computes a delta column, and the non-zero deltas are written
+ * back. Interest on a balance above INT32_MAX, or at a rate of INT32_MAX
+ * basis points or more, is computed in the write-back loop instead; a
+ * balance whose new value would overflow is skipped.
+ *
+ * @param arg The BulkShard to sweep.
+ * @return NULL when done.
+ */
+static void *bulk_sweep(void *arg) {
+  BulkShard *shard = (BulkShard *)arg;
+  Bank *bank = shard->bank;
+  const BulkJob &job = *shard->job;
+  EpochGuard guard;
+  int num = bank->accounts.size();
+  BulkColumns &c = *shard->cols;
+  bool interest = job.kind == BULK_INTEREST;
+  bool narrow = job.value < INT32_MAX;
+  const long limit = LONG_MAX / (10000 + job.value);
+
+  for (int s = shard->first_seg; s < shard->last_seg; s++) {
+    int base = s << SEG_SHIFT;
+    int n = num - base < SEG_SIZE ? num - base : SEG_SIZE;
+    Account *seg = bank->accounts.get(base);
+    if (seg == NULL) { continue; }
+
+    for (int i = 0; i < n; i++) {
+      // fees, like withdrawals, only see funds not reserved by holds
+      long b = seg[i].balance - (interest ? 0 : seg[i].held);
+      long sel = seg[i].open && base + i >= job.first &&
+                 base + i <= job.last && b >= job.min_balance;
+      c.bal[i] = b;
+      c.sel[i] = sel;
+      c.low[i] = sel && narrow && b > 0 && b <= INT32_MAX ? (int32_t)b : 0;
+    }
+    for (int i = n; i < SEG_SIZE; i++) {
+      c.bal[i] = 0;
+      c.sel[i] = 0;
+      c.low[i] = 0;
+    }
+    if (interest) {
+      interest_kernel(c, job.value);
+    } else {
+      fee_kernel(c, job.value);
+    }
+    for (int i = 0; i < n; i++) {
+      long d = c.delta[i];
+      if (interest) {
+        long b = c.bal[i];
+        bool wide = c.sel[i] && b > 0 && c.low[i] == 0;
+        if (wide && b <= limit) {
+          d = b * job.value / 10000;
+        } else if (wide) {
+          shard->skipped++;
+        }
+      } else {
+        shard->skipped += c.skip[i];
+      }
+      if (d == 0) { continue; }
+      seg[i].balance += d;
+      shard->applied++;
+      shard->total += d;
+      if (bank->versions) { bank->versions->record(&seg[i], job.ledgerID); }
+      if (bank->replica) { bank->replica->record(&seg[i]); }
+      if (bank->history) { bank->history->record(base + i, job.ledgerID, d); }
+    }
+  }
+  if (bank->history) { bank->history->flush(); }
+  if (bank->replica) { bank->replica->commit(job.ledgerID); }
+  return NULL;
+}
+
+/**
+ * @brief Applies an end-of-day job to every selected account in one sweep.
+ *
+ * @details
+ * Splits the account table into contiguous ranges of segments and sweeps
+ * them with `num_threads` threads. Instead of one ledger entry and one log
+ * line per account, the job writes a single summary record using the
+ * BULK_MSG() macro:
+ *   `[ SUCCESS ] TID: {workerID}, LID: {ledgerID}, BULK {kind} {value}
+ *   Accounts: {applied} Skipped: {skipped} Total: ${total}`
+ * and counts as one success.
+ *
+ * @attention
+ * - Runs at a quiescent point (after the workers have joined), so it reads
+ * and writes balances without taking account locks.
+ * - Closed accounts are never selected.
+ * - Interest (`value` in basis points) skips accounts whose balance would
+ * overflow; fees skip accounts with insufficient available funds, like
+ * withdraw(), and `min_balance` then applies to the available funds.
+ *
+ * @param workerID The ID reported in the log record.
+ * @param job The job to run.
+ * @param num_threads The number of sweep threads.
+ * @return the number of accounts changed.
+ */
+long Bank::bulk(int workerID, const BulkJob &job, int num_threads) {
+  EpochGuard guard;
+  int segs = (accounts.size() + SEG_SIZE - 1) >> SEG_SHIFT;
+  if (num_threads < 1) { num_threads = 1; }
+  if (num_threads > segs) { num_threads = segs > 0 ? segs : 1; }
+
+  pthread_t *threads = new pthread_t[num_threads];
+  BulkShard *shards = new BulkShard[num_threads];
+  // about 147 KB of columns per sweep thread, aligned for the kernels
+  BulkColumns *cols = new BulkColumns[num_threads];
+  for (int t = 0; t < num_threads; t++) {
+    shards[t] = {this, &job, (int)((long)segs * t / num_threads),
+                 (int)((long)segs * (t + 1) / num_threads), &cols[t], 0, 0,
+                 0};
+    pthread_create(&threads[t], NULL, bulk_sweep, &shards[t]);
+  }
+  long applied = 0, skipped = 0, total = 0;
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    applied += shards[t].applied;
+    skipped += shards[t].skipped;
+    total += shards[t].total;
+  }
+  delete[] cols;
+  delete[] shards;
+  delete[] threads;
+  net_flow.fetch_add(total, memory_order_relaxed);
+
+  recordSucc(BULK_LOG(workerID, job.ledgerID, job.kind, job.value, applied,
+                      skipped, total));
+  return applied;
+}
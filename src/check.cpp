@@ -0,0 +1,114 @@
+#include "../include/bank.h"
+#include "../include/epoch.h"
+
+#include <time.h> /* for clock_gettime() */
+#include <sstream>
+
+using namespace std;
+
+// two 64-bit lanes (SSE2 paddq on x86-64); g++ -O2 does not vectorize
+// reductions by itself
+typedef long long2 __attribute__((vector_size(16)));
+
+/**
+ * @brief sums the balances of a run of accounts.
+ *
+ * Each pair of neighbouring slots is loaded into one vector and added to
+ * one of two vector accumulators, so four balances are summed per step
+ * with explicit SIMD straight from the slots; a contiguous copy would
+ * read the same lines and add a store per account.
+ */
+static long sum_balances(const Account *seg, int n) {
+  long2 s0 = {0, 0}, s1 = {0, 0};
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += (long2){seg[i].balance, seg[i + 1].balance};
+    s1 += (long2){seg[i + 2].balance, seg[i + 3].balance};
+  }
+  long2 s = s0 + s1;
+  long sum = s[0] + s[1];
+  for (; i < n; i++) { sum += seg[i].balance; }
+  return sum;
+}
+
+/**
+ * @brief adds the other-currency balances of a run of accounts to `sums`.
+ *
+ * Reads each slot's wallet pointer, which shares a line with its lock, so
+ * it is only called with FX rates loaded.
+ */
+static void sum_wallets(const Account *seg, int n, long *sums) {
+  for (int i = 0; i < n; i++) {
+    const long *wallet = seg[i].wallet;
+    if (wallet == NULL) { continue; }
+    for (int c = 0; c < FX_CURRENCIES - 1; c++) { sums[c] += wallet[c]; }
+  }
+}
+
+/**
+ * @brief Checks that money is conserved.
+ *
+ * @details
+ * Transfers move money between accounts, so the sum of all balances must
+ * equal the net external flow: successful deposits, opening balances and
+ * interest minus successful withdrawals and fees, as tracked by `net_flow`.
+ * A mismatch means an update was lost or torn. The result is logged to
+ * stderr as
+ *   `[ CHECK ] {where}: balances ${sum} net flow ${flow} OK ({us} us)`
+ * or, on a mismatch,
+ *   `[ CHECK ] {where}: balances ${sum} != net flow ${flow} (diff ${diff}) ({us} us)`,
+ * where `us` is the time the sums took (with --check-ms, the workers are
+ * paused for it).
+ * With FX rates loaded every other currency is checked the same way against
+ * its own flow, on a line with its code after `{where}:`.
+ *
+ * @attention
+ * - Only call this at a quiescent point: after the workers have joined, or
+ * while the worker pool is paused.
+ *
+ * @param where Names the quiescent point in the log line.
+ * @return true if the invariant holds, false otherwise.
+ */
+bool Bank::check_invariant(const char *where) {
+  EpochGuard guard;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int num = accounts.size();
+  long sum = 0;
+  // other currencies, summed over the accounts that have a wallet
+  long sums[FX_CURRENCIES - 1] = {0};
+  for (int base = 0; base < num; base += SEG_SIZE) {
+    int n = num - base < SEG_SIZE ? num - base : SEG_SIZE;
+    const Account *seg = accounts.get(base);
+    if (seg == NULL) { continue; }
+    sum += sum_balances(seg, n);
+    if (fx) { sum_wallets(seg, n, sums); }
+  }
+  long flow = net_flow.load(memory_order_acquire);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long us = (end.tv_sec - start.tv_sec) * 1000000L +
+            (end.tv_nsec - start.tv_nsec) / 1000;
+
+  ostringstream line;
+  line << "[ CHECK ] " << where << ": balances $" << sum;
+  if (sum == flow) {
+    line << " net flow $" << flow << " OK";
+  } else {
+    line << " != net flow $" << flow << " (diff $" << sum - flow << ")";
+  }
+  line << " (" << us << " us)\n";
+  bool ok = sum == flow;
+  for (int c = 1; fx && c < fx->num; c++) {
+    long s = sums[c - 1];
+    long f = fx_flow[c - 1].load(memory_order_acquire);
+    line << "[ CHECK ] " << where << ": " << fx->code(c) << " balances $" << s;
+    if (s == f) {
+      line << " net flow $" << f << " OK\n";
+    } else {
+      line << " != net flow $" << f << " (diff $" << s - f << ")\n";
+    }
+    ok = ok && s == f;
+  }
+  cerr << line.str();
+  return ok;
+}
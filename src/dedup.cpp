@@ -0,0 +1,193 @@
+#include "../include/dedup.h"
+
+#include <string.h> /* for memset() */
+
+using namespace std;
+
+/**
+ * @brief 64-bit finalizer (splitmix64), so sequential IDs spread evenly.
+ */
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static uint64_t pow2_at_least(uint64_t n) {
+  uint64_t p = 1;
+  while (p < n) { p <<= 1; }
+  return p;
+}
+
+/**
+ * @brief Construct a new DedupFilter.
+ *
+ * @param window How many of the most recent IDs are remembered exactly.
+ */
+DedupFilter::DedupFilter(long window) {
+  if (window < DEDUP_SHARDS) { window = DEDUP_SHARDS; }
+  long cap = (window + DEDUP_SHARDS - 1) / DEDUP_SHARDS;
+  for (DedupShard &s : shards) {
+    pthread_mutex_init(&s.lock, NULL);
+    uint64_t size = pow2_at_least(cap * 2);
+    s.slots = new uint64_t[size]();
+    s.mask = size - 1;
+    s.ring = new uint64_t[cap];
+    s.cap = cap;
+    s.head = 0;
+    s.count = 0;
+    s.bloom_blocks = pow2_at_least(cap * DEDUP_BLOOM_BITS_PER_ID / 512 + 1);
+    s.bloom[0] = new uint64_t[s.bloom_blocks * 8]();
+    s.bloom[1] = new uint64_t[s.bloom_blocks * 8]();
+    s.gen = 0;
+    s.fresh = 0;
+  }
+  checked = 0;
+  maybe = 0;
+  duplicates = 0;
+}
+
+/**
+ * @brief Destroy the DedupFilter object.
+ */
+DedupFilter::~DedupFilter() {
+  for (DedupShard &s : shards) {
+    pthread_mutex_destroy(&s.lock);
+    delete[] s.slots;
+    delete[] s.ring;
+    delete[] s.bloom[0];
+    delete[] s.bloom[1];
+  }
+}
+
+/**
+ * @brief tests whether the ID's bits are all set in its Bloom block of
+ *        either generation.
+ *
+ * @attention
+ * - The caller holds the shard lock.
+ *
+ * @return true if the ID was possibly seen, false if it certainly was not.
+ */
+bool DedupFilter::bloom_test(DedupShard &s, uint64_t h) {
+  uint64_t at = (h & (s.bloom_blocks - 1)) * 8;
+  for (int g = 0; g < 2; g++) {
+    const uint64_t *block = s.bloom[g] + at;
+    uint64_t bits = mix64(h);
+    bool present = true;
+    for (int i = 0; i < DEDUP_BLOOM_K && present; i++, bits >>= 9) {
+      int pos = bits & 511;
+      present = (block[pos >> 6] >> (pos & 63)) & 1;
+    }
+    if (present) { return true; }
+  }
+  return false;
+}
+
+/**
+ * @brief sets the ID's bits in the current generation, first clearing the
+ *        other one and switching to it if the current one is full.
+ *
+ * @attention
+ * - The caller holds the shard lock.
+ */
+void DedupFilter::bloom_set(DedupShard &s, uint64_t h) {
+  if (s.fresh == s.cap) {
+    s.gen ^= 1;
+    memset(s.bloom[s.gen], 0, s.bloom_blocks * 8 * sizeof(uint64_t));
+    s.fresh = 0;
+  }
+  uint64_t *block = s.bloom[s.gen] + (h & (s.bloom_blocks - 1)) * 8;
+  uint64_t bits = mix64(h);
+  for (int i = 0; i < DEDUP_BLOOM_K; i++, bits >>= 9) {
+    int pos = bits & 511;
+    block[pos >> 6] |= 1ULL << (pos & 63);
+  }
+  s.fresh++;
+}
+
+/**
+ * @brief removes an ID from a shard's table, shifting later entries of its
+ *        probe run back so lookups stay correct without tombstones.
+ *
+ * @attention
+ * - The caller holds the shard lock.
+ */
+void DedupFilter::erase(DedupShard &s, uint64_t id) {
+  uint64_t i = mix64(id) & s.mask;
+  while (s.slots[i] != id) { i = (i + 1) & s.mask; }
+  s.slots[i] = 0;
+  uint64_t j = i;
+  while (true) {
+    j = (j + 1) & s.mask;
+    if (s.slots[j] == 0) { return; }
+    uint64_t home = mix64(s.slots[j]) & s.mask;
+    // entry j may move to the hole at i unless its home lies in (i, j]
+    bool stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+    if (!stays) {
+      s.slots[i] = s.slots[j];
+      s.slots[j] = 0;
+      i = j;
+    }
+  }
+}
+
+/**
+ * @brief looks an ID up in its shard's exact set.
+ *
+ * @attention
+ * - The caller holds the shard lock.
+ */
+bool DedupFilter::contains(DedupShard &s, uint64_t id, uint64_t h) {
+  for (uint64_t i = h & s.mask; s.slots[i] != 0; i = (i + 1) & s.mask) {
+    if (s.slots[i] == id) { return true; }
+  }
+  return false;
+}
+
+/**
+ * @brief records a new ID in its shard and Bloom filter, evicting the
+ *        shard's oldest ID when it is full.
+ *
+ * @attention
+ * - The caller holds the shard lock and knows the ID is not in the set.
+ */
+void DedupFilter::add(DedupShard &s, uint64_t id, uint64_t h) {
+  if (s.count == s.cap) {
+    erase(s, s.ring[s.head]);
+  } else {
+    s.count++;
+  }
+  uint64_t i = h & s.mask;
+  while (s.slots[i] != 0) { i = (i + 1) & s.mask; }
+  s.slots[i] = id;
+  s.ring[s.head] = id;
+  s.head = (s.head + 1) % s.cap;
+  bloom_set(s, h);
+}
+
+/**
+ * @brief Checks an ID and remembers it.
+ *
+ * @param id A non-zero transaction ID.
+ * @return true if the ID was seen before (within the window), false if it
+ * is new.
+ */
+bool DedupFilter::seen(uint64_t id) {
+  uint64_t h = mix64(id);
+  checked.fetch_add(1, memory_order_relaxed);
+  DedupShard &s = shards[h >> (64 - DEDUP_SHARD_BITS)];
+  pthread_mutex_lock(&s.lock);
+  bool duplicate = false;
+  if (bloom_test(s, h)) {
+    maybe.fetch_add(1, memory_order_relaxed);
+    duplicate = contains(s, id, h);
+  }
+  if (!duplicate) { add(s, id, h); }
+  pthread_mutex_unlock(&s.lock);
+  if (duplicate) { duplicates.fetch_add(1, memory_order_relaxed); }
+  return duplicate;
+}
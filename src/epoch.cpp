@@ -0,0 +1,170 @@
+#include "../include/epoch.h"
+#include <iostream> /* for cerr */
+
+using namespace std;
+
+EpochDomain epochs;
+
+/**
+ * @brief owns the calling thread's slot and hands it back when the thread
+ *        exits, so short-lived threads do not exhaust the domain.
+ */
+struct SlotHandle {
+  int slot = -1;
+  ~SlotHandle() {
+    if (slot >= 0) { epochs.release_slot(slot); }
+  }
+};
+
+static thread_local SlotHandle handle;
+
+/**
+ * @brief Construct a new EpochDomain with every slot free.
+ */
+EpochDomain::EpochDomain() {
+  global = 0;
+  for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+    slots[i].state = 0;
+    slots[i].in_use = 0;
+    slots[i].depth = 0;
+  }
+  pthread_mutex_init(&orphan_lock, NULL);
+}
+
+/**
+ * @brief Destroy the EpochDomain, freeing everything still retired.
+ */
+EpochDomain::~EpochDomain() {
+  drain();
+  pthread_mutex_destroy(&orphan_lock);
+}
+
+/**
+ * @brief returns the calling thread's slot, claiming a free one on first use.
+ */
+EpochSlot *EpochDomain::my_slot() {
+  if (handle.slot >= 0) { return &slots[handle.slot]; }
+  for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+    int expected = 0;
+    if (slots[i].in_use.compare_exchange_strong(expected, 1)) {
+      slots[i].depth = 0;
+      handle.slot = i;
+      return &slots[i];
+    }
+  }
+  cerr << "epoch: more than " << EPOCH_MAX_THREADS << " threads" << endl;
+  abort();
+}
+
+/**
+ * @brief enters a critical section; nested calls only count depth.
+ */
+void EpochDomain::enter() {
+  EpochSlot *s = my_slot();
+  if (s->depth++ == 0) {
+    unsigned long e = global.load(memory_order_relaxed);
+    s->state.store((e << 1) | 1, memory_order_relaxed);
+    // the announcement must be visible before any shared pointer is read
+    atomic_thread_fence(memory_order_seq_cst);
+  }
+}
+
+/**
+ * @brief leaves the critical section entered by the matching enter().
+ */
+void EpochDomain::exit() {
+  EpochSlot *s = &slots[handle.slot];
+  if (--s->depth == 0) {
+    s->state.store(0, memory_order_release);
+  }
+}
+
+/**
+ * @brief advances the global epoch if every active thread has observed it.
+ *
+ * @return true if the epoch moved (here or in another thread).
+ */
+bool EpochDomain::try_advance() {
+  unsigned long e = global.load(memory_order_acquire);
+  for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+    if (!slots[i].in_use.load(memory_order_acquire)) { continue; }
+    unsigned long st = slots[i].state.load(memory_order_acquire);
+    if ((st & 1) && (st >> 1) != e) { return false; }
+  }
+  global.compare_exchange_strong(e, e + 1);
+  return true;
+}
+
+/**
+ * @brief frees every entry of `list` retired at least two epochs before
+ *        `safe` and keeps the rest.
+ */
+void EpochDomain::reclaim(vector<Retired> &list, unsigned long safe) {
+  size_t keep = 0;
+  for (size_t i = 0; i < list.size(); i++) {
+    if (list[i].epoch + 2 <= safe) {
+      list[i].free_fn(list[i].ptr);
+    } else {
+      list[keep++] = list[i];
+    }
+  }
+  list.resize(keep);
+}
+
+/**
+ * @brief Defers freeing `ptr` until no reader can still reference it.
+ *
+ * @details
+ * The caller must already have unlinked `ptr` from every shared structure.
+ * Once the thread has EPOCH_BATCH objects pending it tries to advance the
+ * epoch and frees the batch of objects that are now safe, along with any
+ * left behind by threads that have exited.
+ *
+ * @param ptr     The object to free.
+ * @param free_fn The function that frees it.
+ */
+void EpochDomain::retire(void *ptr, void (*free_fn)(void *)) {
+  EpochSlot *s = my_slot();
+  s->retired.push_back({ptr, free_fn, global.load(memory_order_acquire)});
+  if ((int)s->retired.size() < EPOCH_BATCH) { return; }
+
+  try_advance();
+  unsigned long safe = global.load(memory_order_acquire);
+  reclaim(s->retired, safe);
+  if (pthread_mutex_trylock(&orphan_lock) == 0) {
+    reclaim(orphans, safe);
+    pthread_mutex_unlock(&orphan_lock);
+  }
+}
+
+/**
+ * @brief returns a slot to the domain, handing its pending objects to the
+ *        orphan list.
+ *
+ * @param slot The slot index owned by the exiting thread.
+ */
+void EpochDomain::release_slot(int slot) {
+  EpochSlot *s = &slots[slot];
+  pthread_mutex_lock(&orphan_lock);
+  orphans.insert(orphans.end(), s->retired.begin(), s->retired.end());
+  pthread_mutex_unlock(&orphan_lock);
+  s->retired.clear();
+  s->state.store(0, memory_order_release);
+  s->in_use.store(0, memory_order_release);
+}
+
+/**
+ * @brief frees every retired object immediately.
+ *
+ * @attention
+ * - Only call this at a quiescent point, when no thread is inside a
+ * critical section (e.g. after all workers have joined).
+ */
+void EpochDomain::drain() {
+  for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+    reclaim(slots[i].retired, ~0UL);
+  }
+  pthread_mutex_lock(&orphan_lock);
+  reclaim(orphans, ~0UL);
+  pthread_mutex_unlock(&orphan_lock);
+}
@@ -0,0 +1,172 @@
+#include "../include/fx.h"
+#include "../include/ledger.h"
+
+#include <string.h> /* for memset() */
+#include <sstream>
+
+using namespace std;
+
+/**
+ * @brief parses a positive decimal rate such as `1.0842` into fixed point
+ *        scaled by FX_SCALE, without going through floating point.
+ *
+ * @return false if the text is not a positive number with at most 8
+ * decimal places that fits.
+ */
+static bool parse_rate(const string &text, long *rate) {
+  long value = 0;
+  int decimals = -1;  // -1 until the decimal point
+  for (char c : text) {
+    if (c == '.' && decimals < 0) {
+      decimals = 0;
+      continue;
+    }
+    if (c < '0' || c > '9' || decimals == 8 || value > LONG_MAX / 100) {
+      return false;
+    }
+    value = value * 10 + (c - '0');
+    if (decimals >= 0) { decimals++; }
+  }
+  for (int d = decimals < 0 ? 0 : decimals; d < 8; d++) {
+    if (value > LONG_MAX / 10) { return false; }
+    value *= 10;
+  }
+  *rate = value;
+  return value > 0;
+}
+
+/**
+ * @brief Construct an FxTable that only knows the base currency.
+ */
+FxTable::FxTable() : num(1) {
+  codes[0] = "";
+  rates[0] = FX_SCALE;
+  memset(cross_hi, 0, sizeof(cross_hi));
+  memset(cross_lo, 0, sizeof(cross_lo));
+  cross_hi[0] = 1;
+  memset(amounts, 0, sizeof(amounts));
+  memset(his, 0, sizeof(his));
+  memset(los, 0, sizeof(los));
+  memset(froms, 0, sizeof(froms));
+  memset(tos, 0, sizeof(tos));
+}
+
+/**
+ * @brief Loads the rate table.
+ *
+ * @details
+ * One `CODE RATE` line per currency, at most FX_CURRENCIES of them; `#`
+ * starts a comment. The first line names the base currency and its rate
+ * must be 1; every other rate is how many base units one unit is worth,
+ * with at most 8 decimal places. Codes are at most FX_CODE_MAX characters.
+ *
+ * @param path The rates file.
+ * @return 0 on success, -1 if the file cannot be opened or a line is
+ * invalid (the line is printed to stderr).
+ */
+int FxTable::load(const char *path) {
+  ifstream file(path);
+  if (!file.is_open()) { return -1; }
+  string text;
+  int line = 0;
+  num = 0;
+  while (getline(file, text)) {
+    line++;
+    istringstream iss(text.substr(0, text.find('#')));
+    string code, rate, extra;
+    if (!(iss >> code)) { continue; }
+    long value;
+    if (!(iss >> rate) || (iss >> extra) || num == FX_CURRENCIES ||
+        code.size() > FX_CODE_MAX || find(code) != FX_NONE ||
+        !parse_rate(rate, &value) || (num == 0 && value != FX_SCALE)) {
+      cerr << path << ":" << line << ": invalid rate '" << text << "'"
+           << endl;
+      return -1;
+    }
+    codes[num] = code;
+    rates[num] = value;
+    num++;
+  }
+  if (num == 0) { return -1; }
+  // cross rates in 32.32 fixed point, rounded up so an estimate is never
+  // short; the integer part must fit 32 bits
+  for (int from = 0; from < num; from++) {
+    for (int to = 0; to < num; to++) {
+      unsigned __int128 cross =
+          (((unsigned __int128)rates[from] << 32) + rates[to] - 1) /
+          rates[to];
+      if (cross >> 64 != 0 || (uint64_t)cross >> 32 > UINT32_MAX) {
+        cerr << path << ": rate of " << codes[from] << " to " << codes[to]
+             << " is out of range" << endl;
+        return -1;
+      }
+      cross_hi[from * FX_CURRENCIES + to] = (uint64_t)cross >> 32;
+      cross_lo[from * FX_CURRENCIES + to] = (uint32_t)cross;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief returns the index of a currency code, or FX_NONE.
+ */
+int FxTable::find(const string &code) {
+  for (int c = 0; c < num; c++) {
+    if (codes[c] == code) { return c; }
+  }
+  return FX_NONE;
+}
+
+/**
+ * @brief returns the code of a currency index, or `?` for FX_NONE.
+ */
+string FxTable::code(int cur) {
+  return cur >= 0 && cur < num ? codes[cur] : "?";
+}
+
+/**
+ * @brief converts up to FX_BATCH entries.
+ *
+ * Cross rates are gathered into columns first, so the multiply loop runs
+ * over all FX_BATCH lanes with no lookups or branches; lanes past `n` hold
+ * stale columns and are ignored. The estimates are then corrected against
+ * the exact 128-bit products (see FxTable).
+ */
+void FxTable::convert_batch(Ledger *entries, int n) {
+  for (int j = 0; j < n; j++) {
+    const Ledger &e = entries[j];
+    bool known = e.cur >= 0 && e.to >= 0;
+    int pair = known ? e.cur * FX_CURRENCIES + e.to : 0;
+    amounts[j] = e.amount > 0 ? e.amount : 0;
+    his[j] = cross_hi[pair];
+    los[j] = cross_lo[pair];
+    froms[j] = rates[known ? e.cur : 0];
+    tos[j] = rates[known ? e.to : 0];
+  }
+  for (int j = 0; j < FX_BATCH; j++) {
+    credits[j] = (long)((uint64_t)amounts[j] * his[j] +
+                        (((uint64_t)amounts[j] * los[j]) >> 32));
+  }
+  for (int j = 0; j < n; j++) {
+    // the estimate is one too many when it overshoots the exact product
+    unsigned __int128 want = (unsigned __int128)amounts[j] * froms[j];
+    unsigned __int128 got = (unsigned __int128)credits[j] * tos[j];
+    entries[j].credit = credits[j] - (got > want ? 1 : 0);
+  }
+}
+
+/**
+ * @brief Sets each entry's `credit` to its amount converted from currency
+ *        `cur` to currency `to`, rounded down.
+ *
+ * @attention
+ * - Not thread safe: one loader thread converts every entry.
+ *
+ * @param entries The entries to convert.
+ * @param n How many there are.
+ */
+void FxTable::convert(Ledger *entries, size_t n) {
+  for (size_t i = 0; i < n; i += FX_BATCH) {
+    convert_batch(entries + i, min(n - i, (size_t)FX_BATCH));
+  }
+}
@@ -0,0 +1,250 @@
+#include "../include/history.h"
+#include <algorithm> /* for sort() and inplace_merge() */
+
+using namespace std;
+
+// segment being filled by the calling thread
+static thread_local vector<HistoryEntry> *local_segment = NULL;
+
+/**
+ * @brief appends `v` to `out` as a zigzag-encoded varint.
+ */
+static void put_varint(vector<uint8_t> &out, long v) {
+  unsigned long z = ((unsigned long)v << 1) ^ (unsigned long)(v >> 63);
+  while (z >= 0x80) {
+    out.push_back((uint8_t)(z | 0x80));
+    z >>= 7;
+  }
+  out.push_back((uint8_t)z);
+}
+
+/**
+ * @brief decodes a zigzag varint starting at `p` and advances `p`.
+ */
+static long get_varint(const uint8_t *&p) {
+  unsigned long z = 0;
+  int shift = 0;
+  while (*p & 0x80) {
+    z |= (unsigned long)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  z |= (unsigned long)(*p++) << shift;
+  return (long)(z >> 1) ^ -(long)(z & 1);
+}
+
+/**
+ * @brief Construct a new HistoryIndex and start its merger thread.
+ */
+HistoryIndex::HistoryIndex() {
+  pthread_mutex_init(&queue_lock, NULL);
+  pthread_cond_init(&queue_cond, NULL);
+  pthread_mutex_init(&index_lock, NULL);
+  stopping = false;
+  pthread_create(&merger_thread, NULL, merger, this);
+}
+
+/**
+ * @brief Destroy the HistoryIndex object, merging anything still pending.
+ */
+HistoryIndex::~HistoryIndex() {
+  finish();
+  pthread_mutex_destroy(&index_lock);
+  pthread_cond_destroy(&queue_cond);
+  pthread_mutex_destroy(&queue_lock);
+}
+
+/**
+ * @brief Records a change to an account in the calling thread's segment.
+ *
+ * @param acc The account that changed.
+ * @param ledgerID The ID of the ledger entry that changed it.
+ * @param amount The signed change to the balance.
+ */
+void HistoryIndex::record(int acc, int ledgerID, long amount) {
+  if (local_segment == NULL) {
+    local_segment = new vector<HistoryEntry>;
+    local_segment->reserve(HISTORY_SEGMENT);
+  }
+  local_segment->push_back({acc, ledgerID, amount});
+  if ((int)local_segment->size() >= HISTORY_SEGMENT) {
+    hand_off(local_segment);
+    local_segment = NULL;
+  }
+}
+
+/**
+ * @brief hands the calling thread's partial segment to the merger. Workers
+ *        call this before they exit.
+ */
+void HistoryIndex::flush() {
+  if (local_segment == NULL) { return; }
+  hand_off(local_segment);
+  local_segment = NULL;
+}
+
+/**
+ * @brief queues a segment for the merger thread.
+ */
+void HistoryIndex::hand_off(vector<HistoryEntry> *segment) {
+  pthread_mutex_lock(&queue_lock);
+  pending.push_back(segment);
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+/**
+ * @brief appends an entry to the end of an account's compressed list.
+ */
+static void append(AccountHistory *h, int ledgerID, long amount) {
+  if (h->count % HISTORY_MARK == 0) {
+    h->marks.push_back({h->last_lid, h->bytes.size()});
+  }
+  put_varint(h->bytes, (long)ledgerID - h->last_lid);
+  put_varint(h->bytes, amount);
+  h->last_lid = ledgerID;
+  h->count++;
+}
+
+/**
+ * @brief merges a run of one account's entries, sorted by ledgerID, into
+ *        its compressed list.
+ *
+ * @details
+ * A run that starts at or after the list's last ledgerID is appended.
+ * Otherwise the list is cut at the last mark whose previous ledgerID is not
+ * after the run's first, and the decoded tail and the run are merged back
+ * in order; existing entries go first among equal ledgerIDs.
+ */
+static void merge_run(AccountHistory *h, const HistoryEntry *first,
+                      const HistoryEntry *last) {
+  if (h->count == 0 || first->ledgerID >= h->last_lid) {
+    for (const HistoryEntry *e = first; e != last; e++) {
+      append(h, e->ledgerID, e->amount);
+    }
+    return;
+  }
+  auto mark = upper_bound(h->marks.begin(), h->marks.end(), first->ledgerID,
+                          [](int lid, const pair<int, size_t> &m) {
+                            return lid < m.first;
+                          }) - 1;
+  long kept = (mark - h->marks.begin()) * (long)HISTORY_MARK;
+  vector<HistoryEntry> tail;
+  tail.reserve(h->count - kept + (last - first));
+  const uint8_t *p = h->bytes.data() + mark->second;
+  long lid = mark->first;
+  for (long i = kept; i < h->count; i++) {
+    lid += get_varint(p);
+    long amount = get_varint(p);
+    tail.push_back({0, (int)lid, amount});
+  }
+  size_t middle = tail.size();
+  tail.insert(tail.end(), first, last);
+  inplace_merge(tail.begin(), tail.begin() + middle, tail.end(),
+                [](const HistoryEntry &a, const HistoryEntry &b) {
+                  return a.ledgerID < b.ledgerID;
+                });
+  h->bytes.resize(mark->second);
+  h->last_lid = mark->first;
+  h->count = kept;
+  h->marks.erase(mark, h->marks.end());
+  for (const HistoryEntry &e : tail) { append(h, e.ledgerID, e.amount); }
+}
+
+/**
+ * @brief sorts a segment by account and ledgerID and merges each account's
+ *        entries into its compressed list.
+ */
+void HistoryIndex::merge(vector<HistoryEntry> *segment) {
+  sort(segment->begin(), segment->end(),
+       [](const HistoryEntry &a, const HistoryEntry &b) {
+         return a.acc != b.acc ? a.acc < b.acc : a.ledgerID < b.ledgerID;
+       });
+  pthread_mutex_lock(&index_lock);
+  const HistoryEntry *e = segment->data();
+  const HistoryEntry *end = e + segment->size();
+  while (e != end) {
+    const HistoryEntry *run = e;
+    while (e != end && e->acc == run->acc) { e++; }
+    merge_run(&index[run->acc], run, e);
+  }
+  pthread_mutex_unlock(&index_lock);
+  delete segment;
+}
+
+/**
+ * @brief Merger thread: merges queued segments until finish() is called and
+ *        the queue is empty.
+ *
+ * @param self The HistoryIndex being merged.
+ * @return NULL once stopped.
+ */
+void *HistoryIndex::merger(void *self) {
+  HistoryIndex *h = (HistoryIndex *)self;
+  vector<vector<HistoryEntry> *> batch;
+  while (true) {
+    pthread_mutex_lock(&h->queue_lock);
+    while (h->pending.empty() && !h->stopping) {
+      pthread_cond_wait(&h->queue_cond, &h->queue_lock);
+    }
+    if (h->pending.empty()) {
+      pthread_mutex_unlock(&h->queue_lock);
+      return NULL;
+    }
+    batch.swap(h->pending);
+    pthread_mutex_unlock(&h->queue_lock);
+
+    for (vector<HistoryEntry> *segment : batch) {
+      h->merge(segment);
+    }
+    batch.clear();
+  }
+}
+
+/**
+ * @brief Merges everything still buffered by the calling thread or queued and
+ *        stops the merger thread. Safe to call more than once.
+ */
+void HistoryIndex::finish() {
+  flush();
+  pthread_mutex_lock(&queue_lock);
+  bool running = !stopping;
+  stopping = true;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  if (running) {
+    pthread_join(merger_thread, NULL);
+  }
+}
+
+/**
+ * @brief Returns the merged history of an account.
+ *
+ * @details
+ * Looks the account up in the index and decodes its compressed list into
+ * (ledgerID, signed amount) pairs, in ledgerID order. Safe while workers
+ * run; entries still buffered in their segments are not seen yet.
+ *
+ * @param acc The account to look up.
+ * @param out Receives the decoded entries (appended).
+ * @return the number of entries decoded.
+ */
+long HistoryIndex::query(int acc, vector<pair<int, long>> &out) {
+  pthread_mutex_lock(&index_lock);
+  auto it = index.find(acc);
+  if (it == index.end()) {
+    pthread_mutex_unlock(&index_lock);
+    return 0;
+  }
+  const AccountHistory &h = it->second;
+  long count = h.count;
+  out.reserve(out.size() + count);
+  const uint8_t *p = h.bytes.data();
+  long lid = 0;
+  for (long i = 0; i < count; i++) {
+    lid += get_varint(p);
+    long amount = get_varint(p);
+    out.push_back({(int)lid, amount});
+  }
+  pthread_mutex_unlock(&index_lock);
+  return count;
+}
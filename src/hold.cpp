@@ -0,0 +1,93 @@
+#include "../include/hold.h"
+
+using namespace std;
+
+/**
+ * @brief Construct a new HoldTable with the ledger clock at 0.
+ */
+HoldTable::HoldTable() : expiry(0) {
+  pthread_mutex_init(&lock, NULL);
+}
+
+/**
+ * @brief Destroy the HoldTable object and every hold still open.
+ */
+HoldTable::~HoldTable() {
+  for (auto &entry : by_id) {
+    expiry.remove(entry.second);
+    delete entry.second;
+  }
+  pthread_mutex_destroy(&lock);
+}
+
+/**
+ * @brief Adds an open hold.
+ *
+ * @param h The hold, with `expires` set if `expires` is true.
+ * @param expires Whether the hold expires.
+ * @return true on success, false if a hold with the same ID is open or the
+ * expiry time has already passed on the ledger clock.
+ */
+bool HoldTable::add(Hold *h, bool expires) {
+  pthread_mutex_lock(&lock);
+  bool ok = by_id.find(h->ledgerID) == by_id.end() &&
+            (!expires || expiry.insert(h));
+  if (ok) { by_id[h->ledgerID] = h; }
+  pthread_mutex_unlock(&lock);
+  return ok;
+}
+
+/**
+ * @brief Removes an open hold so it can be captured or released.
+ *
+ * @param ledgerID The ID of the hold.
+ * @param accountID The account the hold must be on.
+ * @param amount The hold must be at least this large.
+ * @return The hold, which now belongs to the caller, or NULL if no matching
+ * hold is open.
+ */
+Hold *HoldTable::take(int ledgerID, int accountID, long amount) {
+  pthread_mutex_lock(&lock);
+  Hold *h = NULL;
+  auto it = by_id.find(ledgerID);
+  if (it != by_id.end() && it->second->accountID == accountID &&
+      amount <= it->second->amount) {
+    h = it->second;
+    by_id.erase(it);
+    expiry.remove(h);
+  }
+  pthread_mutex_unlock(&lock);
+  return h;
+}
+
+/**
+ * @brief Advances the ledger clock and removes the holds that expired.
+ *
+ * @param now The ledger clock.
+ * @return The expired holds, linked through `next`, which now belong to the
+ * caller, or NULL.
+ */
+Hold *HoldTable::expire(long now) {
+  pthread_mutex_lock(&lock);
+  Timer *due = expiry.advance(now);
+  for (Timer *t = due; t != NULL; t = t->next) {
+    by_id.erase(((Hold *)t)->ledgerID);
+  }
+  pthread_mutex_unlock(&lock);
+  return (Hold *)due;
+}
+
+/**
+ * @brief Lists the open holds. They stay in the table.
+ *
+ * @attention
+ * - Call at a quiescent point; the holds are only valid until the next
+ * take() or expire().
+ *
+ * @param out Receives the holds.
+ */
+void HoldTable::list(vector<Hold *> &out) {
+  pthread_mutex_lock(&lock);
+  for (auto &entry : by_id) { out.push_back(entry.second); }
+  pthread_mutex_unlock(&lock);
+}
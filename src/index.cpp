@@ -0,0 +1,94 @@
+#include "../include/index.h"
+#include "../include/ledger.h"
+
+#include <string.h>   /* for memcmp() */
+#include <sys/stat.h> /* for stat() */
+
+using namespace std;
+
+/**
+ * @brief path of the sidecar index for a ledger file.
+ */
+static string index_path(const char *filename) {
+  return string(filename) + ".idx";
+}
+
+/**
+ * @brief Builds the sidecar index for a ledger file.
+ *
+ * @details
+ * Scans the ledger once, numbering valid lines exactly as load_ledger()
+ * does, and records the byte offset of every LEDGER_INDEX_BLOCK-th entry.
+ * The index is written to `<filename>.idx`.
+ *
+ * @param filename The ledger file to index.
+ * @return 0 on success, -1 if the ledger cannot be read or the index cannot
+ * be written.
+ */
+int build_ledger_index(const char *filename) {
+  struct stat st;
+  ifstream file(filename);
+  if (!file.is_open() || stat(filename, &st) != 0) { return -1; }
+
+  vector<int64_t> offsets;
+  string line;
+  Ledger entry;
+  int64_t offset = 0;
+  int ledgerID = 0;
+  while (getline(file, line)) {
+    if (parse_ledger_line(line, entry)) {
+      if (ledgerID % LEDGER_INDEX_BLOCK == 0) { offsets.push_back(offset); }
+      ledgerID++;
+    }
+    offset += line.size() + 1;
+  }
+
+  IndexHeader header;
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.ledger_size = st.st_size;
+  header.ledger_mtime = st.st_mtime;
+  header.block = LEDGER_INDEX_BLOCK;
+  header.count = offsets.size();
+
+  ofstream out(index_path(filename), ios::binary | ios::trunc);
+  if (!out.is_open()) { return -1; }
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)offsets.data(), offsets.size() * sizeof(int64_t));
+  return out.good() ? 0 : -1;
+}
+
+/**
+ * @brief Loads the sidecar index for a ledger file, building it first if it
+ *        is missing or was built from a different version of the ledger.
+ *
+ * @param filename The ledger file.
+ * @param offsets Receives the block offsets.
+ * @return 0 on success, -1 on failure.
+ */
+int load_ledger_index(const char *filename, vector<int64_t> &offsets) {
+  struct stat st;
+  if (stat(filename, &st) != 0) { return -1; }
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    ifstream in(index_path(filename), ios::binary);
+    IndexHeader header;
+    // the offsets must fit in the index file, so a damaged count is
+    // rebuilt rather than sized
+    struct stat idx;
+    if (in.is_open() && in.read((char *)&header, sizeof(header)) &&
+        memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.ledger_size == st.st_size &&
+        header.ledger_mtime == st.st_mtime &&
+        header.block == LEDGER_INDEX_BLOCK &&
+        stat(index_path(filename).c_str(), &idx) == 0 && header.count >= 0 &&
+        header.count <=
+            (idx.st_size - (off_t)sizeof(header)) / (off_t)sizeof(int64_t)) {
+      offsets.resize(header.count);
+      if (in.read((char *)offsets.data(), header.count * sizeof(int64_t))) {
+        return 0;
+      }
+    }
+    if (attempt == 0 && build_ledger_index(filename) != 0) { return -1; }
+  }
+  return -1;
+}
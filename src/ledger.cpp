@@ -1,5 +1,17 @@
 #include "../include/ledger.h"
 #include "../include/bank.h"
+#include "../include/dedup.h"
+#include "../include/index.h"
+#include "../include/merge.h"
+#include "../include/pool.h"
+#include "../include/rules.h"
+#include "../include/shard.h"
+#include "../include/sketch.h"
+#include "../include/wheel.h"
+#include <fcntl.h>  /* for open() */
+#include <signal.h> /* for sigwait() and pthread_sigmask() */
+#include <stdio.h>  /* for rename() */
+#include <unistd.h> /* for sysconf() and close() */
 #include <sstream>
 
 using namespace std;
@@ -9,6 +21,201 @@ pthread_mutex_t ledger_lock;
 
 list<struct Ledger> ledger;
 Bank *bank;
+vector<Bank *> banks;  // every tenant, `bank` first
+RunOptions opts;
+int next_ledgerID = 0;
+int exit_status = 0;
+
+static atomic<bool> checker_stop{false};
+static atomic<bool> history_stop{false};
+
+// entries the merge loader moves into the ledger per lock acquisition
+const size_t LEDGER_BATCH = 256;
+
+// streaming loader state, guarded by ledger_lock
+static pthread_cond_t ledger_cond = PTHREAD_COND_INITIALIZER;  // entries added
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;   // queue drained
+static bool ledger_done = true;  // no more entries will be added
+
+// cooperative cancellation on SIGINT or SIGTERM, guarded by ledger_lock
+// except where noted
+static bool cancelled = false;     // workers stop taking entries
+static int cancel_signal = 0;
+static int taken_upto = -1;        // largest ledgerID a worker has taken
+static atomic<bool> load_cancelled{false};  // read by load_ledger() unlocked
+static atomic<bool> canceller_stop{false};
+static sigset_t cancel_signals;
+
+/**
+ * @brief a scheduled or recurring ledger entry waiting in the timing wheel.
+ */
+struct ScheduledEntry : Timer {
+  Ledger entry;   // what to run, with the plain mode
+  long every;     // period, 0 for a one-shot entry
+  int remaining;  // executions left, 0 = no limit
+};
+
+// pending schedules on the ledger clock, guarded by ledger_lock
+static TimingWheel *schedules;
+static long num_scheduled = 0;
+static long num_fired = 0;
+
+// schedules restored from a checkpoint, and those left for --progress
+static vector<ScheduleRecord> restored_schedules;
+static vector<ScheduleRecord> progress_schedules;
+static void run_due(Timer *due);
+static void save_schedules(const list<Ledger> &unrun);
+static void restore_schedules();
+
+// duplicate filter for txn= IDs, NULL unless --dedup is given
+static DedupFilter *dedup;
+
+// account access frequencies, NULL unless --top is given
+static AccessSketch *sketch;
+
+// screening rules, NULL unless --rules is given; used by the loader only
+static RuleSet *rules;
+
+// replication to a standby process, NULL unless --replica is given
+static Replicator *replica;
+
+// asynchronous log file writer, NULL unless --log-file is given
+static LogWriter *log_out;
+
+// compressed log segments, NULL unless --log-segments is given
+static SegmentLog *log_segments;
+
+// the --log-sink filter in front of the log, NULL if every line is kept
+static LogFilter *log_filter;
+
+/**
+ * @brief frees every tenant's bank.
+ */
+static void delete_banks() {
+  for (Bank *b : banks) { delete b; }
+  banks.clear();
+  bank = NULL;
+}
+
+/**
+ * @brief checks money conservation in every tenant's bank, naming tenants
+ *        after the first, and the shard, in the log line.
+ *
+ * @return true if the invariant holds in all of them.
+ */
+static bool check_tenants(const char *where) {
+  bool ok = true;
+  string shard = shard_id < 0 ? "" : "shard " + to_string(shard_id) + " ";
+  for (Bank *b : banks) {
+    string at = b->tenant == 0 ? shard + where
+                               : "tenant " + to_string(b->tenant) + " " + where;
+    ok = b->check_invariant(at.c_str()) && ok;
+  }
+  return ok;
+}
+
+/**
+ * @brief logs the screening statistics to stderr.
+ */
+static void print_rules_stats() {
+  cerr << "[ RULES ] rules: " << rules->size()
+       << " screened: " << rules->screened << " denied: " << rules->denied
+       << " eval: " << (rules->screened ? rules->nanos / rules->screened : 0)
+       << " ns/entry" << endl;
+}
+
+/**
+ * @brief Canceller thread: waits for SIGINT or SIGTERM, which every other
+ *        thread blocks, and asks the loader and the workers to stop.
+ *
+ * @details
+ * Running in a thread rather than a signal handler lets it take ledger_lock
+ * and wake the threads waiting on the ledger's condition variables. Workers
+ * finish the entry they are running and exit instead of taking another, so
+ * every entry up to `taken_upto` has been applied once they have joined. A
+ * second signal exits at once. InitBank() stops the thread by setting
+ * `canceller_stop` and sending it SIGTERM.
+ *
+ * @param unused Not used.
+ * @return NULL once stopped.
+ */
+static void *canceller(void *unused) {
+  (void)unused;
+  while (true) {
+    int sig;
+    if (sigwait(&cancel_signals, &sig) != 0 || canceller_stop) {
+      return NULL;
+    }
+    if (load_cancelled) {
+      cerr << "[ CANCEL ] signal " << sig << " again, exiting" << endl;
+      _exit(128 + sig);
+    }
+    cerr << "[ CANCEL ] signal " << sig << ", draining" << endl;
+    load_cancelled = true;
+    pthread_mutex_lock(&ledger_lock);
+    cancelled = true;
+    cancel_signal = sig;
+    pthread_cond_broadcast(&ledger_cond);
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&ledger_lock);
+  }
+}
+
+/**
+ * @brief stops and joins the canceller thread, if it was started.
+ */
+static void stop_canceller(pthread_t thread) {
+  if (opts.shards > 1) { return; }
+  canceller_stop = true;
+  pthread_kill(thread, SIGTERM);
+  pthread_join(thread, NULL);
+}
+
+/**
+ * @brief writes tenant 0's balances as a binary report to `opts.progress`,
+ *        followed by the holds, velocity windows and schedules a resumed
+ *        run needs (see Bank::write_state()), through a temporary file
+ *        renamed over it, so a crash never leaves a partial marker behind.
+ *
+ * @return 0 on success, -1 if the file cannot be written.
+ */
+static int write_progress() {
+  string tmp = opts.progress + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return -1; }
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int rc = bank->write_report(fd, REPORT_BIN, threads, next_ledgerID - 1);
+  if (rc == 0) { rc = bank->write_state(fd, progress_schedules); }
+  if (fsync(fd) != 0) { rc = -1; }
+  close(fd);
+  if (rc != 0 || rename(tmp.c_str(), opts.progress.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Standby takeover: the primary went away before finishing, so the
+ *        standby writes the report and the --progress marker in its place.
+ *
+ * The balances and holds are those of every entry up to `last`; velocity
+ * limits and schedules are not replicated, so the marker carries none. The
+ * standby runs no entries, so the counts it prints are zero. Logs
+ * `[ REPL ] primary lost, standby took over after LID: {last}` to stderr.
+ *
+ * @param last The last ledgerID whose changes the standby applied.
+ */
+static void take_over(int last) {
+  cerr << "[ REPL ] primary lost, standby took over after LID: " << last
+       << endl;
+  next_ledgerID = last + 1;
+  write_final_report();
+  if (!opts.progress.empty() && write_progress() != 0) {
+    cerr << "cannot write progress marker " << opts.progress << endl;
+    exit_status = 1;
+  }
+}
 
 /**
  * @brief Initializes a banking system with a specified number of worker threads
@@ -21,11 +228,72 @@ Bank *bank;
  * the bank's accounts.
  *
  * @attention
- * - Initialize the bank with 10 accounts.
+ * - Initialize the bank with `opts.accounts` accounts (10 by default).
  * - If `load_ledger()` fails, exit and free allocated memory.
  * - Be careful how you pass the thread ID to ensure the value does not get
  * changed.
  * - Don't forget to join all created threads.
+ * - With `opts.checkpoint` the balances are restored from a binary report
+ * before the ledger is loaded.
+ * - With `opts.check` money conservation is checked after the ledger and after
+ * the end-of-day jobs; `opts.check_ms` also checks periodically while the
+ * workers run. A failed check sets `exit_status`.
+ * - With `opts.adaptive` the workers form an elastic pool: `num_workers` is
+ * the upper bound and the controller parks or wakes workers as contention
+ * changes.
+ * - With `opts.ledgers` the files are not preloaded: a loader thread merges
+ * them by timestamp and streams the entries to the workers (see
+ * merge_loader()).
+ * - Scheduled entries wait in a timing wheel driven by the ledger clock (see
+ * worker()); a summary is logged to stderr if the ledger had any.
+ * - With `opts.dedup` entries whose `txn=` ID was already seen are rejected
+ * (see DedupFilter); filter statistics are logged to stderr.
+ * - With `opts.top` workers sketch account accesses and the `opts.top` most
+ * accessed accounts are logged to stderr once they have joined.
+ * - With `opts.rules` the rules file is compiled before the ledger is
+ * loaded and every entry is screened as it is loaded (see RuleSet); a file
+ * that does not parse exits like a bad checkpoint. Screening statistics are
+ * logged to stderr.
+ * - With `opts.fx` the FX rate table is loaded before the checkpoint and the
+ * ledger; a bad rates file exits like a bad checkpoint.
+ * - With `opts.tenants` the process hosts that many banks in `banks`, each
+ * with its own account table, counters, checks and report, sharing the
+ * workers, the ledger and the log. `bank` is tenant 0, which alone takes
+ * the checkpoint and the history index.
+ * - With `opts.replica` a hot standby process is forked once the starting
+ * balances are set (see Replicator). Every change is shipped to it and
+ * applied there; after the end-of-day jobs the standby's balances are
+ * compared with the bank's, and a mismatch or a lost standby sets
+ * `exit_status`. If the primary goes away first, the standby takes over
+ * (see take_over()).
+ * - Without `opts.shards`, SIGINT and SIGTERM cancel the run (see
+ * canceller()): the workers drain, the balances reflect every entry up to
+ * the last one taken, the end-of-day jobs are skipped and the report
+ * covers that entry, and the exit status is 128 plus the signal.
+ * - With `opts.progress` tenant 0's balances are written there as a binary
+ * report at exit, finished or cancelled, so `--checkpoint` resumes after
+ * the last entry applied.
+ * - With `opts.log_file` every tenant's log goes to that file through a
+ * LogWriter instead of stdout; it is opened before the ledger is loaded
+ * (a file that cannot be opened exits like a bad checkpoint) and closed
+ * after the end-of-day jobs. A failed write sets `exit_status`. With
+ * `opts.log_format` LOG_BIN the file holds a LogHeader and LogRecords
+ * packed into 24-byte units (see pack_log()) instead of text, rendered
+ * offline by `log_render`.
+ * - With `opts.log_segments` the log goes to that directory instead, as
+ * segments a SegmentLog compresses in the background; it is opened and
+ * closed like the log file.
+ * - `opts.log_sink` puts a LogFilter in front of the log (stdout, file or
+ * segments) that drops every line, keeps one in `opts.log_sample`, or only
+ * failures; the counters still count every outcome.
+ * - With `opts.shards` the accounts are partitioned across that many shard
+ * processes forked before anything else starts (see start_shards()). This
+ * process becomes the coordinator: it loads and screens the ledger, routes
+ * it to the shards (see coordinate()) and writes the final report of their
+ * merged results. Each shard runs the rest of InitBank() with its own
+ * `num_workers` workers on the accounts it owns, streaming entries from the
+ * coordinator (see shard_loader()), and sends its counts and balances back
+ * instead of writing a report.
  *
  * @param num_workers The number of worker threads to be created for concurrent
  * operations.
@@ -34,31 +302,378 @@ Bank *bank;
  */
 void InitBank(int num_workers, char *filename) {
   // initialize bank
-  bank = new Bank(10); 
+  bank = new Bank(opts.accounts); 
+  banks.push_back(bank);
+  for (int t = 1; t < opts.tenants; t++) {
+    banks.push_back(new Bank(opts.accounts));
+    banks[t]->share_log(bank, t);
+  }
+  // fork the shards while this is the only thread
+  if (opts.shards > 1) {
+    if (start_shards() != 0) {
+      exit_status = 1;
+      delete_banks();
+      return;
+    }
+    shard_claim(bank);
+  }
+  // every thread started from here on leaves the cancel signals to the
+  // canceller
+  if (opts.shards == 1) {
+    sigemptyset(&cancel_signals);
+    sigaddset(&cancel_signals, SIGINT);
+    sigaddset(&cancel_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &cancel_signals, NULL);
+  }
+  // currencies must be known to restore a checkpoint and parse the ledger
+  for (Bank *b : banks) {
+    if (!opts.fx.empty() && b->load_fx(opts.fx.c_str()) != 0) {
+      cerr << "cannot load FX rates " << opts.fx << endl;
+      exit_status = 1;
+      delete_banks();
+      return;
+    }
+  }
+  // restore a checkpoint and by default replay from the entry after it
+  if (!opts.checkpoint.empty()) {
+    int last;
+    if (bank->load_checkpoint(opts.checkpoint.c_str(), &last,
+                              &restored_schedules) != 0) {
+      cerr << "cannot load checkpoint " << opts.checkpoint << endl;
+      exit_status = 1;
+      delete_banks();
+      return;
+    }
+    if (opts.range_first < 0) { opts.range_first = last + 1; }
+  }
+  if (opts.range_first < 0) { opts.range_first = 0; }
+  taken_upto = opts.range_first - 1;
+  // the standby starts from the restored balances and only applies changes
+  if (opts.replica != REPLICA_OFF) {
+    replica = new Replicator(opts.replica, taken_upto);
+    if (replica->start() != 0 || replica->standby) {
+      int last;
+      int rc = replica->standby ? replica->run_standby(bank, &last) : -1;
+      if (rc == 1) {
+        take_over(last);
+      } else if (rc != 0) {
+        exit_status = 1;
+      }
+      delete replica;
+      delete_banks();
+      return;
+    }
+    bank->replica = replica;
+  }
+  // the coordinator screens entries before routing them
+  if (!opts.rules.empty() && shard_id < 0) {
+    rules = new RuleSet();
+    if (rules->load(opts.rules.c_str()) != 0) {
+      cerr << "cannot load rules " << opts.rules << endl;
+      exit_status = 1;
+      delete rules;
+      delete_banks();
+      return;
+    }
+  }
+  if (opts.mvcc >= 0 && (opts.shards == 1 || shard_id >= 0)) {
+    for (Bank *b : banks) { b->enable_versions(opts.mvcc); }
+  }
+  if (!opts.history.empty()) { bank->enable_history(); }
+  // the standby, if any, is forked, so threads may start
+  pthread_t cancel_thread;
+  if (opts.shards == 1) {
+    pthread_create(&cancel_thread, NULL, canceller, NULL);
+  }
+  if (!opts.log_file.empty()) {
+    log_out = new LogWriter(opts.log_io, opts.log_sync);
+    LogHeader header;
+    log_header(&header, bank->fx);
+    bool binary = opts.log_format == LOG_BIN;
+    if (log_out->open(opts.log_file.c_str(), binary ? &header : NULL,
+                      sizeof(header)) != 0) {
+      cerr << "cannot open log file " << opts.log_file << endl;
+      exit_status = 1;
+      stop_canceller(cancel_thread);
+      delete log_out;
+      delete_banks();
+      delete rules;
+      return;
+    }
+  }
+  if (!opts.log_segments.empty()) {
+    log_segments = new SegmentLog(opts.log_segment_mb << 20,
+                                  opts.log_rotate_ms);
+    LogHeader header;
+    log_header(&header, bank->fx);
+    if (log_segments->open(opts.log_segments.c_str(), opts.log_format,
+                           header) != 0) {
+      cerr << "cannot open log segments " << opts.log_segments << endl;
+      exit_status = 1;
+      stop_canceller(cancel_thread);
+      delete log_segments;
+      delete_banks();
+      delete rules;
+      return;
+    }
+  }
+  LogSink *sink = log_out ? (LogSink *)log_out
+                  : log_segments ? (LogSink *)log_segments
+                                 : (LogSink *)&log_cout;
+  log_filter = make_log_filter(opts.log_sink, opts.log_sample, sink);
+  if (log_filter) { sink = log_filter; }
+  for (Bank *b : banks) { b->log_sink = sink; }
+  // several ledger files are merged by a loader thread while workers run
+  LedgerMerge merge;
+  pthread_t loader_thread;
+  bool streaming = !opts.ledgers.empty() || shard_id >= 0;
+  // a shard streams the entries its coordinator routes to it
+  if (shard_id >= 0) {
+    ledger_done = false;
+    pthread_create(&loader_thread, NULL, shard_loader, NULL);
+  }
+  else if (!opts.ledgers.empty()) {
+    vector<string> files(1, filename);
+    files.insert(files.end(), opts.ledgers.begin(), opts.ledgers.end());
+    if (merge.open(files) != 0) {
+      cerr << "cannot open ledger " << merge.failed << endl;
+      exit_status = 1;
+      stop_canceller(cancel_thread);
+      delete log_out;
+      delete log_segments;
+      delete log_filter;
+      delete_banks();
+      delete rules;
+      return;
+    }
+    ledger_done = false;
+    pthread_create(&loader_thread, NULL, merge_loader, &merge);
+  }
   // load_ledger fails, exit and free memory
-  if (load_ledger(filename) != 0) {
-    delete bank;
+  else if (load_ledger(filename) != 0) {
+    if (opts.shards > 1) { coordinate(); }
+    stop_canceller(cancel_thread);
+    delete log_out;
+    delete log_segments;
+    delete log_filter;
+    delete_banks();
+    delete rules;
     return; 
   }
-  // create array of workers
+  // the coordinator hands the ledger to the shards and reports their results
+  if (opts.shards > 1 && shard_id < 0) {
+    coordinate();
+    if (rules) { print_rules_stats(); }
+    write_final_report();
+    delete_banks();
+    delete rules;
+    return;
+  }
+  schedules = new TimingWheel(bank->clock.load());
+  restore_schedules();
+  if (opts.dedup > 0) { dedup = new DedupFilter(opts.dedup); }
+  if (opts.top > 0) { sketch = new AccessSketch(); }
+  // create worker pool and array of workers
+  pool = new WorkerPool(num_workers, opts.adaptive);
   pthread_t* workers = new pthread_t[num_workers];
   // initialize threads
   for (int i = 0; i < num_workers; i++) {
     void* id = (void*)(intptr_t) i; 
     pthread_create(&workers[i], NULL, worker, id);
   }
+  pool->start();
+  // periodic conservation checks
+  pthread_t check_thread;
+  if (opts.check_ms > 0) {
+    pthread_create(&check_thread, NULL, checker, NULL);
+  }
+  // live history queries
+  pthread_t history_thread;
+  bool live_history = bank->history && opts.history_ms > 0;
+  if (live_history) {
+    pthread_create(&history_thread, NULL, history_reporter, NULL);
+  }
   // join threads at the end
   for (int i = 0; i < num_workers; i++) {
     int id = i; 
     pthread_join(workers[id], NULL);
   }
-  // print balances
-  bank->print_account(); 
+  if (streaming) {
+    pthread_join(loader_thread, NULL);
+  }
+  if (opts.check_ms > 0) {
+    checker_stop = true;
+    pthread_join(check_thread, NULL);
+  }
+  if (live_history) {
+    history_stop = true;
+    pthread_join(history_thread, NULL);
+  }
+  // a cancelled run covers the entries taken before the signal
+  pthread_mutex_lock(&ledger_lock);
+  bool stopped = cancelled;
+  int stop_signal = cancel_signal;
+  if (stopped) {
+    cerr << "[ CANCEL ] stopped after ledgerID " << taken_upto << ", "
+         << ledger.size() << " queued entries dropped" << endl;
+    next_ledgerID = taken_upto + 1;
+  }
+  if (!opts.progress.empty()) { save_schedules(ledger); }
+  ledger.clear();
+  pthread_mutex_unlock(&ledger_lock);
+  // stop the controller
+  delete pool;
+  if (num_scheduled > 0) {
+    cerr << "[ SCHED ] scheduled: " << num_scheduled << " fired: " << num_fired
+         << " pending: " << schedules->size() << endl;
+  }
+  delete schedules;
+  if (dedup) {
+    cerr << "[ DEDUP ] checked: " << dedup->checked
+         << " filter positives: " << dedup->maybe
+         << " duplicates: " << dedup->duplicates << endl;
+  }
+  if (sketch) {
+    sketch->report(opts.top);
+    delete sketch;
+  }
+  if (rules) { print_rules_stats(); }
+  if (opts.check && !check_tenants("end of ledger")) {
+    exit_status = 1;
+  }
+  // end-of-day jobs, unless the day was cut short
+  if ((opts.interest > 0 || opts.fee > 0) && !stopped) {
+    run_bulk_jobs(num_workers);
+    if (opts.check && !check_tenants("end of day")) {
+      exit_status = 1;
+    }
+  }
+  // every log line is written by now
+  if (log_out && log_out->close() != 0) {
+    exit_status = 1;
+  }
+  if (log_segments && log_segments->close() != 0) {
+    exit_status = 1;
+  }
+  if (log_filter) { log_filter->print_stats(); }
+  // let the standby catch up and compare its balances
+  if (replica && !replica->finish(bank)) {
+    exit_status = 1;
+  }
+  // report final balances, or send them to the coordinator
+  if (shard_id >= 0) {
+    if (shard_finish(next_ledgerID - 1) != 0) { exit_status = 1; }
+  } else {
+    write_final_report();
+  }
+  if (!opts.progress.empty() && write_progress() != 0) {
+    cerr << "cannot write progress marker " << opts.progress << endl;
+    exit_status = 1;
+  }
+  if (stopped) {
+    cerr << "[ CANCEL ] resume with --checkpoint "
+         << (opts.progress.empty() ? "<binary report>" : opts.progress)
+         << endl;
+    exit_status = 128 + stop_signal;
+  }
+  stop_canceller(cancel_thread);
+  // merge the history index and answer history queries
+  if (bank->history) {
+    bank->history->finish();
+    for (int acc : opts.history) { print_history(acc); }
+  }
   // free memory
-  delete bank; 
+  delete_banks();
+  delete dedup;
+  delete rules;
+  delete replica;
+  delete log_out;
+  delete log_segments;
+  delete log_filter;
   delete[] workers;
 }
 
+/**
+ * @brief Parses one ledger line.
+ *
+ * The four required columns may be followed by optional `key=value`
+ * columns:
+ *   - `ts=T`: the entry's timestamp, used to merge several ledger files and
+ *     to drive scheduled entries. A line without it keeps the `ts` already
+ *     in `entry`, so callers reusing one entry inherit the previous line's.
+ *   - `at=T`, `every=P`, `count=N`: when a scheduled entry first runs, its
+ *     period and how many times it runs; reset for every line.
+ *   - `exp=T`: when an authorization hold expires; reset for every line.
+ *   - `txn=ID`: a non-zero external transaction ID for --dedup; reset for
+ *     every line.
+ *   - `cur=CODE`, `to=CODE`: the currency of the amount, and the currency a
+ *     transfer credits (by default the same), as listed in the --fx rate
+ *     table; FX_NONE for a code it does not list. Reset for every line to
+ *     the base currency.
+ *   - `tenant=T`, `peer=P`: the tenant whose bank runs the entry, and the
+ *     tenant of a transfer's destination (by default the same); reset for
+ *     every line to tenant 0.
+ * Unknown columns are ignored.
+ *
+ * @param line The text of the line.
+ * @param entry Receives the account, other account, amount, mode and any
+ * optional fields.
+ * @return true if the line holds a valid entry, false otherwise.
+ */
+bool parse_ledger_line(const string &line, Ledger &entry) {
+  istringstream iss(line);
+  if (!(iss >> entry.acc >> entry.other >> entry.amount >> entry.mode)) {
+    return false;
+  }
+  entry.at = -1;
+  entry.every = 0;
+  entry.count = 0;
+  entry.exp = -1;
+  entry.txn = 0;
+  entry.cur = 0;
+  entry.to = 0;
+  entry.tenant = 0;
+  bool to_set = false, peer_set = false;
+  string column;
+  while (iss >> column) {
+    if (column.compare(0, 3, "ts=") == 0) {
+      entry.ts = atol(column.c_str() + 3);
+    } else if (column.compare(0, 3, "at=") == 0) {
+      entry.at = atol(column.c_str() + 3);
+    } else if (column.compare(0, 6, "every=") == 0) {
+      entry.every = atol(column.c_str() + 6);
+    } else if (column.compare(0, 6, "count=") == 0) {
+      entry.count = atoi(column.c_str() + 6);
+    } else if (column.compare(0, 4, "exp=") == 0) {
+      entry.exp = atol(column.c_str() + 4);
+    } else if (column.compare(0, 4, "txn=") == 0) {
+      entry.txn = strtoul(column.c_str() + 4, NULL, 10);
+    } else if (column.compare(0, 4, "cur=") == 0) {
+      entry.cur = bank->fx ? bank->fx->find(column.substr(4)) : FX_NONE;
+    } else if (column.compare(0, 3, "to=") == 0) {
+      entry.to = bank->fx ? bank->fx->find(column.substr(3)) : FX_NONE;
+      to_set = true;
+    } else if (column.compare(0, 7, "tenant=") == 0) {
+      entry.tenant = atoi(column.c_str() + 7);
+    } else if (column.compare(0, 5, "peer=") == 0) {
+      entry.peer = atoi(column.c_str() + 5);
+      peer_set = true;
+    }
+  }
+  if (!to_set) { entry.to = entry.cur; }
+  if (!peer_set) { entry.peer = entry.tenant; }
+  return true;
+}
+
+/**
+ * @brief screens a batch of loaded entries against the --rules file and
+ *        converts the amounts its transfers credit with the FX rate table.
+ */
+static void prepare_batch(vector<Ledger> &batch) {
+  if (rules) { rules->screen(batch.data(), batch.size()); }
+  if (bank->fx) { bank->fx->convert(batch.data(), batch.size()); }
+}
+
 /**
  * @brief Loads a ledger from a specified file into the banking system.
  *
@@ -67,7 +682,14 @@ void InitBank(int num_workers, char *filename) {
  *   - Account (int): the account number
  *   - Other (int): for transfers, the other account number; otherwise not used
  *   - Amount (int): the amount to deposit, withdraw, or transfer
- *   - Mode (Enum): 0 for deposit, 1 for withdraw, 2 for transfer
+ *   - Mode (Enum): 0 for deposit, 1 for withdraw, 2 for transfer, 3 for
+ *     open (Amount is the initial balance), 4 for close, 5 for a balance
+ *     query (Other is the ledgerID to read the balance as of), 6 to
+ *     authorize a hold of Amount, 7 to capture Amount of the hold authorized
+ *     by ledgerID Other, 8 to release that hold, 9 to limit outflows to
+ *     Amount per Other ticks (0 removes the limit); SCHED_AT or SCHED_EVERY
+ *     plus one of those schedules it
+ *   - optional `key=value` columns, see parse_ledger_line()
  * The function then creates ledger entries and appends them to the ledger list
  * of the banking system.
  *
@@ -75,34 +697,302 @@ void InitBank(int num_workers, char *filename) {
  * - If the file cannot be opened, the function returns -1, indicating failure.
  * - The function expects a specific file format as indicated above.
  * - Each line in the file corresponds to a ledger entry.
- * - The ledgerID starts with 0.
+ * - The ledgerID starts with 0; `next_ledgerID` is left one past the last
+ * entry loaded.
+ * - Entries are screened against the --rules file, and FX transfers
+ * converted, LEDGER_BATCH at a time before they are appended.
+ * - A cancelled run stops loading at the next batch boundary.
+ * - Only entries with ledgerIDs in [`opts.range_first`, `opts.range_last`]
+ * are loaded. A range that does not start at 0 seeks straight to its block
+ * using the sidecar index (see index.h), building the index on first use.
  *
  * @param filename The name of the file containing the ledger data.
- * @return 0 on success, -1 on failure to open the file.
+ * @return 0 on success, -1 on failure to open the file or its index.
  */
 int load_ledger(char *filename) {
   // load file and initialize variables
   int ledgerID = 0;
+  int first = opts.range_first > 0 ? opts.range_first : 0;
   ifstream file(filename);
   string current_line;
   // cant open file
   if (!file.is_open()) { return -1; }
+  // seek to the indexed block that holds the first entry of the range
+  if (first > 0) {
+    vector<int64_t> offsets;
+    if (load_ledger_index(filename, offsets) != 0) { return -1; }
+    size_t block = first / LEDGER_INDEX_BLOCK;
+    if (block >= offsets.size()) {
+      next_ledgerID = first;
+      return 0;
+    }
+    file.seekg(offsets[block]);
+    ledgerID = block * LEDGER_INDEX_BLOCK;
+  }
+  // one entry object, so lines without a timestamp inherit the last one
+  Ledger current_entry;
+  vector<Ledger> batch;
+  batch.reserve(LEDGER_BATCH);
   // while there are valid lines
   while (getline(file, current_line)) {
-    // new entry object
-    Ledger current_entry;
-    istringstream iss(current_line);
-    // if all entries are valid, append
-    if (iss >> current_entry.acc >> current_entry.other >> current_entry.amount >> current_entry.mode) {
-        current_entry.ledgerID = ledgerID++; 
-        ledger.push_back(current_entry); 
+    // if all entries are valid, append those within the range
+    if (parse_ledger_line(current_line, current_entry)) {
+      if (ledgerID > opts.range_last) { break; }
+      current_entry.ledgerID = ledgerID++; 
+      if (current_entry.ledgerID >= first) { batch.push_back(current_entry); }
+      if (batch.size() == LEDGER_BATCH) {
+        if (load_cancelled) { break; }
+        prepare_batch(batch);
+        ledger.insert(ledger.end(), batch.begin(), batch.end());
+        batch.clear();
+      }
     } 
   }
+  prepare_batch(batch);
+  ledger.insert(ledger.end(), batch.begin(), batch.end());
   // close and return if successful
+  next_ledgerID = ledgerID;
   file.close();
   return 0;
 }
 
+/**
+ * @brief Loader thread that merges several ledger files into the ledger.
+ *
+ * @details
+ * Entries are taken from the LedgerMerge in timestamp order and numbered
+ * with global ledgerIDs in that order, starting at 0; only those within
+ * [`opts.range_first`, `opts.range_last`] are queued. Entries are moved into
+ * the ledger LEDGER_BATCH at a time, screened and converted on the way (see
+ * prepare_batch()), and the loader waits while
+ * LEDGER_QUEUE_MAX are queued, so memory stays bounded however long the
+ * files are. When the files are exhausted, or the run is cancelled, it sets
+ * `next_ledgerID` and marks the ledger done.
+ *
+ * @param merge The LedgerMerge with every file open.
+ * @return NULL once every entry has been queued.
+ */
+void *merge_loader(void *merge) {
+  LedgerMerge *files = (LedgerMerge *)merge;
+  vector<Ledger> batch;
+  batch.reserve(LEDGER_BATCH);
+  int ledgerID = 0;
+  bool more = true;
+  while (more) {
+    batch.clear();
+    Ledger entry;
+    while (batch.size() < LEDGER_BATCH) {
+      if (!files->next(entry) || ledgerID > opts.range_last) {
+        more = false;
+        break;
+      }
+      entry.ledgerID = ledgerID++;
+      if (entry.ledgerID >= opts.range_first) { batch.push_back(entry); }
+    }
+    prepare_batch(batch);
+    pthread_mutex_lock(&ledger_lock);
+    while (ledger.size() >= LEDGER_QUEUE_MAX && !cancelled) {
+      pthread_cond_wait(&space_cond, &ledger_lock);
+    }
+    if (cancelled) {
+      more = false;
+    } else {
+      ledger.insert(ledger.end(), batch.begin(), batch.end());
+    }
+    if (!more) {
+      next_ledgerID = ledgerID;
+      ledger_done = true;
+    }
+    pthread_cond_broadcast(&ledger_cond);
+    pthread_mutex_unlock(&ledger_lock);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Loader thread of a shard: streams the entries its coordinator
+ *        routes to it into the ledger.
+ *
+ * @details
+ * Entries arrive already numbered, screened and converted. Unlike
+ * merge_loader() this loader never waits for the queue to drain: it must
+ * keep reading so the coordinator, which sends two-phase commit decisions
+ * while it is still routing, never blocks on a full socket. When the
+ * coordinator ends the ledger it sets `next_ledgerID` and marks the ledger
+ * done.
+ *
+ * @param unused Not used.
+ * @return NULL once the coordinator has ended the ledger.
+ */
+void *shard_loader(void *unused) {
+  (void)unused;
+  vector<Ledger> batch;
+  batch.reserve(SHARD_BATCH);
+  bool more = true;
+  while (more) {
+    batch.clear();
+    int next = 0;
+    more = shard_receive(batch, &next);
+    pthread_mutex_lock(&ledger_lock);
+    ledger.insert(ledger.end(), batch.begin(), batch.end());
+    if (!more) {
+      next_ledgerID = next;
+      ledger_done = true;
+    }
+    pthread_cond_broadcast(&ledger_cond);
+    pthread_mutex_unlock(&ledger_lock);
+  }
+  return NULL;
+}
+
+/**
+ * @brief queues the executions of due schedules at the front of the ledger.
+ *
+ * Recurring entries go back into the wheel for their next period; one that
+ * is still due because the clock jumped several periods goes back into the
+ * due list in time order, so no execution is skipped. Executions keep the
+ * ledgerID of the entry that scheduled them.
+ *
+ * @attention
+ * - The caller holds ledger_lock.
+ *
+ * @param due Expired timers from the wheel, linked through `next`.
+ */
+static void run_due(Timer *due) {
+  list<Ledger> fired;
+  while (due != NULL) {
+    ScheduledEntry *s = (ScheduledEntry *)due;
+    due = due->next;
+    fired.push_back(s->entry);
+    fired.back().ts = s->expires;
+    fired.back().txn = 0;
+    num_fired++;
+    if (s->every > 0 && (s->remaining == 0 || --s->remaining > 0)) {
+      s->expires += s->every;
+      if (!schedules->insert(s)) {
+        Timer **at = &due;
+        while (*at != NULL && (*at)->expires <= s->expires) {
+          at = &(*at)->next;
+        }
+        s->next = *at;
+        *at = s;
+      }
+    } else {
+      delete s;
+    }
+  }
+  ledger.splice(ledger.begin(), fired);
+}
+
+/**
+ * @brief Puts a scheduled entry into the timing wheel.
+ *
+ * A one-shot entry runs at `at`, or at its own timestamp without one; a
+ * recurring entry first runs at `at`, or one period after its timestamp.
+ * An entry that is already due runs straight away. A recurring entry
+ * without a positive period is dropped.
+ *
+ * @attention
+ * - The caller holds ledger_lock.
+ *
+ * @param entry A ledger entry with a SCHED_AT or SCHED_EVERY mode.
+ */
+static void schedule(const Ledger &entry) {
+  bool recurring = entry.mode >= SCHED_EVERY;
+  if (recurring && entry.every <= 0) {
+    debug("recurring entry " << entry.ledgerID << " without a period");
+    return;
+  }
+  ScheduledEntry *s = new ScheduledEntry;
+  s->entry = entry;
+  s->entry.mode = entry.mode % 10;
+  s->every = recurring ? entry.every : 0;
+  s->remaining = recurring ? entry.count : 0;
+  s->expires = entry.at >= 0 ? entry.at : entry.ts + s->every;
+  num_scheduled++;
+  if (!schedules->insert(s)) {
+    s->next = NULL;
+    run_due(s);
+  }
+}
+
+/**
+ * @brief returns a scheduled entry as a --progress marker keeps it.
+ */
+static ScheduleRecord schedule_record(const Ledger &e, long expires,
+                                      long every, int remaining) {
+  return {e.acc,  e.other,  e.amount,  e.mode,    e.ledgerID, e.cur,
+          e.to,   remaining, e.exp,    e.credit,  expires,    every};
+}
+
+/**
+ * @brief Keeps the pending schedules for the --progress marker.
+ *
+ * @details
+ * Besides the schedules still in the wheel, a cancelled run may leave
+ * executions that came due but were not taken; they are queued ahead of
+ * the ledger with the ID of the entry that scheduled them, so they are the
+ * entries up to the last one taken, and are kept as one-shot schedules due
+ * at once.
+ *
+ * @attention
+ * - The caller holds ledger_lock and the workers have joined.
+ *
+ * @param unrun The entries left in the ledger.
+ */
+static void save_schedules(const list<Ledger> &unrun) {
+  vector<Timer *> pending;
+  schedules->list(pending);
+  for (Timer *t : pending) {
+    ScheduledEntry *s = (ScheduledEntry *)t;
+    progress_schedules.push_back(
+        schedule_record(s->entry, s->expires, s->every, s->remaining));
+  }
+  for (const Ledger &e : unrun) {
+    if (e.ledgerID > taken_upto) { break; }
+    progress_schedules.push_back(schedule_record(e, e.ts, 0, 0));
+  }
+}
+
+/**
+ * @brief Puts the schedules a checkpoint restored back into the wheel;
+ *        those already due are queued ahead of the ledger.
+ */
+static void restore_schedules() {
+  pthread_mutex_lock(&ledger_lock);
+  for (const ScheduleRecord &r : restored_schedules) {
+    ScheduledEntry *s = new ScheduledEntry;
+    s->entry.acc = r.acc;
+    s->entry.other = r.other;
+    s->entry.amount = r.amount;
+    s->entry.mode = r.mode;
+    s->entry.ledgerID = r.ledgerID;
+    s->entry.cur = r.cur;
+    s->entry.to = r.to;
+    s->entry.exp = r.exp;
+    s->entry.credit = r.credit;
+    s->every = r.every;
+    s->remaining = r.remaining;
+    s->expires = r.expires;
+    num_scheduled++;
+    if (!schedules->insert(s)) {
+      s->next = NULL;
+      run_due(s);
+    }
+  }
+  pthread_mutex_unlock(&ledger_lock);
+  restored_schedules.clear();
+}
+
+/**
+ * @brief Finishes a worker's entry: ships its changes to the standby, if
+ *        any, waiting for it in sync mode, and tells the pool.
+ */
+static void entry_done(int ledgerID) {
+  if (replica) { replica->commit(ledgerID); }
+  pool->entry_done();
+}
+
 /**
  * @brief Worker function for processing ledger entries concurrently.
  *
@@ -121,6 +1011,42 @@ int load_ledger(char *filename) {
  * bank's state accordingly.
  * - The worker handles deposit (D), withdraw (W), and transfer (T) operations
  * based on the ledger entry's mode.
+ * - While a loader is still streaming entries, an empty ledger means the
+ * worker waits for more instead of exiting.
+ * - The ledger clock is the largest `ts` dequeued so far. Before taking an
+ * entry that moves it forward, the worker advances the timing wheel and
+ * queues the schedules that came due ahead of that entry. Scheduled entries
+ * themselves are put into the wheel rather than run; schedules due after
+ * the last entry's timestamp never run.
+ * - After moving the clock forward, and before running its entry, the worker
+ * passes the clock to the bank, which releases the authorization holds that
+ * expired and measures velocity windows against it.
+ * - With --dedup, an entry whose `txn=` ID was already seen is logged as a
+ * duplicate and skipped, outside ledger_lock so workers check IDs in
+ * parallel. Executions of a scheduled entry carry no ID.
+ * - An entry the loader's --rules screening denied is logged as a failure
+ * naming the rule's line and never reaches the bank; a denied scheduled
+ * entry is never scheduled.
+ * - An entry with a `cur=` other than the base runs as a deposit, withdrawal
+ * or transfer in that currency, and a transfer whose `to=` differs converts;
+ * `cur=` and `to=` are ignored on other modes.
+ * - The entry runs on the bank of its `tenant=`; an unknown tenant is a
+ * failure logged on tenant 0. A transfer whose `peer=` names another
+ * tenant runs as Bank::transfer_to().
+ * - With --top, the worker counts an access to `acc`, and to `other` for a
+ * transfer, in its own sketch before running the entry; a shard counts the
+ * side of a transfer between shards that it owns when preparing it.
+ * - With --replica, the changes the entry made are published to the
+ * standby after it runs; in sync mode the worker waits until the standby
+ * has applied them before taking the next entry.
+ * - Once the run is cancelled (see canceller()) the worker exits instead of
+ * taking another entry. Entries are taken in ledgerID order, apart from
+ * executions of schedules, which keep an older one, so every entry up to
+ * the largest ledgerID taken has run once all workers have joined.
+ * - In a shard, the prepares of a transfer between shards are voted on
+ * through shard_vote() (a duplicate source side votes no), and commits and
+ * aborts finish them (see coordinate()). A CROSS_SHARD entry, a transfer
+ * the coordinator did not split, fails with SHARD_REASON.
  *
  * @param workerID A pointer to the unique identifier of the worker thread.
  * @return NULL after completing ledger processing.
@@ -132,30 +1058,317 @@ void *worker(void *workerID) {
   while (true) {
     // entry object
     Ledger current_entry; 
+    long clock = -1;
+    // parked while above the active level
+    pool->wait_turn(id);
     // check if empty
-    pthread_mutex_lock(&ledger_lock);
-    if (ledger.empty()) { 
+    timed_lock(&ledger_lock);
+    if (ledger.empty() && !ledger_done && !cancelled) {
+      pool->leave();
+      pthread_cond_wait(&ledger_cond, &ledger_lock);
+      pthread_mutex_unlock(&ledger_lock);
+      continue;
+    }
+    if (ledger.empty() || cancelled) { 
       pthread_mutex_unlock(&ledger_lock);
+      pool->leave();
+      pool->finish();
+      for (Bank *b : banks) {
+        if (b->history) { b->history->flush(); }
+      }
       return NULL; 
     }
+    // advance the ledger clock, queuing due schedules ahead of this entry
+    if (ledger.front().ts > schedules->time()) {
+      clock = ledger.front().ts;
+      run_due(schedules->advance(clock));
+    }
     // crit section + entry object + update ledger
     current_entry = ledger.front(); 
     ledger.pop_front(); 
+    if (current_entry.ledgerID > taken_upto) {
+      taken_upto = current_entry.ledgerID;
+      if (replica) { replica->take(taken_upto); }
+    }
+    // let a waiting loader refill once half the queue is drained
+    if (ledger.size() == LEDGER_QUEUE_MAX / 2) {
+      pthread_cond_signal(&space_cond);
+    }
     // unlock
     pthread_mutex_unlock(&ledger_lock); 
+    if (clock >= 0) {
+      for (Bank *b : banks) { b->advance_clock(id, clock); }
+    }
+    // route the entry to its tenant
+    if (current_entry.tenant < 0 || current_entry.tenant >= (int)banks.size()) {
+      bank->recordFail(TENANT_LOG(id, current_entry.ledgerID, current_entry.tenant));
+      entry_done(current_entry.ledgerID);
+      continue;
+    }
+    Bank *b = banks[current_entry.tenant];
+    // resent entries are rejected before they run
+    if (dedup && current_entry.txn != 0 && dedup->seen(current_entry.txn)) {
+      b->recordDuplicate(DUPLICATE_LOG(id, current_entry.ledgerID, current_entry.txn));
+      if (current_entry.mode == PREPARE_SRC) { shard_vote(current_entry, false); }
+      entry_done(current_entry.ledgerID);
+      continue;
+    }
+    // entries denied by a screening rule never reach the bank
+    if (current_entry.rule != 0) {
+      b->recordFail(DENIED_LOG(id, current_entry.ledgerID, current_entry.acc, current_entry.rule));
+      entry_done(current_entry.ledgerID);
+      continue;
+    }
+    // scheduled entries wait in the wheel
+    if (current_entry.mode >= SCHED_AT && current_entry.mode < SCHED_EVERY + 10) {
+      timed_lock(&ledger_lock);
+      schedule(current_entry);
+      pthread_mutex_unlock(&ledger_lock);
+      entry_done(current_entry.ledgerID);
+      continue;
+    }
+    if (sketch && current_entry.mode == PREPARE_DST) {
+      sketch->touch(current_entry.other);
+    } else if (sketch && current_entry.mode <= PREPARE_SRC) {
+      sketch->touch(current_entry.acc);
+      if (current_entry.mode == T) { sketch->touch(current_entry.other); }
+    }
+    // two-phase commit cases, each on the side this shard owns
+    if (current_entry.mode == PREPARE_SRC || current_entry.mode == PREPARE_DST) {
+      int vote = b->prepare_transfer(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount, current_entry.mode == PREPARE_SRC);
+      shard_vote(current_entry, vote == 0);
+    }
+    else if (current_entry.mode == COMMIT_SRC || current_entry.mode == COMMIT_DST) {
+      b->commit_transfer(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount, current_entry.mode == COMMIT_SRC);
+    }
+    else if (current_entry.mode == ABORT_SRC || current_entry.mode == ABORT_DST) {
+      b->abort_transfer(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount, current_entry.mode == ABORT_SRC);
+    }
+    else if (current_entry.mode == CROSS_SHARD) {
+      bool fx = current_entry.cur != 0 || current_entry.to != 0;
+      LogRecord r = fx ? FX_TRANSFER_LOG(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount, current_entry.cur, current_entry.credit, current_entry.to)
+                       : TRANSFER_LOG(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount);
+      r.flags |= LOG_CROSS_SHARD;
+      b->recordFail(r);
+    }
+    // other currency cases
+    else if (current_entry.mode == D && current_entry.cur != 0) {
+      b->deposit_fx(id, current_entry.ledgerID, current_entry.acc, current_entry.amount, current_entry.cur);
+    }
+    else if (current_entry.mode == W && current_entry.cur != 0) {
+      b->withdraw_fx(id, current_entry.ledgerID, current_entry.acc, current_entry.amount, current_entry.cur);
+    }
+    // cross-tenant transfer case, in the base currency only
+    else if (current_entry.mode == T && current_entry.peer != current_entry.tenant) {
+      bool known = current_entry.peer >= 0 && current_entry.peer < (int)banks.size();
+      Bank *dest = known && current_entry.cur == 0 && current_entry.to == 0 ? banks[current_entry.peer] : NULL;
+      b->transfer_to(dest, id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount);
+    }
+    else if (current_entry.mode == T && (current_entry.cur != 0 || current_entry.to != 0)) {
+      b->transfer_fx(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount, current_entry.cur, current_entry.to, current_entry.credit);
+    }
     // deposit case
-    if (current_entry.mode == D) {
-      bank->deposit(id, current_entry.ledgerID, current_entry.acc, current_entry.amount); 
+    else if (current_entry.mode == D) {
+      b->deposit(id, current_entry.ledgerID, current_entry.acc, current_entry.amount); 
     }
     // withdraw case
     else if (current_entry.mode == W) {
-      bank->withdraw(id, current_entry.ledgerID, current_entry.acc, current_entry.amount);
+      b->withdraw(id, current_entry.ledgerID, current_entry.acc, current_entry.amount);
     }
     // transfer case
+    else if (current_entry.mode == T) {
+      b->transfer(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount);
+    }
+    // open case
+    else if (current_entry.mode == O) {
+      b->open(id, current_entry.ledgerID, current_entry.acc, current_entry.amount);
+    }
+    // close case
+    else if (current_entry.mode == C) {
+      b->close(id, current_entry.ledgerID, current_entry.acc);
+    }
+    // query case
+    else if (current_entry.mode == Q) {
+      b->query(id, current_entry.ledgerID, current_entry.acc, current_entry.other);
+    }
+    // authorization hold cases
+    else if (current_entry.mode == AUTHORIZE) {
+      b->authorize(id, current_entry.ledgerID, current_entry.acc, current_entry.amount, current_entry.exp);
+    }
+    else if (current_entry.mode == CAPTURE) {
+      b->capture(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount);
+    }
+    else if (current_entry.mode == RELEASE) {
+      b->release(id, current_entry.ledgerID, current_entry.acc, current_entry.other);
+    }
+    // velocity limit case
+    else if (current_entry.mode == LIMIT) {
+      b->set_limit(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount);
+    }
     else {
-      bank->transfer(id, current_entry.ledgerID, current_entry.acc, current_entry.other, current_entry.amount);
+      debug("unknown mode " << current_entry.mode);
     }
+    entry_done(current_entry.ledgerID);
   }
   // return after success 
   return NULL; 
 }
+
+/**
+ * @brief Prints the history of one account from the history index.
+ *
+ * Prints `History Acc: {acc} Entries: {n} ({us} us)` followed by one
+ * `LID# {ledgerID} | {signed amount}` line per change. The time covers the
+ * index lookup and decoding.
+ *
+ * @param acc The account to print.
+ */
+void print_history(int acc) {
+  vector<pair<int, long>> entries;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long n = bank->history->query(acc, entries);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long us = (end.tv_sec - start.tv_sec) * 1000000L +
+            (end.tv_nsec - start.tv_nsec) / 1000;
+  cout << "History Acc: " << acc << " Entries: " << n << " (" << us << " us)"
+       << endl;
+  for (const pair<int, long> &e : entries) {
+    cout << "LID# " << e.first << " | " << e.second << "\n";
+  }
+  cout.flush();
+}
+
+/**
+ * @brief Live history queries: every `opts.history_ms` milliseconds while
+ *        the workers run, queries each --history account and logs
+ *        `[ HISTORY ] Acc: {acc} Entries: {n} Last LID: {id} Net: {sum} ({us} us)`
+ *        to stderr.
+ *
+ * The queries do not pause the workers; they see the segments merged so
+ * far, in ledgerID order.
+ *
+ * @param unused Not used.
+ * @return NULL once the workers have joined.
+ */
+void *history_reporter(void *unused) {
+  (void)unused;
+  struct timespec nap = {opts.history_ms / 1000,
+                         (opts.history_ms % 1000) * 1000000L};
+  vector<pair<int, long>> entries;
+  while (true) {
+    nanosleep(&nap, NULL);
+    if (history_stop) { return NULL; }
+    for (int acc : opts.history) {
+      entries.clear();
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      long n = bank->history->query(acc, entries);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      long us = (end.tv_sec - start.tv_sec) * 1000000L +
+                (end.tv_nsec - start.tv_nsec) / 1000;
+      long net = 0;
+      for (const pair<int, long> &e : entries) { net += e.second; }
+      string line = "[ HISTORY ] Acc: " + to_string(acc) +
+                    " Entries: " + to_string(n) + " Last LID: " +
+                    to_string(n > 0 ? entries.back().first : -1) +
+                    " Net: " + to_string(net) + " (" + to_string(us) +
+                    " us)\n";
+      cerr << line;
+    }
+  }
+}
+
+/**
+ * @brief Runs the end-of-day jobs requested on the command line.
+ *
+ * Interest runs before the fee; each job gets a ledgerID after the ledger
+ * and is swept by `num_threads` threads, in every tenant's bank. The job
+ * IDs only tag versions, history and log records: `next_ledgerID` stays one
+ * past the last ledger entry, so reports, checkpoints and progress markers
+ * name that entry and a resumed run replays from the one after it.
+ *
+ * @param num_threads The number of sweep threads per job.
+ */
+void run_bulk_jobs(int num_threads) {
+  int ledgerID = next_ledgerID;
+  if (opts.interest > 0) {
+    BulkJob job = {BULK_INTEREST, opts.interest, opts.bulk_min,
+                   opts.bulk_first, opts.bulk_last, ledgerID++};
+    for (Bank *b : banks) { b->bulk(0, job, num_threads); }
+  }
+  if (opts.fee > 0) {
+    BulkJob job = {BULK_FEE, opts.fee, opts.bulk_min,
+                   opts.bulk_first, opts.bulk_last, ledgerID++};
+    for (Bank *b : banks) { b->bulk(0, job, num_threads); }
+  }
+}
+
+/**
+ * @brief Checker thread for periodic conservation checks.
+ *
+ * Every `opts.check_ms` milliseconds it pauses the worker pool, which parks
+ * every worker between entries, checks the invariant at that quiescent
+ * point and resumes the pool.
+ *
+ * @param unused Not used.
+ * @return NULL once the workers have joined.
+ */
+void *checker(void *unused) {
+  (void)unused;
+  struct timespec nap = {opts.check_ms / 1000,
+                         (opts.check_ms % 1000) * 1000000L};
+  while (true) {
+    nanosleep(&nap, NULL);
+    if (checker_stop) { return NULL; }
+    pool->pause();
+    if (!check_tenants("periodic")) { exit_status = 1; }
+    pool->resume();
+  }
+}
+
+/**
+ * @brief Report stage: writes the final balances in `opts.report` format to
+ *        stdout or `opts.report_file`.
+ *
+ * Formatting runs on one thread per online CPU. When the report is not text
+ * on stdout, the success and fail counts are still printed to stdout. With
+ * --dedup a `Duplicates: {n}` line follows.
+ *
+ * With several tenants each one gets its own report and counts, in tenant
+ * order; those after the first are preceded by a `Tenant: {t}` line on
+ * stdout (unless a binary report goes there) and go to
+ * `opts.report_file` + `.{t}` when a report file is given.
+ */
+void write_final_report() {
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  for (Bank *b : banks) {
+    int fd = STDOUT_FILENO;
+    string path = opts.report_file;
+    if (!path.empty() && b->tenant > 0) { path += "." + to_string(b->tenant); }
+    if (!path.empty()) {
+      fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+        cerr << "cannot open report file " << path << endl;
+        exit_status = 1;
+        return;
+      }
+    }
+    if (b->tenant > 0 && (fd != STDOUT_FILENO || opts.report != REPORT_BIN)) {
+      cout << "Tenant: " << b->tenant << "\n";
+    }
+    if (b->write_report(fd, opts.report, threads, next_ledgerID - 1) != 0) {
+      cerr << "report write failed" << endl;
+      exit_status = 1;
+    }
+    if (fd != STDOUT_FILENO) {
+      close(fd);
+    }
+    if (fd != STDOUT_FILENO || opts.report != REPORT_TEXT) {
+      b->print_counts();
+    }
+    if (opts.dedup > 0) {
+      cout << "Duplicates: " << b->duplicates() << endl;
+    }
+  }
+}
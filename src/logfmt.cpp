@@ -0,0 +1,181 @@
+#include "../include/bank.h"
+#include "../include/logfmt.h"
+
+#include <string.h> /* for memcpy() and strncpy() */
+
+using namespace std;
+
+/**
+ * @brief Fills a binary log header with the currency codes of a rate
+ *        table, or none without one.
+ *
+ * @param header The header to fill.
+ * @param fx The bank's rate table, or NULL.
+ */
+void log_header(LogHeader *header, FxTable *fx) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, LOG_MAGIC, sizeof(header->magic));
+  header->record_size = sizeof(LogEntry);
+  header->currencies = fx ? fx->num : 0;
+  for (int c = 0; c < header->currencies; c++) {
+    strncpy(header->codes[c], fx->code(c).c_str(), FX_CODE_MAX);
+  }
+}
+
+/**
+ * @brief Packs a record into the units a binary log stores.
+ *
+ * @param r The record.
+ * @param out Receives the LogEntry and, if needed, its LogExtension.
+ * @return 1, or 2 with an extension.
+ */
+size_t pack_log(const LogRecord &r, LogEntry out[2]) {
+  bool ext = r.amount != (int32_t)r.amount || r.extra != 0 || r.cur != 0 ||
+             r.to != 0;
+  LogEntry &e = out[0];
+  e.op = r.op;
+  e.bits = r.status | (r.flags & LOG_LIMITED ? LOG_BIT_LIMITED : 0) |
+           (r.flags & LOG_CROSS_SHARD ? LOG_BIT_CROSS_SHARD : 0) |
+           (ext ? LOG_BIT_EXT : 0);
+  e.tenant = r.tenant;
+  e.tid = r.tid;
+  e.lid = r.lid;
+  e.acc = r.acc;
+  e.other = r.other;
+  e.amount = (int32_t)r.amount;
+  if (!ext) { return 1; }
+  LogExtension x;
+  memset(&x, 0, sizeof(x));
+  x.mark = LOG_EXT_MARK;
+  x.cur = r.cur;
+  x.to = r.to;
+  x.amount = r.amount;
+  x.extra = r.extra;
+  memcpy(&out[1], &x, sizeof(x));
+  return 2;
+}
+
+/**
+ * @brief Unpacks the record that starts at a unit of a binary log.
+ *
+ * @param in The units, starting at a LogEntry.
+ * @param units How many units are readable from `in`.
+ * @param r Receives the record.
+ * @return The units the record takes, or 0 if `in` does not start a
+ * record or its extension is missing.
+ */
+size_t unpack_log(const LogEntry *in, size_t units, LogRecord *r) {
+  if (units == 0 || in[0].op == LOG_EXT_MARK) { return 0; }
+  const LogEntry &e = in[0];
+  *r = log_record(e.op, e.tid, e.lid, e.acc, e.other, e.amount);
+  r->status = e.bits & LOG_STATUS_MASK;
+  r->flags = (e.bits & LOG_BIT_LIMITED ? LOG_LIMITED : 0) |
+             (e.bits & LOG_BIT_CROSS_SHARD ? LOG_CROSS_SHARD : 0);
+  r->tenant = e.tenant;
+  if (!(e.bits & LOG_BIT_EXT)) { return 1; }
+  if (units < 2 || in[1].op != LOG_EXT_MARK) { return 0; }
+  LogExtension x;
+  memcpy(&x, &in[1], sizeof(x));
+  r->cur = x.cur;
+  r->to = x.to;
+  r->amount = x.amount;
+  r->extra = x.extra;
+  return 2;
+}
+
+/**
+ * @brief returns the code of a currency as Bank::currency() does.
+ */
+static string code(const LogHeader &header, int cur) {
+  return cur >= 0 && cur < header.currencies ? string(header.codes[cur]) : "?";
+}
+
+/**
+ * @brief Formats a record as the text of its log line, without the newline.
+ *
+ * @details
+ * The text is what the *_MSG macros produce for the same values, with the
+ * `TEN: {tenant}, ` tag after the level for tenants other than 0 and
+ * LIMIT_REASON after a failure on the velocity limit (SHARD_REASON after a
+ * transfer between shards that was not split), so a rendered binary log
+ * matches the text log line for line.
+ *
+ * @param r The record.
+ * @param header The header of its log, for currency codes.
+ * @return The line.
+ */
+string render_log(const LogRecord &r, const LogHeader &header) {
+  string level = r.status == LOG_SUCC ? SUCC : r.status == LOG_FAIL ? ERR : DUP;
+  if (r.tenant != 0) { level += "TEN: " + to_string(r.tenant) + ", "; }
+  string line;
+  switch (r.op) {
+    case LOG_DEPOSIT:
+      line = DEPOSITE_MSG(level, r.tid, r.lid, r.acc, r.amount);
+      break;
+    case LOG_WITHDRAW:
+      line = WITHDRAW_MSG(level, r.tid, r.lid, r.acc, r.amount);
+      break;
+    case LOG_TRANSFER:
+      line = TRANSFER_MSG(level, r.tid, r.lid, r.acc, r.other, r.amount);
+      break;
+    case LOG_DEPOSIT_FX:
+      line = DEPOSITE_MSG(level, r.tid, r.lid, r.acc, r.amount) + " " +
+             code(header, r.cur);
+      break;
+    case LOG_WITHDRAW_FX:
+      line = WITHDRAW_MSG(level, r.tid, r.lid, r.acc, r.amount) + " " +
+             code(header, r.cur);
+      break;
+    case LOG_TRANSFER_FX:
+      line = FX_TRANSFER_MSG(level, r.tid, r.lid, r.acc, r.other, r.amount,
+                             code(header, r.cur), r.extra, code(header, r.to));
+      break;
+    case LOG_TENANT_TRANSFER:
+      line = TENANT_TRANSFER_MSG(level, r.tid, r.lid, r.acc, r.amount,
+                                 (int)r.extra, r.other);
+      break;
+    case LOG_TENANT:
+      line = TENANT_MSG(level, r.tid, r.lid, r.other);
+      break;
+    case LOG_OPEN:
+      line = OPEN_MSG(level, r.tid, r.lid, r.acc, r.amount);
+      break;
+    case LOG_CLOSE:
+      line = CLOSE_MSG(level, r.tid, r.lid, r.acc);
+      break;
+    case LOG_QUERY:
+      line = QUERY_MSG(level, r.tid, r.lid, r.acc, r.other, r.amount);
+      break;
+    case LOG_AUTHORIZE:
+      line = AUTHORIZE_MSG(level, r.tid, r.lid, r.acc, r.amount);
+      break;
+    case LOG_CAPTURE:
+      line = CAPTURE_MSG(level, r.tid, r.lid, r.acc, r.other, r.amount);
+      break;
+    case LOG_RELEASE:
+      line = RELEASE_MSG(level, r.tid, r.lid, r.acc, r.other, r.amount);
+      break;
+    case LOG_EXPIRE:
+      line = EXPIRE_MSG(level, r.tid, r.lid, r.acc, r.amount);
+      break;
+    case LOG_DUPLICATE:
+      line = DUPLICATE_MSG(level, r.tid, r.lid, (unsigned long)r.amount);
+      break;
+    case LOG_LIMIT:
+      line = LIMIT_MSG(level, r.tid, r.lid, r.acc, r.amount, r.other);
+      break;
+    case LOG_DENIED:
+      line = DENIED_MSG(level, r.tid, r.lid, r.acc, r.other);
+      break;
+    case LOG_BULK:
+      line = BULK_MSG(level, r.tid, r.lid,
+                      (r.cur == BULK_INTEREST ? "INTEREST" : "FEE"), r.amount,
+                      r.acc, r.other, r.extra);
+      break;
+    default:
+      line = level + "UNKNOWN RECORD " + to_string(r.op);
+  }
+  if (r.flags & LOG_LIMITED) { line += LIMIT_REASON; }
+  if (r.flags & LOG_CROSS_SHARD) { line += SHARD_REASON; }
+  return line;
+}
@@ -0,0 +1,372 @@
+#include "../include/logio.h"
+
+#include <errno.h>          /* for errno */
+#include <fcntl.h>          /* for open() */
+#include <linux/io_uring.h> /* for the io_uring ABI */
+#include <stdlib.h>         /* for aligned_alloc() */
+#include <string.h>         /* for memcpy() and strerror() */
+#include <sys/mman.h>       /* for mmap() */
+#include <sys/syscall.h>    /* for the io_uring system call numbers */
+#include <sys/uio.h>        /* for struct iovec */
+#include <time.h>           /* for clock_gettime() */
+#include <unistd.h>         /* for pwrite() and fdatasync() */
+#include <iostream>         /* for cerr */
+
+using namespace std;
+
+// user_data bit of the fsync linked to a buffer's write
+const uint64_t LOG_FSYNC_BIT = 1ULL << 32;
+
+static long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+ * @brief Construct a LogWriter; nothing is opened until open().
+ *
+ * @param backend LOG_IO_URING or LOG_IO_PWRITE.
+ * @param sync    Whether every buffer is flushed to disk before it is reused.
+ */
+LogWriter::LogWriter(int backend, bool sync)
+    : fd(-1), sync(sync), offset(0), current(0), failed(false),
+      started_ns(0), ring(-1), fixed(false), sq_map(MAP_FAILED),
+      cq_map(MAP_FAILED), sq_map_size(0), cq_map_size(0), sqes_size(0),
+      sqes((io_uring_sqe *)MAP_FAILED), closing(false), backend(backend),
+      lines(0), bytes(0), writes(0), stalls(0) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&queued_cond, NULL);
+  pthread_cond_init(&done_cond, NULL);
+}
+
+/**
+ * @brief Destroy the LogWriter, closing it first if open() succeeded.
+ */
+LogWriter::~LogWriter() {
+  if (fd >= 0) { close(); }
+  if (sqes != MAP_FAILED) { munmap(sqes, sqes_size); }
+  if (cq_map != MAP_FAILED && cq_map != sq_map) { munmap(cq_map, cq_map_size); }
+  if (sq_map != MAP_FAILED) { munmap(sq_map, sq_map_size); }
+  if (ring >= 0) { ::close(ring); }
+  for (LogBuffer &b : buffers) { free(b.data); }
+  pthread_cond_destroy(&done_cond);
+  pthread_cond_destroy(&queued_cond);
+  pthread_mutex_destroy(&lock);
+}
+
+/**
+ * @brief sets up an io_uring with room for every buffer's write and fsync,
+ *        maps its rings and registers the buffers.
+ *
+ * Registration failing (for instance on the locked memory limit) is not
+ * fatal: the buffers are then written with IORING_OP_WRITE.
+ *
+ * @return 0 on success, -1 (with errno set) if io_uring is not available.
+ */
+int LogWriter::setup_ring() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring = syscall(__NR_io_uring_setup, 2 * LOG_BUFFERS, &p);
+  if (ring < 0) { return -1; }
+  sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && cq_map_size > sq_map_size) { sq_map_size = cq_map_size; }
+  sq_map = mmap(NULL, sq_map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+  if (sq_map == MAP_FAILED) { return -1; }
+  cq_map = single ? sq_map
+                  : mmap(NULL, cq_map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+  if (cq_map == MAP_FAILED) { return -1; }
+  sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+  sqes = (io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring,
+                              IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) { return -1; }
+  char *sq = (char *)sq_map, *cq = (char *)cq_map;
+  sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq + p.sq_off.array);
+  cq_head = (unsigned *)(cq + p.cq_off.head);
+  cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+  struct iovec iov[LOG_BUFFERS];
+  for (int b = 0; b < LOG_BUFFERS; b++) {
+    iov[b] = {buffers[b].data, LOG_BUFFER_SIZE};
+  }
+  fixed = syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, iov,
+                  LOG_BUFFERS) == 0;
+  return 0;
+}
+
+/**
+ * @brief Opens (truncating) the log file and sets up the backend.
+ *
+ * If io_uring was asked for but cannot be set up, a note is logged to
+ * stderr and the pwrite backend is used instead.
+ *
+ * @param path The log file.
+ * @param header Bytes the file starts with, a binary log's LogHeader, not
+ * counted as a line; NULL for a text log.
+ * @param header_size Their size.
+ * @return 0 on success, -1 if the file cannot be opened.
+ */
+int LogWriter::open(const char *path, const void *header, size_t header_size) {
+  fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return -1; }
+  buffers.resize(LOG_BUFFERS);
+  for (LogBuffer &b : buffers) {
+    b.data = (char *)aligned_alloc(4096, LOG_BUFFER_SIZE);
+    b.used = 0;
+    b.offset = 0;
+    b.inflight = 0;
+  }
+  if (backend == LOG_IO_URING && setup_ring() != 0) {
+    cerr << "[ LOGIO ] io_uring unavailable (" << strerror(errno)
+         << "), using pwrite threads" << endl;
+    backend = LOG_IO_PWRITE;
+  }
+  if (backend == LOG_IO_PWRITE) {
+    for (int t = 0; t < LOG_PWRITE_THREADS; t++) {
+      pthread_create(&threads[t], NULL, write_loop, this);
+    }
+  }
+  if (header) { copy((const char *)header, header_size); }
+  binary = header != NULL;
+  started_ns = now_ns();
+  return 0;
+}
+
+/**
+ * @brief copies bytes into the buffers, submitting each one that fills.
+ */
+void LogWriter::copy(const char *p, size_t size) {
+  bytes += size;
+  while (size > 0) {
+    LogBuffer &b = buffers[current];
+    size_t n = min(size, LOG_BUFFER_SIZE - b.used);
+    memcpy(b.data + b.used, p, n);
+    b.used += n;
+    p += n;
+    size -= n;
+    if (b.used == LOG_BUFFER_SIZE) {
+      submit();
+      current = (current + 1) % LOG_BUFFERS;
+      wait_free(current);
+    }
+  }
+}
+
+/**
+ * @brief Appends one line, adding the newline.
+ *
+ * @param line The text of the line.
+ */
+void LogWriter::append(const string &line) {
+  copy(line.data(), line.size());
+  copy("\n", 1);
+  lines++;
+}
+
+/**
+ * @brief Appends one binary record (or header) as it is.
+ *
+ * @param data The record.
+ * @param size Its size in bytes.
+ */
+void LogWriter::append(const void *data, size_t size) {
+  copy((const char *)data, size);
+  lines++;
+}
+
+/**
+ * @brief Appends a bank's record, packed (see pack_log()) to a binary log
+ *        and as its line otherwise.
+ */
+void LogWriter::write(const LogRecord &r, const string &line) {
+  if (binary) {
+    LogEntry units[2];
+    append(units, pack_log(r, units) * sizeof(LogEntry));
+  } else {
+    append(line);
+  }
+}
+
+/**
+ * @brief submits the current buffer at the next file offset.
+ */
+void LogWriter::submit() {
+  LogBuffer &b = buffers[current];
+  b.offset = offset;
+  offset += b.used;
+  writes++;
+  if (backend == LOG_IO_PWRITE) {
+    pthread_mutex_lock(&lock);
+    b.inflight = 1;
+    queue.push_back(current);
+    pthread_cond_signal(&queued_cond);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  // the ring has room for every buffer's two operations, so no check
+  unsigned tail = *sq_tail;
+  io_uring_sqe *sqe = &sqes[tail & *sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)b.data;
+  sqe->len = b.used;
+  sqe->off = b.offset;
+  sqe->buf_index = current;
+  sqe->user_data = current;
+  sq_array[tail & *sq_mask] = tail & *sq_mask;
+  tail++;
+  b.inflight = 1;
+  if (sync) {
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = &sqes[tail & *sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = current | LOG_FSYNC_BIT;
+    sq_array[tail & *sq_mask] = tail & *sq_mask;
+    tail++;
+    b.inflight = 2;
+  }
+  unsigned count = sync ? 2 : 1;
+  __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+  while (syscall(__NR_io_uring_enter, ring, count, 0, 0, NULL, 0) < 0) {
+    if (errno != EINTR) {
+      cerr << "[ LOGIO ] io_uring submit: " << strerror(errno) << endl;
+      failed = true;
+      b.inflight = 0;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Reaps every completion in the ring, optionally waiting for at
+ *        least one first.
+ *
+ * A write that fails or comes up short marks the writer failed; its linked
+ * fsync then completes as cancelled.
+ */
+void LogWriter::reap(bool wait) {
+  unsigned head = *cq_head;
+  if (wait && head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    while (syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS,
+                   NULL, 0) < 0 && errno == EINTR) {
+    }
+  }
+  unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    io_uring_cqe *cqe = &cqes[head & *cq_mask];
+    LogBuffer &b = buffers[cqe->user_data & (LOG_FSYNC_BIT - 1)];
+    bool is_fsync = cqe->user_data & LOG_FSYNC_BIT;
+    if (cqe->res < 0 && !(is_fsync && cqe->res == -ECANCELED && failed)) {
+      cerr << "[ LOGIO ] " << (is_fsync ? "fsync" : "write") << ": "
+           << strerror(-cqe->res) << endl;
+      failed = true;
+    } else if (!is_fsync && (size_t)cqe->res != b.used) {
+      cerr << "[ LOGIO ] short write at offset " << b.offset << endl;
+      failed = true;
+    }
+    b.inflight--;
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief waits until buffer `b` is written, then empties it.
+ */
+void LogWriter::wait_free(int b) {
+  if (backend == LOG_IO_URING) {
+    if (buffers[b].inflight > 0) { stalls++; }
+    while (buffers[b].inflight > 0) { reap(true); }
+  } else {
+    pthread_mutex_lock(&lock);
+    if (buffers[b].inflight > 0) { stalls++; }
+    while (buffers[b].inflight > 0) { pthread_cond_wait(&done_cond, &lock); }
+    pthread_mutex_unlock(&lock);
+  }
+  buffers[b].used = 0;
+}
+
+/**
+ * @brief pwrite backend thread: writes queued buffers until the writer is
+ *        closing and the queue is empty.
+ *
+ * @param arg The LogWriter.
+ * @return NULL once closed.
+ */
+void *LogWriter::write_loop(void *arg) {
+  LogWriter *w = (LogWriter *)arg;
+  pthread_mutex_lock(&w->lock);
+  while (true) {
+    while (w->queue.empty() && !w->closing) {
+      pthread_cond_wait(&w->queued_cond, &w->lock);
+    }
+    if (w->queue.empty()) { break; }
+    LogBuffer &b = w->buffers[w->queue.front()];
+    w->queue.erase(w->queue.begin());
+    pthread_mutex_unlock(&w->lock);
+    bool ok = true;
+    for (size_t done = 0; ok && done < b.used;) {
+      ssize_t n = pwrite(w->fd, b.data + done, b.used - done, b.offset + done);
+      if (n < 0 && errno == EINTR) { continue; }
+      ok = n > 0;
+      done += ok ? n : 0;
+    }
+    if (ok && w->sync && fdatasync(w->fd) != 0) { ok = false; }
+    if (!ok) {
+      cerr << "[ LOGIO ] pwrite at offset " << b.offset << ": "
+           << strerror(errno) << endl;
+    }
+    pthread_mutex_lock(&w->lock);
+    if (!ok) { w->failed = true; }
+    b.inflight = 0;
+    pthread_cond_broadcast(&w->done_cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/**
+ * @brief Writes the last partial buffer, waits for every write and closes
+ *        the file.
+ *
+ * Logs `[ LOGIO ] {backend} lines: .. bytes: .. writes: .. stalls: ..
+ * (.. MB/s)` to stderr; the rate covers open() to close().
+ *
+ * @return 0 on success, -1 if any write or fsync failed.
+ */
+int LogWriter::close() {
+  if (buffers[current].used > 0) { submit(); }
+  if (backend == LOG_IO_URING) {
+    for (int b = 0; b < LOG_BUFFERS; b++) {
+      while (buffers[b].inflight > 0) { reap(true); }
+    }
+  } else {
+    pthread_mutex_lock(&lock);
+    closing = true;
+    pthread_cond_broadcast(&queued_cond);
+    pthread_mutex_unlock(&lock);
+    for (int t = 0; t < LOG_PWRITE_THREADS; t++) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+  long ns = now_ns() - started_ns;
+  cerr << "[ LOGIO ] " << (backend == LOG_IO_URING ? "uring" : "pwrite")
+       << (fixed ? " fixed" : "") << (sync ? " sync" : "")
+       << " lines: " << lines << " bytes: " << bytes << " writes: " << writes
+       << " stalls: " << stalls << " ("
+       << (ns > 0 ? bytes * 1000 / ns : 0) << " MB/s)" << endl;
+  ::close(fd);
+  fd = -1;
+  return failed ? -1 : 0;
+}
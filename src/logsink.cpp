@@ -0,0 +1,91 @@
+#include "../include/logsink.h"
+
+#include <iostream> /* for cout and cerr */
+
+using namespace std;
+
+// the sink every bank starts with
+CoutSink log_cout;
+
+/**
+ * @brief writes a line to cout, flushed as the record functions always did.
+ */
+void CoutSink::write(const LogRecord &r, const string &line) {
+  (void)r;
+  cout << line << endl;
+}
+
+/**
+ * @brief Construct a filter in front of a sink.
+ *
+ * @param name The mode as --log-sink gives it.
+ * @param out  Where kept lines go; NULL if none are kept.
+ */
+LogFilter::LogFilter(const string &name, LogSink *out)
+    : out(out), name(name), seen(0), passed(0) {
+  binary = out && out->binary;
+}
+
+/**
+ * @brief counts the record and passes it on if keep() says so.
+ *
+ * @details
+ * Called by several workers at once without the log lock, so the counts
+ * are atomic; `n` is the record's position among those seen.
+ */
+bool LogFilter::accept(const LogRecord &r) {
+  long n = seen.fetch_add(1, memory_order_relaxed);
+  if (!keep(r, n) || !out->accept(r)) { return false; }
+  passed.fetch_add(1, memory_order_relaxed);
+  return true;
+}
+
+void LogFilter::write(const LogRecord &r, const string &line) {
+  out->write(r, line);
+}
+
+/**
+ * @brief logs `[ LOGSINK ] <mode> lines: .. written: ..` to stderr.
+ */
+void LogFilter::print_stats() {
+  cerr << "[ LOGSINK ] " << name << " lines: " << seen.load()
+       << " written: " << passed.load() << endl;
+}
+
+bool NullSink::keep(const LogRecord &r, long n) {
+  (void)r;
+  (void)n;
+  return false;
+}
+
+bool SampleSink::keep(const LogRecord &r, long n) {
+  (void)r;
+  return n % every == 0;
+}
+
+bool FailureSink::keep(const LogRecord &r, long n) {
+  (void)n;
+  return r.status == LOG_FAIL;
+}
+
+/**
+ * @brief Builds the filter a --log-sink mode selects in front of a sink.
+ *
+ * @param mode  LOG_SINK_ALL, LOG_SINK_NONE, LOG_SINK_SAMPLE or
+ *              LOG_SINK_FAILURES.
+ * @param every For LOG_SINK_SAMPLE, keep one line in `every`.
+ * @param out   The sink kept lines go to.
+ * @return The filter, or NULL for LOG_SINK_ALL (use `out` itself).
+ */
+LogFilter *make_log_filter(int mode, long every, LogSink *out) {
+  switch (mode) {
+    case LOG_SINK_NONE:
+      return new NullSink();
+    case LOG_SINK_SAMPLE:
+      return new SampleSink(out, every);
+    case LOG_SINK_FAILURES:
+      return new FailureSink(out);
+    default:
+      return NULL;
+  }
+}
@@ -0,0 +1,198 @@
+#include "../include/lz.h"
+
+#include <stdint.h>
+#include <string.h> /* for memcpy() */
+
+/*
+ * Block format (the LZ4 block layout): a sequence is a token byte whose high
+ * nibble is the literal count and low nibble the match length minus 4, a
+ * count of 15 continuing in bytes of 255 and a final byte below 255, then
+ * the literals, then a little-endian 16-bit offset back into the output.
+ * The last sequence has literals only.
+ */
+
+// a match may not start in the last 12 bytes, and the last 5 are literals,
+// so the decoder never reads a match past the end of the block
+const size_t LZ_MATCH_LIMIT = 12;
+const size_t LZ_LAST_LITERALS = 5;
+const size_t LZ_MIN_MATCH = 4;
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief writes the continuation bytes of a count above 14.
+ */
+static inline uint8_t *put_count(uint8_t *op, size_t n) {
+  for (; n >= 255; n -= 255) { *op++ = 255; }
+  *op++ = (uint8_t)n;
+  return op;
+}
+
+/**
+ * @brief returns how many bytes from `a` and `b` on are equal, stopping at
+ *        `limit` (the end of `a`).
+ */
+static inline size_t match_length(const uint8_t *a, const uint8_t *b,
+                                  const uint8_t *limit) {
+  const uint8_t *start = a;
+  while (a + 8 <= limit) {
+    uint64_t diff = read64(a) ^ read64(b);
+    if (diff) { return a - start + (__builtin_ctzll(diff) >> 3); }
+    a += 8;
+    b += 8;
+  }
+  while (a < limit && *a == *b) {
+    a++;
+    b++;
+  }
+  return a - start;
+}
+
+/**
+ * @brief Compresses a block.
+ *
+ * @details
+ * Greedy single-pass LZ77: each position's first 4 bytes are hashed into a
+ * table of the last position seen with that hash; if the bytes there match
+ * and lie within LZ_WINDOW, the match is extended and emitted, otherwise
+ * the position becomes a literal. Log lines repeat most of their text, so
+ * this finds the long matches that matter at a few hundred MB/s.
+ *
+ * @param src The bytes to compress.
+ * @param size Their number.
+ * @param dst Where the compressed block goes.
+ * @param capacity Its size; lz_bound(size) always suffices.
+ * @return The compressed size, or 0 if it would not fit in `capacity`.
+ */
+size_t lz_compress(const char *src, size_t size, char *dst, size_t capacity) {
+  const uint8_t *base = (const uint8_t *)src;
+  const uint8_t *end = base + size;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  uint8_t *op = (uint8_t *)dst;
+  uint8_t *oend = op + capacity;
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  if (size > LZ_MATCH_LIMIT) {
+    const uint8_t *match_start_limit = end - LZ_MATCH_LIMIT;
+    const uint8_t *match_end_limit = end - LZ_LAST_LITERALS;
+    while (ip < match_start_limit) {
+      uint32_t seq = read32(ip);
+      uint32_t h = hash4(seq);
+      const uint8_t *ref = base + table[h];
+      table[h] = ip - base;
+      if (ref >= ip || (size_t)(ip - ref) > LZ_WINDOW || read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+      size_t len = LZ_MIN_MATCH + match_length(ip + LZ_MIN_MATCH,
+                                               ref + LZ_MIN_MATCH,
+                                               match_end_limit);
+      size_t literals = ip - anchor;
+      size_t extra = len - LZ_MIN_MATCH;
+      if ((size_t)(oend - op) <
+          1 + literals / 255 + 1 + literals + 2 + extra / 255 + 1) {
+        return 0;
+      }
+      uint8_t *token = op++;
+      *token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+      if (literals >= 15) { op = put_count(op, literals - 15); }
+      memcpy(op, anchor, literals);
+      op += literals;
+      size_t offset = ip - ref;
+      *op++ = (uint8_t)offset;
+      *op++ = (uint8_t)(offset >> 8);
+      *token |= (uint8_t)(extra < 15 ? extra : 15);
+      if (extra >= 15) { op = put_count(op, extra - 15); }
+      ip += len;
+      anchor = ip;
+    }
+  }
+  size_t literals = end - anchor;
+  if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals) { return 0; }
+  *op++ = (uint8_t)((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15) { op = put_count(op, literals - 15); }
+  memcpy(op, anchor, literals);
+  op += literals;
+  return op - (uint8_t *)dst;
+}
+
+/**
+ * @brief Decompresses a block written by lz_compress().
+ *
+ * @details
+ * Every count and offset is checked against the input and output bounds,
+ * so a damaged block fails instead of reading or writing out of range.
+ *
+ * @param src The compressed block.
+ * @param size Its size.
+ * @param dst Where the bytes go.
+ * @param raw_size Their number, as recorded when the block was written.
+ * @return 0 on success, -1 if the block is damaged or does not decompress
+ *         to exactly `raw_size` bytes.
+ */
+int lz_decompress(const char *src, size_t size, char *dst, size_t raw_size) {
+  const uint8_t *ip = (const uint8_t *)src;
+  const uint8_t *iend = ip + size;
+  uint8_t *op = (uint8_t *)dst;
+  uint8_t *oend = op + raw_size;
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend) { return -1; }
+        b = *ip++;
+        literals += b;
+      } while (b == 255);
+    }
+    if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) {
+      return -1;
+    }
+    memcpy(op, ip, literals);
+    op += literals;
+    ip += literals;
+    if (ip == iend) { break; }
+    if (iend - ip < 2) { return -1; }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst)) { return -1; }
+    size_t len = token & 15;
+    if (len == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend) { return -1; }
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += LZ_MIN_MATCH;
+    if (len > (size_t)(oend - op)) { return -1; }
+    // a match closer than its length overlaps the bytes it produces, so
+    // those are copied byte by byte
+    const uint8_t *match = op - offset;
+    if (offset >= len) {
+      memcpy(op, match, len);
+    } else {
+      for (size_t i = 0; i < len; i++) { op[i] = match[i]; }
+    }
+    op += len;
+  }
+  return op == oend ? 0 : -1;
+}
@@ -1,13 +1,235 @@
 #include "../include/ledger.h"
 
+#include <stdio.h>  /* for sscanf() */
+#include <string.h> /* for strcmp() and strncmp() */
+
+static void usage(char *prog) {
+  cerr << "Usage: " << prog
+       << " <num_of_threads> <leader_file> [more_leader_files] [options]\n"
+       << "  more ledger files are merged with the first by their ts= column\n"
+       << "  --adaptive   treat num_of_threads as the maximum and resize the\n"
+       << "               worker pool based on measured contention\n"
+       << "  --accounts N number of accounts opened at startup (default 10)\n"
+       << "  --mvcc N     keep versioned balances for the last N ledger IDs\n"
+       << "               (and any older ones a running query needs)\n"
+       << "  --history A  index per-account history while running and print\n"
+       << "               account A's history at exit (repeatable)\n"
+       << "  --history-ms N\n"
+       << "               also query the --history accounts every N ms while\n"
+       << "               running and log a summary line to stderr\n"
+       << "  --interest B end-of-day interest of B basis points\n"
+       << "  --fee F      end-of-day flat fee of F\n"
+       << "  --bulk-min M end-of-day jobs only touch balances >= M\n"
+       << "  --bulk-accounts A-B\n"
+       << "               end-of-day jobs only touch accounts A..B\n"
+       << "  --check      check that balances match deposits minus\n"
+       << "               withdrawals after the ledger and end-of-day jobs\n"
+       << "  --check-ms N also check every N ms while running\n"
+       << "  --report F   final balances as text (default), csv or bin\n"
+       << "  --report-file P\n"
+       << "               write the final balances to P instead of stdout\n"
+       << "  --range A:B  only replay ledgerIDs A..B (B optional), seeking\n"
+       << "               with the <leader_file>.idx sidecar index\n"
+       << "  --checkpoint P\n"
+       << "               start from the balances in binary report P and,\n"
+       << "               without --range, replay after its last ledgerID\n"
+       << "  --progress P write a binary report of the balances, holds,\n"
+       << "               velocity windows and schedules to P at exit,\n"
+       << "               also when SIGINT or SIGTERM cancels the run, to\n"
+       << "               resume from with --checkpoint; not with --shards\n"
+       << "               or --tenants\n"
+       << "  --dedup N    reject entries whose txn= ID repeats one of the\n"
+       << "               last N IDs, counted apart from failures\n"
+       << "  --top K      sketch account accesses and print the K most\n"
+       << "               accessed accounts at exit\n"
+       << "  --rules P    deny entries matching the rules in file P before\n"
+       << "               they run, counted as failures\n"
+       << "  --fx P       load FX rates from P, enabling balances in other\n"
+       << "               currencies with the cur= and to= columns\n"
+       << "  --tenants N  host N banks in one process, routing entries by\n"
+       << "               their tenant= column\n"
+       << "  --replica M  replicate every change to a standby process, M is\n"
+       << "               sync (wait for it after each entry) or async; not\n"
+       << "               with --shards or --tenants. If the primary dies,\n"
+       << "               the standby writes the report and the --progress\n"
+       << "               marker in its place\n"
+       << "  --log-file P write the log to P instead of stdout, through\n"
+       << "               asynchronous I/O; not with --shards\n"
+       << "  --log-io B   how --log-file is written: uring (default; falls\n"
+       << "               back to pwrite if unavailable) or pwrite threads\n"
+       << "  --log-format F\n"
+       << "               the log file or segments as text (default) or\n"
+       << "               bin, packed 24-byte records that bin/log_render\n"
+       << "               turns into the text\n"
+       << "  --log-sync   make every --log-file buffer durable before reuse\n"
+       << "  --log-segments D\n"
+       << "               write the log to directory D as segments compressed\n"
+       << "               in the background and indexed by ledgerID; not with\n"
+       << "               --log-file or --shards\n"
+       << "  --log-segment-mb N\n"
+       << "               start a new segment before one exceeds N MiB on\n"
+       << "               disk (default 64)\n"
+       << "  --log-rotate-ms T\n"
+       << "               also start one when a segment is T ms old\n"
+       << "  --log-sink S which log lines are written: all (default), none,\n"
+       << "               failures, or sample:N for one in N; the counts\n"
+       << "               always include every outcome\n"
+       << "  --shards N   partition the accounts across N processes, each\n"
+       << "               with num_of_threads workers; not with --tenants,\n"
+       << "               --checkpoint, --history or more ledger files.\n"
+       << "               Transfers between shards in other currencies,\n"
+       << "               or scheduled, fail as CROSS-SHARD\n"
+       << endl;
+  exit(-1);
+}
+
 int main(int argc, char* argv[]) {
-  if (argc != 3) {
-    cerr << "Usage: " << argv[0] << " <num_of_threads> <leader_file>\n" << endl;
-    exit(-1);
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--adaptive") == 0) {
+      opts.adaptive = true;
+    } else if (strcmp(argv[i], "--accounts") == 0 && i + 1 < argc) {
+      opts.accounts = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mvcc") == 0 && i + 1 < argc) {
+      opts.mvcc = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+      opts.history.push_back(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--history-ms") == 0 && i + 1 < argc) {
+      opts.history_ms = atoi(argv[++i]);
+      if (opts.history_ms < 1) { usage(argv[0]); }
+    } else if (strcmp(argv[i], "--interest") == 0 && i + 1 < argc) {
+      opts.interest = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--fee") == 0 && i + 1 < argc) {
+      opts.fee = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--bulk-min") == 0 && i + 1 < argc) {
+      opts.bulk_min = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--check") == 0) {
+      opts.check = true;
+    } else if (strcmp(argv[i], "--check-ms") == 0 && i + 1 < argc) {
+      opts.check = true;
+      opts.check_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "text") == 0) {
+        opts.report = REPORT_TEXT;
+      } else if (strcmp(argv[i], "csv") == 0) {
+        opts.report = REPORT_CSV;
+      } else if (strcmp(argv[i], "bin") == 0) {
+        opts.report = REPORT_BIN;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--report-file") == 0 && i + 1 < argc) {
+      opts.report_file = argv[++i];
+    } else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+      int n = sscanf(argv[++i], "%d:%d", &opts.range_first, &opts.range_last);
+      if (n < 1 || opts.range_first < 0) { usage(argv[0]); }
+    } else if (strcmp(argv[i], "--dedup") == 0 && i + 1 < argc) {
+      opts.dedup = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      opts.top = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rules") == 0 && i + 1 < argc) {
+      opts.rules = argv[++i];
+    } else if (strcmp(argv[i], "--fx") == 0 && i + 1 < argc) {
+      opts.fx = argv[++i];
+    } else if (strcmp(argv[i], "--tenants") == 0 && i + 1 < argc) {
+      opts.tenants = atoi(argv[++i]);
+      if (opts.tenants < 1) { usage(argv[0]); }
+    } else if (strcmp(argv[i], "--replica") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "sync") == 0) {
+        opts.replica = REPLICA_SYNC;
+      } else if (strcmp(argv[i], "async") == 0) {
+        opts.replica = REPLICA_ASYNC;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc) {
+      opts.log_file = argv[++i];
+    } else if (strcmp(argv[i], "--log-io") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "uring") == 0) {
+        opts.log_io = LOG_IO_URING;
+      } else if (strcmp(argv[i], "pwrite") == 0) {
+        opts.log_io = LOG_IO_PWRITE;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--log-format") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "text") == 0) {
+        opts.log_format = LOG_TEXT;
+      } else if (strcmp(argv[i], "bin") == 0) {
+        opts.log_format = LOG_BIN;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--log-sync") == 0) {
+      opts.log_sync = true;
+    } else if (strcmp(argv[i], "--log-segments") == 0 && i + 1 < argc) {
+      opts.log_segments = argv[++i];
+    } else if (strcmp(argv[i], "--log-segment-mb") == 0 && i + 1 < argc) {
+      opts.log_segment_mb = atol(argv[++i]);
+      if (opts.log_segment_mb < 1) { usage(argv[0]); }
+    } else if (strcmp(argv[i], "--log-rotate-ms") == 0 && i + 1 < argc) {
+      opts.log_rotate_ms = atol(argv[++i]);
+      if (opts.log_rotate_ms < 1) { usage(argv[0]); }
+    } else if (strcmp(argv[i], "--log-sink") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "all") == 0) {
+        opts.log_sink = LOG_SINK_ALL;
+      } else if (strcmp(argv[i], "none") == 0) {
+        opts.log_sink = LOG_SINK_NONE;
+      } else if (strcmp(argv[i], "failures") == 0) {
+        opts.log_sink = LOG_SINK_FAILURES;
+      } else if (sscanf(argv[i], "sample:%ld", &opts.log_sample) == 1 &&
+                 opts.log_sample >= 1) {
+        opts.log_sink = LOG_SINK_SAMPLE;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      opts.shards = atoi(argv[++i]);
+      if (opts.shards < 1) { usage(argv[0]); }
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      opts.checkpoint = argv[++i];
+    } else if (strcmp(argv[i], "--progress") == 0 && i + 1 < argc) {
+      opts.progress = argv[++i];
+    } else if (strcmp(argv[i], "--bulk-accounts") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d-%d", &opts.bulk_first, &opts.bulk_last) != 2) {
+        usage(argv[0]);
+      }
+    } else if (strncmp(argv[i], "--", 2) != 0) {
+      opts.ledgers.push_back(argv[i]);
+    } else {
+      cerr << "Unknown option: " << argv[i] << endl;
+      usage(argv[0]);
+    }
+  }
+
+  if (opts.shards > 1 && (opts.tenants > 1 || !opts.checkpoint.empty() ||
+                          !opts.history.empty() || !opts.ledgers.empty())) {
+    usage(argv[0]);
+  }
+  if (opts.replica != REPLICA_OFF && (opts.shards > 1 || opts.tenants > 1)) {
+    usage(argv[0]);
+  }
+
+  bool log_to_file = !opts.log_file.empty() || !opts.log_segments.empty();
+  if ((log_to_file && opts.shards > 1) ||
+      (!opts.log_file.empty() && !opts.log_segments.empty()) ||
+      (opts.log_format == LOG_BIN && !log_to_file)) {
+    usage(argv[0]);
+  }
+  if (!opts.progress.empty() && (opts.shards > 1 || opts.tenants > 1)) {
+    usage(argv[0]);
   }
 
   int p = atoi(argv[1]);
   InitBank(p, argv[2]);
 
-  return 0;
+  return exit_status;
 }
@@ -0,0 +1,103 @@
+#include "../include/merge.h"
+
+using namespace std;
+
+/**
+ * @brief orders streams by the timestamp of their next entry, then by their
+ *        position on the command line.
+ */
+static bool earlier(const LedgerStream *a, const LedgerStream *b) {
+  if (a->next.ts != b->next.ts) { return a->next.ts < b->next.ts; }
+  return a->index < b->index;
+}
+
+/**
+ * @brief Destroy the LedgerMerge object, closing any files still open.
+ */
+LedgerMerge::~LedgerMerge() {
+  for (LedgerStream *s : heap) { delete s; }
+}
+
+/**
+ * @brief Opens every ledger file and reads its first entry.
+ *
+ * @param files The ledger files, in command line order.
+ * @return 0 on success, -1 if a file cannot be opened (named in `failed`).
+ */
+int LedgerMerge::open(const vector<string> &files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    LedgerStream *s = new LedgerStream;
+    s->file.open(files[i]);
+    if (!s->file.is_open()) {
+      delete s;
+      failed = files[i];
+      return -1;
+    }
+    s->index = i;
+    s->next.ts = 0;
+    if (advance(s)) {
+      heap.push_back(s);
+      sift_up(heap.size() - 1);
+    } else {
+      delete s;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief reads the next valid entry of a stream into `s->next`.
+ *
+ * An entry without a `ts=` column keeps the timestamp of the entry before
+ * it in the same file.
+ *
+ * @return true if an entry was read, false at the end of the file.
+ */
+bool LedgerMerge::advance(LedgerStream *s) {
+  string line;
+  while (getline(s->file, line)) {
+    if (parse_ledger_line(line, s->next)) { return true; }
+  }
+  return false;
+}
+
+/**
+ * @brief Takes the earliest pending entry across all files.
+ *
+ * @param entry Receives the entry; its ledgerID is left for the caller.
+ * @return true if an entry was taken, false once every file is exhausted.
+ */
+bool LedgerMerge::next(Ledger &entry) {
+  if (heap.empty()) { return false; }
+  LedgerStream *top = heap[0];
+  entry = top->next;
+  if (!advance(top)) {
+    delete top;
+    heap[0] = heap.back();
+    heap.pop_back();
+  }
+  if (!heap.empty()) { sift_down(0); }
+  return true;
+}
+
+void LedgerMerge::sift_down(size_t i) {
+  size_t n = heap.size();
+  while (true) {
+    size_t least = i;
+    size_t l = 2 * i + 1, r = 2 * i + 2;
+    if (l < n && earlier(heap[l], heap[least])) { least = l; }
+    if (r < n && earlier(heap[r], heap[least])) { least = r; }
+    if (least == i) { return; }
+    swap(heap[i], heap[least]);
+    i = least;
+  }
+}
+
+void LedgerMerge::sift_up(size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!earlier(heap[i], heap[parent])) { return; }
+    swap(heap[i], heap[parent]);
+    i = parent;
+  }
+}
@@ -0,0 +1,116 @@
+#include "../include/mvcc.h"
+#include "../include/epoch.h"
+
+using namespace std;
+
+/**
+ * @brief Construct a new VersionStore.
+ *
+ * @param retain How many ledger IDs of history to keep behind the newest
+ * commit when no reader needs older versions.
+ */
+VersionStore::VersionStore(int retain) : retain(retain) {
+  newest = 0;
+  for (int i = 0; i < MVCC_READERS; i++) {
+    readers[i] = -1;
+  }
+}
+
+/**
+ * @brief oldest ledgerID a reader may still ask for.
+ */
+int VersionStore::horizon() {
+  int h = newest.load(memory_order_relaxed) - retain;
+  for (int i = 0; i < MVCC_READERS; i++) {
+    int pinned = readers[i].load(memory_order_acquire);
+    if (pinned >= 0 && pinned < h) { h = pinned; }
+  }
+  return h;
+}
+
+/**
+ * @brief cuts the chain after the version that is current at `below` and
+ *        retires the cut-off versions.
+ *
+ * @attention
+ * - The caller holds the account lock.
+ */
+void VersionStore::trim(Account *acc, int below) {
+  Version *v = acc->versions.load(memory_order_relaxed);
+  while (v != NULL && v->ledgerID > below) {
+    v = v->older.load(memory_order_relaxed);
+  }
+  if (v == NULL) { return; }
+  Version *tail = v->older.exchange(NULL, memory_order_acq_rel);
+  while (tail != NULL) {
+    Version *next = tail->older.load(memory_order_relaxed);
+    epochs.retire(tail);
+    tail = next;
+  }
+}
+
+/**
+ * @brief Records the account's current balance as a new version.
+ *
+ * @attention
+ * - The caller holds the account lock and has already applied the change.
+ *
+ * @param acc The account that changed.
+ * @param ledgerID The ID of the ledger entry that changed it.
+ */
+void VersionStore::record(Account *acc, int ledgerID) {
+  Version *v = new Version;
+  v->ledgerID = ledgerID;
+  v->balance = acc->balance;
+  v->older.store(acc->versions.load(memory_order_relaxed),
+                 memory_order_relaxed);
+  acc->versions.store(v, memory_order_release);
+
+  int seen = newest.load(memory_order_relaxed);
+  while (ledgerID > seen &&
+         !newest.compare_exchange_weak(seen, ledgerID,
+                                       memory_order_relaxed)) {
+  }
+  if (++acc->untrimmed >= MVCC_TRIM_EVERY) {
+    acc->untrimmed = 0;
+    trim(acc, horizon());
+  }
+}
+
+/**
+ * @brief Reads the balance of an account as of a ledgerID without locking.
+ *
+ * @details
+ * Pins `asof` in a reader slot so writers keep the versions it needs, then
+ * walks the chain from the newest version. If every reader slot is taken
+ * the read still proceeds; it may then report a version as not retained.
+ *
+ * @attention
+ * - The caller must be inside an EpochGuard.
+ *
+ * @param acc The account to read.
+ * @param asof The ledgerID to read as of.
+ * @param balance Receives the balance on success.
+ * @return true if a version as of `asof` is retained, false otherwise.
+ */
+bool VersionStore::read(Account *acc, int asof, long *balance) {
+  int slot = -1;
+  for (int i = 0; i < MVCC_READERS && slot < 0; i++) {
+    int expected = -1;
+    if (readers[i].compare_exchange_strong(expected, asof)) { slot = i; }
+  }
+
+  bool found = false;
+  Version *v = acc->versions.load(memory_order_acquire);
+  while (v != NULL) {
+    if (v->ledgerID <= asof) {
+      *balance = v->balance;
+      found = true;
+      break;
+    }
+    v = v->older.load(memory_order_acquire);
+  }
+
+  if (slot >= 0) { readers[slot].store(-1, memory_order_release); }
+  return found;
+}
@@ -0,0 +1,196 @@
+#include "../include/pool.h"
+#include <iostream> /* for cerr */
+#include <sstream>
+
+using namespace std;
+
+atomic<long> lock_wait_ns{0};
+WorkerPool *pool;
+
+/**
+ * @brief Construct a new WorkerPool object.
+ *
+ * @details
+ * A fixed pool runs all `max_workers` threads for the whole ledger. An
+ * adaptive pool starts at half of them (rounded up) and lets the controller
+ * move the level between 1 and `max_workers`.
+ *
+ * @param max_workers The number of worker threads that will be created.
+ * @param adaptive    Whether the controller thread should resize the pool.
+ */
+WorkerPool::WorkerPool(int max_workers, bool adaptive)
+    : max_workers(max_workers), adaptive(adaptive) {
+  pthread_mutex_init(&park_lock, NULL);
+  pthread_cond_init(&park_cond, NULL);
+  level = adaptive ? (max_workers + 1) / 2 : max_workers;
+  processed = 0;
+  done = false;
+  paused = false;
+  busy = 0;
+}
+
+/**
+ * @brief Destroy the WorkerPool object, joining the controller if it ran.
+ */
+WorkerPool::~WorkerPool() {
+  finish();
+  if (adaptive) {
+    pthread_join(controller_thread, NULL);
+  }
+  pthread_cond_destroy(&park_cond);
+  pthread_mutex_destroy(&park_lock);
+}
+
+/**
+ * @brief starts the controller thread (adaptive pools only).
+ */
+void WorkerPool::start() {
+  if (!adaptive) { return; }
+  cerr << "[ POOL ] adaptive, starting at " << level << " of " << max_workers
+       << " workers" << endl;
+  pthread_create(&controller_thread, NULL, controller, this);
+}
+
+/**
+ * @brief marks the ledger as drained and wakes every parked worker so it can
+ *        observe the empty ledger and exit.
+ */
+void WorkerPool::finish() {
+  pthread_mutex_lock(&park_lock);
+  done = true;
+  pthread_cond_broadcast(&park_cond);
+  pthread_mutex_unlock(&park_lock);
+}
+
+/**
+ * @brief Parks every worker and waits until none is processing an entry.
+ *
+ * @details
+ * Workers check `paused` after marking themselves busy and the caller waits
+ * for `busy` to drop to zero after setting it, so when pause() returns no
+ * worker is inside a bank operation and none can start one until resume().
+ * Only one thread may pause the pool at a time.
+ */
+void WorkerPool::pause() {
+  paused.store(true, memory_order_seq_cst);
+  struct timespec nap = {0, 100000L};
+  while (busy.load(memory_order_seq_cst) > 0) {
+    nanosleep(&nap, NULL);
+  }
+}
+
+/**
+ * @brief releases the workers parked by pause().
+ */
+void WorkerPool::resume() {
+  pthread_mutex_lock(&park_lock);
+  paused = false;
+  pthread_cond_broadcast(&park_cond);
+  pthread_mutex_unlock(&park_lock);
+}
+
+/**
+ * @brief slow path of wait_turn(): sleeps until the level covers this worker
+ *        and the pool is not paused, or the pool is finished.
+ *
+ * @param workerID The ID of the worker (thread).
+ */
+void WorkerPool::park(int workerID) {
+  pthread_mutex_lock(&park_lock);
+  while ((workerID >= level || paused) && !done) {
+    pthread_cond_wait(&park_cond, &park_lock);
+  }
+  pthread_mutex_unlock(&park_lock);
+}
+
+/**
+ * @brief changes the active level and logs the reason for the change.
+ */
+void WorkerPool::set_level(int next, const char *reason, double tput,
+                           double wait) {
+  // one write per line so it does not interleave with other stderr output
+  ostringstream line;
+  line << "[ POOL ] workers " << level << " -> " << next << " (" << reason
+       << ", " << (long)tput << " entries/s, lock wait " << (int)(wait * 100)
+       << "%)\n";
+  cerr << line.str();
+  pthread_mutex_lock(&park_lock);
+  level = next;
+  pthread_cond_broadcast(&park_cond);
+  pthread_mutex_unlock(&park_lock);
+}
+
+/**
+ * @brief Controller thread for adaptive pools.
+ *
+ * @details
+ * Every POOL_SAMPLE_MS the controller measures entries processed per second
+ * and the share of time active workers spent blocked on locks. It keeps
+ * stepping the level in the same direction while throughput rises, reverses
+ * when throughput drops, and steps down whenever lock wait exceeds
+ * POOL_HIGH_WAIT. While throughput holds within 3% the level stays put, and
+ * only after POOL_PROBE_MS of that does the controller probe one step
+ * further, so the level settles around the best concurrency for the
+ * current mix of the ledger instead of oscillating around it.
+ *
+ * @param self The WorkerPool being controlled.
+ * @return NULL once the pool is finished.
+ */
+void *WorkerPool::controller(void *self) {
+  WorkerPool *p = (WorkerPool *)self;
+  struct timespec nap = {0, POOL_SAMPLE_MS * 1000000L};
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long last_ns = now.tv_sec * 1000000000L + now.tv_nsec;
+  long last_done = p->processed;
+  long last_wait = lock_wait_ns;
+  double prev_tput = -1;
+  int dir = 1;
+  long held_ns = 0;  // how long throughput has held since the last step
+
+  while (!p->done) {
+    nanosleep(&nap, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long now_ns = now.tv_sec * 1000000000L + now.tv_nsec;
+    long cur_done = p->processed;
+    long cur_wait = lock_wait_ns;
+    int cur = p->level;
+
+    double dt = (double)(now_ns - last_ns);
+    double tput = (cur_done - last_done) * 1e9 / dt;
+    double wait = (cur_wait - last_wait) / (dt * cur);
+    last_ns = now_ns;
+    last_done = cur_done;
+    last_wait = cur_wait;
+
+    if (prev_tput >= 0 && !p->done) {
+      const char *reason = NULL;
+      if (tput < prev_tput * 0.97) {
+        dir = -dir;
+        reason = "throughput fell";
+      } else if (tput > prev_tput * 1.03) {
+        reason = "throughput rose";
+      } else {
+        held_ns += (long)dt;
+        if (held_ns >= POOL_PROBE_MS * 1000000L) { reason = "probe"; }
+      }
+      if (wait > POOL_HIGH_WAIT) {
+        dir = -1;
+        reason = "lock wait high";
+      }
+      int next = cur + dir;
+      if (reason == NULL) {
+        // hold the level
+      } else if (next < 1 || next > p->max_workers) {
+        // bounce off the bounds instead of sitting on them
+        dir = -dir;
+      } else {
+        p->set_level(next, reason, tput, wait);
+        held_ns = 0;
+      }
+    }
+    prev_tput = tput;
+  }
+  cerr << "[ POOL ] finished at " << p->level << " workers" << endl;
+  return NULL;
+}
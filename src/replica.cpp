@@ -0,0 +1,536 @@
+#include "../include/bank.h"
+#include "../include/epoch.h"
+
+#include <errno.h>      /* for errno */
+#include <signal.h>     /* for signal() */
+#include <string.h>     /* for memset() */
+#include <sys/socket.h> /* for socketpair(), send(), recv() and shutdown() */
+#include <sys/wait.h>   /* for waitpid() */
+#include <time.h>       /* for clock_gettime() */
+#include <unistd.h>     /* for fork() and close() */
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+// records of the calling thread's changes since its last commit()
+static thread_local vector<ReplRecord> outbox;
+
+/**
+ * @brief returns CLOCK_MONOTONIC in nanoseconds, which is the same clock
+ *        in the primary and the standby.
+ */
+static long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+ * @brief sends a whole buffer, without raising SIGPIPE if the other end is
+ *        gone.
+ *
+ * @return true on success, false on a send error.
+ */
+static bool send_all(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief receives exactly `size` bytes.
+ *
+ * @return true on success, false on end of file or a receive error.
+ */
+static bool recv_all(int fd, void *data, size_t size) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief 64-bit finalizer (splitmix64).
+ */
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/**
+ * @brief digests the balances and held amounts of every open account, in
+ *        every currency, so the primary and the standby can compare their
+ *        state without shipping it.
+ *
+ * @param accounts Receives the number of open accounts.
+ */
+static uint64_t digest(Bank *b, int64_t *accounts) {
+  EpochGuard guard;
+  uint64_t h = 0;
+  int64_t n = 0;
+  int num = b->accounts.size();
+  for (int i = 0; i < num; i++) {
+    const Account *acc = b->accounts.get(i);
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    if (!acc->open) { continue; }
+    uint64_t a = mix64(acc->accountID);
+    h += mix64(a ^ (uint64_t)acc->balance);
+    h += mix64(~a ^ (uint64_t)acc->held);
+    for (int c = 0; acc->wallet && c < FX_CURRENCIES - 1; c++) {
+      if (acc->wallet[c] != 0) { h += mix64(a + c + 1) ^ acc->wallet[c]; }
+    }
+    n++;
+  }
+  *accounts = n;
+  return h;
+}
+
+/**
+ * @brief Construct a new Replicator, not yet attached to a standby.
+ *
+ * @param mode REPLICA_ASYNC or REPLICA_SYNC.
+ * @param ledgerID The last ledger entry the starting balances reflect.
+ */
+Replicator::Replicator(int mode, int ledgerID)
+    : mode(mode), fd(-1), pid(-1), pending_since(0), published(0), acked(0),
+      upto(ledgerID), closing(false), lost(false), standby(false),
+      batches(0), lag_sum_ns(0), lag_max_ns(0) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&published_cond, NULL);
+  pthread_cond_init(&acked_cond, NULL);
+  final_ack = {0, 0, 0, 0};
+}
+
+/**
+ * @brief Destroy the Replicator. Call finish() first on the primary.
+ */
+Replicator::~Replicator() {
+  if (fd >= 0) { close(fd); }
+  pthread_cond_destroy(&acked_cond);
+  pthread_cond_destroy(&published_cond);
+  pthread_mutex_destroy(&lock);
+}
+
+/**
+ * @brief Forks the standby, connected to this process by a Unix socket
+ *        pair, and on the primary starts the shipper and reader threads.
+ *
+ * @details
+ * The standby starts from a copy of the bank as it is now, so call after
+ * anything that sets up the starting balances (a checkpoint) and before
+ * any other thread is started. It returns with `standby` set and should go
+ * straight to run_standby().
+ *
+ * @return 0 on success in both processes, -1 in the primary if the socket
+ * or the process cannot be created.
+ */
+int Replicator::start() {
+  int fds[2];
+  signal(SIGPIPE, SIG_IGN);
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("socketpair");
+    return -1;
+  }
+  cout.flush();
+  cerr.flush();
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    fd = fds[1];
+    standby = true;
+    return 0;
+  }
+  close(fds[1]);
+  fd = fds[0];
+  pthread_create(&shipper, NULL, ship, this);
+  pthread_create(&reader, NULL, collect, this);
+  return 0;
+}
+
+/**
+ * @brief Records the state of an account after a change.
+ *
+ * @attention
+ * - The caller holds the account lock (or runs at a quiescent point), so
+ * the account's change numbers follow the order of its changes.
+ * - The record stays in the calling thread's buffer until commit().
+ */
+void Replicator::record(Account *acc) {
+  ReplRecord r;
+  r.accountID = acc->accountID;
+  r.lsn = ++acc->lsn;
+  r.kind = REPL_ACCOUNT;
+  r.ledgerID = -1;
+  r.open = acc->open;
+  r.pending = acc->pending;
+  r.balance = acc->balance;
+  r.held = acc->held;
+  for (int c = 0; c < FX_CURRENCIES - 1; c++) {
+    r.wallet[c] = acc->wallet ? acc->wallet[c] : 0;
+  }
+  outbox.push_back(r);
+}
+
+/**
+ * @brief Records that a hold was placed, or captured, released or expired.
+ *
+ * @attention
+ * - Call right after record() of the change to `held` that goes with it,
+ * still under the account lock. The standby applies the hold once it has
+ * applied that change.
+ * - The record stays in the calling thread's buffer until commit().
+ */
+void Replicator::record_hold(const Account *acc, const Hold *h,
+                             bool placed) {
+  ReplRecord r;
+  memset(&r, 0, sizeof(r));
+  r.accountID = h->accountID;
+  r.lsn = h->ledgerID;
+  r.kind = placed ? REPL_HOLD : REPL_UNHOLD;
+  r.pending = acc->lsn;
+  r.balance = h->amount;
+  r.held = h->expires;
+  outbox.push_back(r);
+}
+
+/**
+ * @brief Notes that a worker took a ledger entry, which is not committed
+ *        until its commit().
+ *
+ * @attention
+ * - Call under the ledger lock, in the order the entries are taken, and
+ * only for entries past the last ledgerID taken (not for executions of
+ * schedules).
+ */
+void Replicator::take(int ledgerID) {
+  pthread_mutex_lock(&lock);
+  running.push_back(make_pair(ledgerID, false));
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Publishes the calling thread's records, as the changes of entry
+ *        `ledgerID`, to the shipper.
+ *
+ * In sync mode, waits until the standby has acknowledged them; in async
+ * mode, only while the standby is more than REPLICA_WINDOW records behind.
+ * Returns without waiting if the thread recorded nothing, or the standby is
+ * lost.
+ *
+ * @attention
+ * - Workers call this once per ledger entry they take, whether or not it
+ * changed anything; other threads that change accounts call it before
+ * they exit, with the ledgerID their changes belong to.
+ */
+void Replicator::commit(int ledgerID) {
+  for (ReplRecord &r : outbox) { r.ledgerID = ledgerID; }
+  pthread_mutex_lock(&lock);
+  if (!outbox.empty()) {
+    if (pending.empty()) { pending_since = now_ns(); }
+    pending.insert(pending.end(), outbox.begin(), outbox.end());
+    published += outbox.size();
+  }
+  for (pair<int, bool> &e : running) {
+    if (e.first == ledgerID) {
+      e.second = true;
+      break;
+    }
+  }
+  while (!running.empty() && running.front().second) {
+    upto = running.front().first;
+    running.pop_front();
+  }
+  if (outbox.empty()) {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  long mine = published;
+  pthread_cond_signal(&published_cond);
+  if (mode == REPLICA_SYNC) {
+    while (acked < mine && !lost) { pthread_cond_wait(&acked_cond, &lock); }
+  } else {
+    while (published - acked > REPLICA_WINDOW && !lost) {
+      pthread_cond_wait(&acked_cond, &lock);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  outbox.clear();
+}
+
+/**
+ * @brief Shipper thread: sends everything published so far as one batch,
+ *        and again whenever more has been published, until finish().
+ *
+ * @param arg The Replicator.
+ * @return NULL once the last batch is sent.
+ */
+void *Replicator::ship(void *arg) {
+  Replicator *r = (Replicator *)arg;
+  vector<ReplRecord> batch;
+  while (true) {
+    pthread_mutex_lock(&r->lock);
+    while (r->pending.empty() && !r->closing) {
+      pthread_cond_wait(&r->published_cond, &r->lock);
+    }
+    if (r->pending.empty()) {
+      pthread_mutex_unlock(&r->lock);
+      break;
+    }
+    batch.swap(r->pending);
+    ReplBatch header = {r->published, (int64_t)batch.size(), r->pending_since,
+                        r->upto};
+    pthread_mutex_unlock(&r->lock);
+    if (!send_all(r->fd, &header, sizeof(header)) ||
+        !send_all(r->fd, batch.data(), batch.size() * sizeof(ReplRecord))) {
+      shutdown(r->fd, SHUT_WR);
+      return NULL;
+    }
+    batch.clear();
+  }
+  // the standby sends its digest once it has applied everything; without
+  // this header it takes over instead
+  pthread_mutex_lock(&r->lock);
+  ReplBatch last = {r->published, -1, 0, r->upto};
+  pthread_mutex_unlock(&r->lock);
+  send_all(r->fd, &last, sizeof(last));
+  shutdown(r->fd, SHUT_WR);
+  return NULL;
+}
+
+/**
+ * @brief Reader thread: takes the standby's acknowledgements, measures the
+ *        lag and wakes the workers waiting on them, until the final digest.
+ *
+ * @param arg The Replicator.
+ * @return NULL once the final digest arrives or the standby is lost.
+ */
+void *Replicator::collect(void *arg) {
+  Replicator *r = (Replicator *)arg;
+  ReplAck ack;
+  while (recv_all(r->fd, &ack, sizeof(ack))) {
+    if (ack.upto < 0) {
+      r->final_ack = ack;
+      return NULL;
+    }
+    long lag = now_ns() - ack.since_ns;
+    pthread_mutex_lock(&r->lock);
+    r->acked = ack.upto;
+    r->batches++;
+    r->lag_sum_ns += lag;
+    if (lag > r->lag_max_ns) { r->lag_max_ns = lag; }
+    pthread_cond_broadcast(&r->acked_cond);
+    pthread_mutex_unlock(&r->lock);
+  }
+  cerr << "[ REPL ] standby lost" << endl;
+  pthread_mutex_lock(&r->lock);
+  r->lost = true;
+  pthread_cond_broadcast(&r->acked_cond);
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+/**
+ * @brief applies one record to the standby's bank.
+ *
+ * An account record is applied only if it is newer than the account's last
+ * applied change, so the order of records across accounts does not matter.
+ * A hold may be closed by one worker before the worker that placed it has
+ * committed, so a close that finds no hold is remembered in `closed` and
+ * cancels the placement when it comes.
+ */
+void Replicator::apply(Bank *b, const ReplRecord &r) {
+  if (r.kind == REPL_HOLD) {
+    if (closed.erase(r.lsn) > 0) { return; }
+    Hold *h = new Hold;
+    h->ledgerID = r.lsn;
+    h->accountID = r.accountID;
+    h->amount = r.balance;
+    h->expires = r.held;
+    if (!b->holds.add(h, h->expires >= 0)) { delete h; }
+    return;
+  }
+  if (r.kind == REPL_UNHOLD) {
+    Hold *h = b->holds.take(r.lsn, r.accountID, 0);
+    if (h == NULL) { closed.insert(r.lsn); }
+    delete h;
+    return;
+  }
+  if (!b->accounts.grow(r.accountID + 1)) { return; }
+  Account *acc = b->accounts.get(r.accountID);
+  if (r.lsn <= acc->lsn) { return; }
+  acc->lsn = r.lsn;
+  acc->open = r.open;
+  acc->pending = r.pending;
+  acc->balance = r.balance;
+  acc->held = r.held;
+  for (int c = 0; c < FX_CURRENCIES - 1; c++) {
+    if (r.wallet[c] != 0 && acc->wallet == NULL) {
+      acc->wallet = new long[FX_CURRENCIES - 1]();
+    }
+    if (acc->wallet) { acc->wallet[c] = r.wallet[c]; }
+  }
+}
+
+/**
+ * @brief returns the account change number a record follows: an account
+ *        record's own, or that of the change to `held` a hold record goes
+ *        with.
+ */
+static uint32_t change_of(const ReplRecord &r) {
+  return r.kind == REPL_ACCOUNT ? r.lsn : (uint32_t)r.pending;
+}
+
+/**
+ * @brief whether the standby may apply a record: its entry is at or before
+ *        `upto`, and it is the account's next change (or, for a hold, the
+ *        change it goes with has been applied).
+ *
+ * An account record is the account's whole state, so it includes every
+ * earlier change to the account; applying it before an earlier change whose
+ * entry is still held back would apply that entry's effect early.
+ */
+static bool released(Bank *b, const ReplRecord &r, int upto) {
+  if (r.ledgerID > upto) { return false; }
+  const Account *acc = b->accounts.get(r.accountID);
+  uint32_t applied = acc ? acc->lsn : 0;
+  return r.kind == REPL_ACCOUNT ? r.lsn <= applied + 1
+                                : change_of(r) <= applied;
+}
+
+/**
+ * @brief Standby loop: applies batches to this process's copy of the bank
+ *        and acknowledges each, until the primary finishes, then sends the
+ *        digest of the result.
+ *
+ * The records of an entry are applied once a batch names a ledgerID at or
+ * past it; until then they are held back. An account record is also held
+ * back until the account's earlier changes are applied (see released()),
+ * so each account goes through its changes in order and never shows the
+ * effect of an entry past `upto`. The held records are kept sorted by
+ * change number, so a run of them on one account goes in one pass. The
+ * primary's last header releases everything, including the end-of-day
+ * jobs.
+ *
+ * @param b The standby's bank.
+ * @param last Receives the last ledgerID whose changes were all applied.
+ * @return 0 once the digest is sent, 1 if the primary went away before
+ * finishing, so the standby should take over from `*last` (with every
+ * velocity limit removed), -1 if it went away after.
+ */
+int Replicator::run_standby(Bank *b, int *last) {
+  EpochGuard guard;
+  ReplBatch header;
+  vector<ReplRecord> batch;
+  vector<ReplRecord> later;  // records of entries past `upto`
+  while (recv_all(fd, &header, sizeof(header))) {
+    if (header.count < 0) {
+      for (const ReplRecord &r : later) { apply(b, r); }
+      upto = header.ledgerID;
+      *last = upto;
+      ReplAck ack = {-1, 0, 0, 0};
+      ack.digest = digest(b, &ack.accounts);
+      return send_all(fd, &ack, sizeof(ack)) ? 0 : -1;
+    }
+    batch.resize(header.count);
+    if (!recv_all(fd, batch.data(), header.count * sizeof(ReplRecord))) {
+      break;
+    }
+    upto = header.ledgerID;
+    later.insert(later.end(), batch.begin(), batch.end());
+    stable_sort(later.begin(), later.end(),
+                [](const ReplRecord &x, const ReplRecord &y) {
+                  return change_of(x) < change_of(y);
+                });
+    size_t kept = 0;
+    for (const ReplRecord &r : later) {
+      if (released(b, r, upto)) {
+        apply(b, r);
+      } else {
+        later[kept++] = r;
+      }
+    }
+    later.resize(kept);
+    ReplAck ack = {header.upto, header.since_ns, 0, 0};
+    if (!send_all(fd, &ack, sizeof(ack))) { break; }
+  }
+  // velocity limits are not replicated, so none survive a takeover
+  int num = b->accounts.size();
+  for (int i = 0; i < num; i++) {
+    Account *acc = b->accounts.get(i);
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    acc->limit = 0;
+  }
+  *last = upto;
+  return 1;
+}
+
+/**
+ * @brief Ships the last records, waits for the standby to apply them and
+ *        compares its digest with the primary's bank.
+ *
+ * @details
+ * Logs to stderr
+ *   `[ REPL ] {mode} records: {n} batches: {b} ({avg} records/batch) lag avg: {us} us max: {us} us`
+ * and
+ *   `[ REPL ] standby accounts: {n} digest OK` (or `MISMATCH`).
+ *
+ * @attention
+ * - Call at a quiescent point, after the workers and end-of-day jobs.
+ *
+ * @param b The primary's bank.
+ * @return true if the standby ended with the same balances.
+ */
+bool Replicator::finish(Bank *b) {
+  pthread_mutex_lock(&lock);
+  closing = true;
+  pthread_cond_signal(&published_cond);
+  pthread_mutex_unlock(&lock);
+  pthread_join(shipper, NULL);
+  pthread_join(reader, NULL);
+  waitpid(pid, NULL, 0);
+
+  int64_t accounts;
+  uint64_t h = digest(b, &accounts);
+  bool ok = !lost && final_ack.upto < 0 && final_ack.digest == h &&
+            final_ack.accounts == accounts;
+  ostringstream line;
+  line << "[ REPL ] " << (mode == REPLICA_SYNC ? "sync" : "async")
+       << " records: " << published << " batches: " << batches << " ("
+       << (batches ? published / batches : 0) << " records/batch) lag avg: "
+       << (batches ? lag_sum_ns / batches / 1000 : 0)
+       << " us max: " << lag_max_ns / 1000 << " us\n";
+  line << "[ REPL ] standby accounts: " << final_ack.accounts << " digest "
+       << (ok ? "OK" : "MISMATCH") << "\n";
+  cerr << line.str();
+  return ok;
+}
@@ -0,0 +1,506 @@
+#include "../include/bank.h"
+#include "../include/epoch.h"
+
+#include <errno.h>
+#include <fstream>
+#include <limits.h> /* for IOV_MAX */
+#include <string.h> /* for memcpy() */
+#include <sys/uio.h> /* for writev() */
+#include <charconv>
+#include <vector>
+
+using namespace std;
+
+// longest text or CSV line: "ID# " + 10 digits + " | " + 20 digits + "\n"
+const int REPORT_LINE_MAX = 40;
+// most an account's other currencies add: a record each, or " | " + code +
+// " " + 20 digits each
+const int REPORT_WALLET_MAX = (FX_CURRENCIES - 1) * (3 + FX_CODE_MAX + 1 + 20);
+// what the other currencies' columns add to a CSV row: "," + 20 digits each
+const int REPORT_CSV_WALLET_MAX = (FX_CURRENCIES - 1) * (1 + 20);
+
+/**
+ * @brief one report thread's range of segments and its output buffer.
+ */
+struct ReportChunk {
+  Bank *bank;
+  int format;
+  int first_seg;
+  int last_seg;  // exclusive
+  vector<char> buf;
+  long count;
+};
+
+/**
+ * @brief appends an account's non-zero balances in other currencies to its
+ *        text report line (` | {code} {balance}`) or as records after its
+ *        base record. CSV rows have a column per currency instead.
+ *
+ * @return The new end of the chunk's output.
+ */
+static char *format_wallet(ReportChunk *chunk, char *p, const Account &acc) {
+  size_t at = p - chunk->buf.data();
+  chunk->buf.resize(chunk->buf.size() + REPORT_WALLET_MAX);
+  p = chunk->buf.data() + at;
+  // drop the newline so the currencies extend the line
+  if (chunk->format != REPORT_BIN) { p--; }
+  for (int c = 1; c < FX_CURRENCIES; c++) {
+    long balance = acc.wallet[c - 1];
+    if (balance == 0) { continue; }
+    if (chunk->format == REPORT_BIN) {
+      ReportRecord r = {acc.accountID, c, balance};
+      memcpy(p, &r, sizeof(r));
+      p += sizeof(r);
+      chunk->count++;
+      continue;
+    }
+    string code = chunk->bank->currency(c);
+    memcpy(p, " | ", 3);
+    p += 3;
+    memcpy(p, code.data(), code.size());
+    p += code.size();
+    *p++ = ' ';
+    p = to_chars(p, p + 20, balance).ptr;
+  }
+  if (chunk->format != REPORT_BIN) { *p++ = '\n'; }
+  return p;
+}
+
+/**
+ * @brief Formats a contiguous range of segments into the chunk's buffer with
+ *        std::to_chars, skipping accounts that are not open.
+ *
+ * @param arg The ReportChunk to fill.
+ * @return NULL when done.
+ */
+static void *format_chunk(void *arg) {
+  ReportChunk *chunk = (ReportChunk *)arg;
+  EpochGuard guard;
+  int num = chunk->bank->accounts.size();
+  int first = chunk->first_seg << SEG_SHIFT;
+  int last = chunk->last_seg << SEG_SHIFT;
+  if (last > num) { last = num; }
+  if (first >= last) { return NULL; }
+
+  // CSV rows carry every other currency's column, zero or not
+  int others = chunk->bank->fx ? chunk->bank->fx->num - 1 : 0;
+  size_t per = chunk->format == REPORT_BIN ? sizeof(ReportRecord)
+               : chunk->format == REPORT_CSV
+                   ? REPORT_LINE_MAX + REPORT_CSV_WALLET_MAX
+                   : REPORT_LINE_MAX;
+  // only allocated segments can hold open accounts
+  size_t slots = 0;
+  for (int base = first; base < last; base += SEG_SIZE) {
+    if (chunk->bank->accounts.get(base) == NULL) { continue; }
+    slots += last - base < SEG_SIZE ? last - base : SEG_SIZE;
+  }
+  chunk->buf.resize(slots * per);
+  char *p = chunk->buf.data();
+  for (int base = first; base < last; base += SEG_SIZE) {
+    Account *seg = chunk->bank->accounts.get(base);
+    if (seg == NULL) { continue; }
+    int n = last - base < SEG_SIZE ? last - base : SEG_SIZE;
+    for (int i = 0; i < n; i++) {
+      if (!seg[i].open) { continue; }
+      if (chunk->format == REPORT_BIN) {
+        ReportRecord r = {seg[i].accountID, 0, seg[i].balance};
+        memcpy(p, &r, sizeof(r));
+        p += sizeof(r);
+      } else if (chunk->format == REPORT_CSV) {
+        p = to_chars(p, p + 10, seg[i].accountID).ptr;
+        *p++ = ',';
+        p = to_chars(p, p + 20, seg[i].balance).ptr;
+        for (int c = 0; c < others; c++) {
+          *p++ = ',';
+          p = to_chars(p, p + 20, seg[i].wallet ? seg[i].wallet[c] : 0).ptr;
+        }
+        *p++ = '\n';
+      } else {
+        memcpy(p, "ID# ", 4);
+        p = to_chars(p + 4, p + 14, seg[i].accountID).ptr;
+        memcpy(p, " | ", 3);
+        p = to_chars(p + 3, p + 23, seg[i].balance).ptr;
+        *p++ = '\n';
+      }
+      chunk->count++;
+      if (seg[i].wallet != NULL && chunk->format != REPORT_CSV) {
+        p = format_wallet(chunk, p, seg[i]);
+      }
+    }
+  }
+  chunk->buf.resize(p - chunk->buf.data());
+  return NULL;
+}
+
+/**
+ * @brief writes every iovec completely, in batches of at most IOV_MAX.
+ *
+ * @return 0 on success, -1 on a write error.
+ */
+static int write_all(int fd, vector<struct iovec> &iov) {
+  size_t at = 0;
+  while (at < iov.size()) {
+    int n = iov.size() - at < IOV_MAX ? iov.size() - at : IOV_MAX;
+    ssize_t w = writev(fd, &iov[at], n);
+    if (w < 0) {
+      if (errno == EINTR) { continue; }
+      return -1;
+    }
+    // skip fully written buffers and advance into a partial one
+    while (at < iov.size() && w >= (ssize_t)iov[at].iov_len) {
+      w -= iov[at].iov_len;
+      at++;
+    }
+    if (at < iov.size()) {
+      iov[at].iov_base = (char *)iov[at].iov_base + w;
+      iov[at].iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Writes the final balances of all open accounts.
+ *
+ * @details
+ * The account table is split into contiguous ranges of segments, each
+ * formatted by its own thread into one large buffer with std::to_chars. The
+ * buffers are then written in order with writev(), so the whole report
+ * costs a handful of system calls instead of one flush per account.
+ *
+ * Formats:
+ *   - REPORT_TEXT: the print_account() lines `ID# {id} | {balance}` followed
+ *     by `Success: {num_succ} Fails: {num_fail}`.
+ *   - REPORT_CSV: an `account,balance` header and one row per account.
+ *   - REPORT_BIN: a ReportHeader tagged with `last_ledgerID`, then one
+ *     ReportRecord per account and currency.
+ * Non-zero balances in other currencies extend an account's text line with
+ * ` | {code} {balance}` and its CSV row with `,{code},{balance}`.
+ *
+ * @attention
+ * - Runs at a quiescent point (after the workers have joined), so it reads
+ * balances without taking account locks.
+ * - Flushes cout first so the report lands after earlier log lines.
+ *
+ * @param fd The file descriptor to write to.
+ * @param format REPORT_TEXT, REPORT_CSV or REPORT_BIN.
+ * @param num_threads The number of formatting threads.
+ * @param last_ledgerID The last ledger entry reflected in the balances.
+ * @return 0 on success, -1 on a write error.
+ */
+int Bank::write_report(int fd, int format, int num_threads,
+                       int last_ledgerID) {
+  EpochGuard guard;
+  int segs = (accounts.size() + SEG_SIZE - 1) >> SEG_SHIFT;
+  if (num_threads < 1) { num_threads = 1; }
+  if (num_threads > segs) { num_threads = segs > 0 ? segs : 1; }
+
+  vector<ReportChunk> chunks(num_threads);
+  vector<pthread_t> threads(num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    chunks[t].bank = this;
+    chunks[t].format = format;
+    chunks[t].first_seg = (int)((long)segs * t / num_threads);
+    chunks[t].last_seg = (int)((long)segs * (t + 1) / num_threads);
+    chunks[t].count = 0;
+    pthread_create(&threads[t], NULL, format_chunk, &chunks[t]);
+  }
+  long count = 0;
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    count += chunks[t].count;
+  }
+
+  ReportHeader header;
+  memcpy(header.magic, REPORT_MAGIC, sizeof(header.magic));
+  header.last_ledgerID = last_ledgerID;
+  header.reserved = 0;
+  header.count = count;
+  // the base balance, then a column named by each other currency's code
+  string csv_header = "account,balance";
+  for (int c = 1; fx && c < fx->num; c++) { csv_header += "," + currency(c); }
+  csv_header += "\n";
+  string summary = "Success: " + to_string(num_succ) +
+                   " Fails: " + to_string(num_fail) + "\n";
+
+  vector<struct iovec> iov;
+  if (format == REPORT_BIN) {
+    iov.push_back({&header, sizeof(header)});
+  } else if (format == REPORT_CSV) {
+    iov.push_back({(void *)csv_header.data(), csv_header.size()});
+  }
+  for (ReportChunk &c : chunks) {
+    if (!c.buf.empty()) { iov.push_back({c.buf.data(), c.buf.size()}); }
+  }
+  if (format == REPORT_TEXT) {
+    iov.push_back({(void *)summary.data(), summary.size()});
+  }
+
+  cout.flush();
+  return write_all(fd, iov);
+}
+
+/**
+ * @brief Appends the state section of a --progress marker to a binary
+ *        report: the ledger clock, the open holds, the velocity windows of
+ *        limited accounts and the given schedules.
+ *
+ * @attention
+ * - Runs at a quiescent point, right after write_report(REPORT_BIN).
+ *
+ * @param fd The file descriptor the report was written to.
+ * @param schedules The pending scheduled entries.
+ * @return 0 on success, -1 on a write error.
+ */
+int Bank::write_state(int fd, const vector<ScheduleRecord> &schedules) {
+  static_assert(sizeof(LimitRecord::outflow) ==
+                    VELOCITY_BUCKETS * sizeof(int32_t),
+                "LimitRecord must hold a whole velocity window");
+  EpochGuard guard;
+  vector<Hold *> open;
+  holds.list(open);
+  vector<HoldRecord> hold_records;
+  for (Hold *h : open) {
+    hold_records.push_back({h->ledgerID, (uint32_t)h->accountID, h->amount,
+                            h->expires});
+  }
+  vector<LimitRecord> limits;
+  int num = accounts.size();
+  for (int i = 0; i < num; i++) {
+    Account *acc = accounts.get(i);
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    if (!acc->open || acc->limit == 0) { continue; }
+    LimitRecord l = {acc->accountID, acc->limit, acc->bucket_ticks, {}, 0,
+                     acc->bucket};
+    for (int b = 0; b < VELOCITY_BUCKETS; b++) {
+      l.outflow[b] = acc->outflow[b];
+    }
+    limits.push_back(l);
+  }
+
+  StateHeader header;
+  memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+  header.clock = clock.load();
+  header.holds = hold_records.size();
+  header.limits = limits.size();
+  header.schedules = schedules.size();
+  vector<struct iovec> iov;
+  iov.push_back({&header, sizeof(header)});
+  iov.push_back({hold_records.data(),
+                 hold_records.size() * sizeof(HoldRecord)});
+  iov.push_back({limits.data(), limits.size() * sizeof(LimitRecord)});
+  iov.push_back({(void *)schedules.data(),
+                 schedules.size() * sizeof(ScheduleRecord)});
+  return write_all(fd, iov);
+}
+
+/**
+ * @brief returns how many bytes are left to read in a file, so the counts
+ *        in its headers can be checked before anything is sized by them.
+ */
+static int64_t bytes_left(ifstream &in) {
+  streampos at = in.tellg();
+  in.seekg(0, ios::end);
+  streampos end = in.tellg();
+  in.seekg(at);
+  return at < 0 || end < at ? 0 : (int64_t)(end - at);
+}
+
+/**
+ * @brief restores the state section of a checkpoint, if it has one.
+ *
+ * @return 0 on success or if there is none, -1 if it is not valid.
+ */
+static int load_state(Bank *bank, ifstream &in,
+                      vector<ScheduleRecord> *schedules) {
+  StateHeader header;
+  if (!in.read((char *)&header, sizeof(header))) {
+    return in.gcount() == 0 ? 0 : -1;
+  }
+  int64_t left = bytes_left(in);
+  if (memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.holds < 0 || header.limits < 0 || header.schedules < 0 ||
+      header.holds > left / (int64_t)sizeof(HoldRecord) ||
+      header.limits > left / (int64_t)sizeof(LimitRecord) ||
+      header.schedules > left / (int64_t)sizeof(ScheduleRecord) ||
+      header.holds * sizeof(HoldRecord) +
+              header.limits * sizeof(LimitRecord) +
+              header.schedules * sizeof(ScheduleRecord) >
+          (uint64_t)left) {
+    return -1;
+  }
+  vector<HoldRecord> holds(header.holds);
+  vector<LimitRecord> limits(header.limits);
+  schedules->resize(header.schedules);
+  if (!in.read((char *)holds.data(), holds.size() * sizeof(HoldRecord)) ||
+      !in.read((char *)limits.data(), limits.size() * sizeof(LimitRecord)) ||
+      !in.read((char *)schedules->data(),
+               schedules->size() * sizeof(ScheduleRecord))) {
+    return -1;
+  }
+  bank->clock = header.clock;
+  for (const LimitRecord &l : limits) {
+    Account *acc = bank->accounts.get(l.accountID);
+    if (acc == NULL || l.bucket_ticks < 1) { return -1; }
+    acc->limit = l.limit;
+    acc->bucket_ticks = l.bucket_ticks;
+    acc->bucket = l.bucket;
+    for (int b = 0; b < VELOCITY_BUCKETS; b++) {
+      acc->outflow[b] = l.outflow[b];
+    }
+  }
+  for (const HoldRecord &r : holds) {
+    Account *acc = bank->accounts.get(r.accountID);
+    if (acc == NULL) { return -1; }
+    Hold *h = new Hold;
+    h->ledgerID = r.ledgerID;
+    h->accountID = r.accountID;
+    h->amount = r.amount;
+    h->expires = r.expires;
+    if (!bank->holds.add(h, r.expires >= 0)) {
+      delete h;
+      return -1;
+    }
+    acc->held += r.amount;
+  }
+  return 0;
+}
+
+/**
+ * @brief Restores balances from a binary report used as a checkpoint.
+ *
+ * @details
+ * The checkpoint is the complete state: every account it lists is opened
+ * with its balance (growing the table as needed) and every other account is
+ * closed with a zero balance. The net flow of each currency is reset to its
+ * restored total so the conservation check keeps holding. Balances in other
+ * currencies need the same FX rate table the report was written with. A
+ * --progress marker also restores the ledger clock, the open holds and the
+ * velocity windows from its state section (see write_state()) and hands
+ * back its schedules; without one there are none.
+ *
+ * @attention
+ * - Call before the workers start.
+ *
+ * @param path A report written with REPORT_BIN.
+ * @param last_ledgerID Receives the last ledger entry the checkpoint covers.
+ * @param schedules Receives the scheduled entries still pending.
+ * @return 0 on success, -1 if the file is missing or not a valid report.
+ */
+int Bank::load_checkpoint(const char *path, int *last_ledgerID,
+                          vector<ScheduleRecord> *schedules) {
+  ifstream in(path, ios::binary);
+  ReportHeader header;
+  if (!in.is_open() || !in.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, REPORT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.count < 0 ||
+      header.count > bytes_left(in) / (int64_t)sizeof(ReportRecord)) {
+    return -1;
+  }
+  vector<ReportRecord> records(header.count);
+  if (!in.read((char *)records.data(), header.count * sizeof(ReportRecord))) {
+    return -1;
+  }
+  int currencies = fx ? fx->num : 1;
+  for (const ReportRecord &r : records) {
+    if (r.accountID >= (uint32_t)MAX_ACCOUNTS || r.currency < 0 ||
+        r.currency >= currencies || !accounts.grow(r.accountID + 1)) {
+      return -1;
+    }
+  }
+
+  EpochGuard guard;
+  int num = accounts.size();
+  for (int i = 0; i < num; i++) {
+    Account *acc = accounts.get(i);
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    acc->open = 0;
+    acc->balance = 0;
+    acc->held = 0;
+    acc->limit = 0;
+    if (acc->wallet) {
+      for (int c = 0; c < FX_CURRENCIES - 1; c++) { acc->wallet[c] = 0; }
+    }
+  }
+  long total[FX_CURRENCIES] = {0};
+  for (const ReportRecord &r : records) {
+    Account *acc = accounts.get(r.accountID);
+    acc->open = 1;
+    if (r.currency == 0) {
+      acc->balance = r.balance;
+    } else {
+      if (acc->wallet == NULL) { acc->wallet = new long[FX_CURRENCIES - 1](); }
+      acc->wallet[r.currency - 1] = r.balance;
+    }
+    total[r.currency] += r.balance;
+  }
+  net_flow = total[0];
+  for (int c = 1; c < FX_CURRENCIES; c++) { fx_flow[c - 1] = total[c]; }
+  *last_ledgerID = header.last_ledgerID;
+  return load_state(this, in, schedules);
+}
+
+/**
+ * @brief Adds the accounts of a binary report held in memory, such as one a
+ *        shard process sent its coordinator.
+ *
+ * @details
+ * Unlike load_checkpoint() this is not the complete state: every account
+ * the report lists is opened with its balances (growing the table as
+ * needed) and the net flows grow by the report's totals, but accounts it
+ * does not list are left alone. Merging the reports of shards that own
+ * disjoint accounts into a bank with no open accounts rebuilds the whole
+ * bank.
+ *
+ * @attention
+ * - Call at a quiescent point.
+ *
+ * @param data A report written with REPORT_BIN.
+ * @param size Its length in bytes.
+ * @return 0 on success, -1 if it is not a valid report.
+ */
+int Bank::merge_report(const char *data, size_t size) {
+  ReportHeader header;
+  if (size < sizeof(header)) { return -1; }
+  memcpy(&header, data, sizeof(header));
+  // the count is checked against the size before it is multiplied
+  if (memcmp(header.magic, REPORT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.count < 0 ||
+      (uint64_t)header.count > (size - sizeof(header)) / sizeof(ReportRecord) ||
+      size != sizeof(header) + header.count * sizeof(ReportRecord)) {
+    return -1;
+  }
+  vector<ReportRecord> records(header.count);
+  memcpy(records.data(), data + sizeof(header),
+         header.count * sizeof(ReportRecord));
+  int currencies = fx ? fx->num : 1;
+  for (const ReportRecord &r : records) {
+    if (r.accountID >= (uint32_t)MAX_ACCOUNTS || r.currency < 0 ||
+        r.currency >= currencies || !accounts.grow(r.accountID + 1)) {
+      return -1;
+    }
+  }
+
+  EpochGuard guard;
+  long total[FX_CURRENCIES] = {0};
+  for (const ReportRecord &r : records) {
+    Account *acc = accounts.get(r.accountID);
+    acc->open = 1;
+    if (r.currency == 0) {
+      acc->balance = r.balance;
+    } else {
+      if (acc->wallet == NULL) { acc->wallet = new long[FX_CURRENCIES - 1](); }
+      acc->wallet[r.currency - 1] = r.balance;
+    }
+    total[r.currency] += r.balance;
+  }
+  net_flow += total[0];
+  for (int c = 1; c < FX_CURRENCIES; c++) { fx_flow[c - 1] += total[c]; }
+  return 0;
+}
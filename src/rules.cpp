@@ -0,0 +1,224 @@
+#include "../include/rules.h"
+
+#include <errno.h>  /* for errno */
+#include <string.h> /* for memset() */
+#include <time.h>   /* for clock_gettime() */
+#include <sstream>
+
+using namespace std;
+
+static const char *RULE_FIELD_NAMES[RULE_FIELDS] = {"acc", "other", "amount",
+                                                    "mode"};
+
+/**
+ * @brief maps an int onto uint32_t keeping its order, so a range check on
+ *        biased values is one unsigned compare.
+ */
+static inline uint32_t bias(long x) {
+  return (uint32_t)x ^ 0x80000000u;
+}
+
+/**
+ * @brief parses a whole int.
+ *
+ * @return a pointer past the number, or NULL if there is none or it does
+ * not fit an int.
+ */
+static const char *parse_int(const char *s, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(s, &end, 10);
+  if (end == s || errno != 0 || *value < INT_MIN || *value > INT_MAX) {
+    return NULL;
+  }
+  return end;
+}
+
+/**
+ * @brief Construct a new, empty RuleSet that denies nothing.
+ */
+RuleSet::RuleSet() : screened(0), denied(0), nanos(0) {
+  memset(cols, 0, sizeof(cols));
+  memset(verdict, 0, sizeof(verdict));
+}
+
+/**
+ * @brief narrows the bounds of one column by a condition such as
+ *        `amount>5000`, `mode=2` or `acc=100-199`.
+ *
+ * @return false if the condition cannot be parsed.
+ */
+bool RuleSet::parse_condition(const string &cond, long lo[], long hi[]) {
+  size_t op = cond.find_first_of("<>=");
+  if (op == string::npos) { return false; }
+  int field = 0;
+  while (field < RULE_FIELDS && cond.compare(0, op, RULE_FIELD_NAMES[field]) != 0) {
+    field++;
+  }
+  if (field == RULE_FIELDS) { return false; }
+  char kind = cond[op];
+  bool inclusive = kind == '=' || (op + 1 < cond.size() && cond[op + 1] == '=');
+  const char *text = cond.c_str() + op + (kind != '=' && inclusive ? 2 : 1);
+  long a, b;
+  const char *end = parse_int(text, &a);
+  if (end == NULL) { return false; }
+  b = a;
+  // `=A-B` is a range
+  if (kind == '=' && *end == '-') { end = parse_int(end + 1, &b); }
+  if (end == NULL || *end != '\0') { return false; }
+  if (kind == '<') {
+    hi[field] = min(hi[field], inclusive ? a : a - 1);
+  } else if (kind == '>') {
+    lo[field] = max(lo[field], inclusive ? a : a + 1);
+  } else {
+    lo[field] = max(lo[field], a);
+    hi[field] = min(hi[field], b);
+  }
+  return true;
+}
+
+/**
+ * @brief Loads and compiles a rules file.
+ *
+ * @details
+ * One rule per line; `#` starts a comment:
+ *   - `deny COND...` denies entries that meet every condition. A condition
+ *     is a column (`acc`, `other`, `amount` or `mode`), an operator (`=`,
+ *     `<`, `<=`, `>`, `>=`) and a value, or `=A-B` for a range. `mode` is
+ *     the operation a scheduled entry runs, not its scheduling mode.
+ *   - `block ACC...` denies every entry on the accounts listed, and
+ *     transfers to them.
+ * The first line that matches an entry decides. A deny rule whose
+ * conditions contradict each other can never match and is dropped.
+ *
+ * @param path The rules file.
+ * @return 0 on success, -1 if the file cannot be opened or a line cannot be
+ * parsed (the line is printed to stderr).
+ */
+int RuleSet::load(const char *path) {
+  ifstream file(path);
+  if (!file.is_open()) { return -1; }
+  string text;
+  int line = 0;
+  while (getline(file, text)) {
+    line++;
+    istringstream iss(text.substr(0, text.find('#')));
+    string word;
+    if (!(iss >> word)) { continue; }
+    bool ok = true;
+    if (word == "deny") {
+      long lo[RULE_FIELDS], hi[RULE_FIELDS];
+      for (int f = 0; f < RULE_FIELDS; f++) {
+        lo[f] = INT_MIN;
+        hi[f] = INT_MAX;
+      }
+      while (ok && iss >> word) { ok = parse_condition(word, lo, hi); }
+      bool possible = true;
+      for (int f = 0; f < RULE_FIELDS; f++) { possible &= lo[f] <= hi[f]; }
+      if (ok && possible) {
+        Rule rule;
+        for (int f = 0; f < RULE_FIELDS; f++) {
+          rule.lo[f] = bias(lo[f]);
+          rule.span[f] = (uint32_t)(hi[f] - lo[f]);
+        }
+        rule.line = line;
+        table.push_back(rule);
+      }
+    } else if (word == "block") {
+      long acc;
+      while (ok && iss >> word) {
+        const char *end = parse_int(word.c_str(), &acc);
+        ok = end != NULL && *end == '\0';
+        if (ok) { blocked.emplace(acc, line); }
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      cerr << path << ":" << line << ": cannot parse rule '" << text << "'"
+           << endl;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief screens up to RULE_BATCH entries.
+ *
+ * The batch is copied into biased columns, then every row of the table
+ * runs over all RULE_BATCH lanes with no branch, last row first, so the
+ * first matching line is left in `verdict`. Lanes past `n` hold stale
+ * columns and are ignored.
+ */
+void RuleSet::screen_batch(Ledger *entries, int n) {
+  for (int j = 0; j < n; j++) {
+    const Ledger &e = entries[j];
+    cols[RULE_ACC][j] = bias(e.acc);
+    cols[RULE_OTHER][j] = bias(e.other);
+    cols[RULE_AMOUNT][j] = bias(e.amount);
+    cols[RULE_MODE][j] = bias(e.mode >= SCHED_AT ? e.mode % 10 : e.mode);
+  }
+  for (int j = 0; j < RULE_BATCH; j++) { verdict[j] = 0; }
+  for (auto r = table.rbegin(); r != table.rend(); ++r) {
+    const uint32_t acc_lo = r->lo[RULE_ACC], acc_span = r->span[RULE_ACC];
+    const uint32_t oth_lo = r->lo[RULE_OTHER], oth_span = r->span[RULE_OTHER];
+    const uint32_t amt_lo = r->lo[RULE_AMOUNT], amt_span = r->span[RULE_AMOUNT];
+    const uint32_t mod_lo = r->lo[RULE_MODE], mod_span = r->span[RULE_MODE];
+    const int line = r->line;
+    for (int j = 0; j < RULE_BATCH; j++) {
+      bool match = (cols[RULE_ACC][j] - acc_lo <= acc_span) &
+                   (cols[RULE_OTHER][j] - oth_lo <= oth_span) &
+                   (cols[RULE_AMOUNT][j] - amt_lo <= amt_span) &
+                   (cols[RULE_MODE][j] - mod_lo <= mod_span);
+      verdict[j] = match ? line : verdict[j];
+    }
+  }
+  for (int j = 0; j < n; j++) {
+    int line = verdict[j];
+    if (!blocked.empty()) {
+      auto it = blocked.find(entries[j].acc);
+      if (it != blocked.end() && (line == 0 || it->second < line)) {
+        line = it->second;
+      }
+      if (entries[j].mode % 10 == T) {
+        it = blocked.find(entries[j].other);
+        if (it != blocked.end() && (line == 0 || it->second < line)) {
+          line = it->second;
+        }
+      }
+    }
+    entries[j].rule = line;
+    denied += line != 0;
+  }
+}
+
+/**
+ * @brief Screens ledger entries, setting each one's `rule` to the line of
+ *        the rule that denies it, or 0.
+ *
+ * @attention
+ * - Not thread safe: one loader thread screens every entry.
+ *
+ * @param entries The entries to screen.
+ * @param n How many there are.
+ */
+void RuleSet::screen(Ledger *entries, size_t n) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < n; i += RULE_BATCH) {
+    screen_batch(entries + i, min(n - i, (size_t)RULE_BATCH));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  nanos += (end.tv_sec - start.tv_sec) * 1000000000L +
+           (end.tv_nsec - start.tv_nsec);
+  screened += n;
+}
+
+/**
+ * @brief returns the number of rows in the decision table plus blocklisted
+ *        accounts.
+ */
+size_t RuleSet::size() {
+  return table.size() + blocked.size();
+}
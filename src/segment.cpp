@@ -0,0 +1,446 @@
+#include "../include/segment.h"
+#include "../include/lz.h"
+
+#include <dirent.h>   /* for opendir() */
+#include <errno.h>    /* for errno */
+#include <fcntl.h>    /* for open() */
+#include <limits.h>   /* for INT_MAX */
+#include <string.h>   /* for memcpy() and strerror() */
+#include <sys/stat.h> /* for mkdir() */
+#include <time.h>     /* for clock_gettime() */
+#include <unistd.h>   /* for write(), pread() and fdatasync() */
+#include <iostream>   /* for cerr */
+
+using namespace std;
+
+const char SEG_PREFIX[] = "segment-";
+const char SEG_SUFFIX[] = ".lz";
+const char SEG_INDEX[] = "index";
+
+static long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+ * @brief returns the path of a segment file in a log directory.
+ */
+string segment_path(const string &dir, int segment) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%06d%s", SEG_PREFIX, segment, SEG_SUFFIX);
+  return dir + "/" + name;
+}
+
+/**
+ * @brief writes a whole buffer to a file descriptor.
+ *
+ * @return 0 on success, -1 on a write error.
+ */
+static int write_all(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+/**
+ * @brief reads a whole range of a file, like pread() without short reads.
+ *
+ * @return 0 on success, -1 on a read error or end of file.
+ */
+static int read_all(int fd, void *data, size_t size, long at) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, at);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return -1; }
+    p += n;
+    size -= n;
+    at += n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Construct a SegmentLog; nothing is opened until open().
+ *
+ * @param segment_bytes Size a segment file is kept within.
+ * @param rotate_ms     Age at which a segment is closed, 0 for no limit.
+ */
+SegmentLog::SegmentLog(long segment_bytes, long rotate_ms)
+    : segment_bytes(segment_bytes), rotate_ms(rotate_ms), opened(false),
+      current(NULL), closing(false), fd(-1), index_fd(-1), offset(0),
+      opened_ns(0), failed(false), lines(0), raw_bytes(0), stored_bytes(0),
+      blocks(0), segments(0), peak_queued(0) {
+  pthread_mutex_init(&lock, NULL);
+  // the compressor's timed wait is against the clock now_ns() reads
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&queued_cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @brief Destroy the SegmentLog, closing it first if open() succeeded.
+ */
+SegmentLog::~SegmentLog() {
+  if (opened) { close(); }
+  delete current;
+  for (SegmentBlock *b : spare) { delete b; }
+  pthread_cond_destroy(&queued_cond);
+  pthread_mutex_destroy(&lock);
+}
+
+/**
+ * @brief Creates the log directory, or empties it of an earlier run's
+ *        segments and index, opens the first segment and starts the
+ *        compressor thread.
+ *
+ * @param path   The directory.
+ * @param format LOG_TEXT or LOG_BIN, recorded in every segment header.
+ * @param codes  The currency codes LOG_BIN records are rendered with.
+ * @return 0 on success, -1 (with errno set) if it cannot be created or
+ *         written.
+ */
+int SegmentLog::open(const char *path, int format, const LogHeader &codes) {
+  dir = path;
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) { return -1; }
+  DIR *d = opendir(path);
+  if (d == NULL) { return -1; }
+  size_t prefix = strlen(SEG_PREFIX);
+  size_t suffix = strlen(SEG_SUFFIX);
+  for (struct dirent *e = readdir(d); e != NULL; e = readdir(d)) {
+    size_t len = strlen(e->d_name);
+    if (len > prefix + suffix &&
+        strncmp(e->d_name, SEG_PREFIX, prefix) == 0 &&
+        strcmp(e->d_name + len - suffix, SEG_SUFFIX) == 0) {
+      unlink((dir + "/" + e->d_name).c_str());
+    }
+  }
+  closedir(d);
+  index_fd = ::open((dir + "/" + SEG_INDEX).c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (index_fd < 0) { return -1; }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SEG_MAGIC, sizeof(header.magic));
+  header.segment = -1;
+  header.format = format;
+  header.log = codes;
+  binary = format == LOG_BIN;
+  if (start_segment() != 0) {
+    ::close(index_fd);
+    index_fd = -1;
+    return -1;
+  }
+  pthread_mutex_lock(&lock);
+  current = take_spare();
+  pthread_mutex_unlock(&lock);
+  packed.resize(lz_bound(SEG_BLOCK_SIZE));
+  pthread_create(&compressor, NULL, compress_loop, this);
+  opened = true;
+  return 0;
+}
+
+/**
+ * @brief closes the open segment, if any, and starts the next one.
+ *
+ * @attention
+ * - Called by open() and then only by the compressor thread.
+ *
+ * @return 0 on success, -1 if the new segment cannot be written.
+ */
+int SegmentLog::start_segment() {
+  if (fd >= 0) {
+    if (fdatasync(fd) != 0) { failed = true; }
+    ::close(fd);
+  }
+  header.segment++;
+  string path = segment_path(dir, header.segment);
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || write_all(fd, &header, sizeof(header)) != 0) {
+    cerr << "[ LOGSEG ] " << path << ": " << strerror(errno) << endl;
+    failed = true;
+    return -1;
+  }
+  offset = sizeof(header);
+  opened_ns = now_ns();
+  segments++;
+  return 0;
+}
+
+/**
+ * @brief returns a free block, allocating one if the compressor holds all
+ *        of them. The caller holds `lock`.
+ */
+SegmentBlock *SegmentLog::take_spare() {
+  SegmentBlock *b = NULL;
+  if (!spare.empty()) {
+    b = spare.back();
+    spare.pop_back();
+  }
+  if (b == NULL) {
+    b = new SegmentBlock;
+    b->data.reserve(SEG_BLOCK_SIZE);
+  }
+  b->data.clear();
+  b->min_lid = INT_MAX;
+  b->max_lid = -1;
+  return b;
+}
+
+/**
+ * @brief queues the current block for the compressor and starts a new one.
+ *        The caller holds `lock`.
+ */
+void SegmentLog::hand_off() {
+  queue.push_back(current);
+  if ((long)queue.size() > peak_queued) { peak_queued = queue.size(); }
+  pthread_cond_signal(&queued_cond);
+  current = take_spare();
+}
+
+/**
+ * @brief Appends a log line and its newline.
+ *
+ * @param line The line.
+ * @param lid  The ledgerID it logs, or -1 if none.
+ */
+void SegmentLog::append(const string &line, int lid) {
+  pthread_mutex_lock(&lock);
+  if (current->data.size() + line.size() + 1 > SEG_BLOCK_SIZE &&
+      !current->data.empty()) {
+    hand_off();
+  }
+  current->data.insert(current->data.end(), line.begin(), line.end());
+  current->data.push_back('\n');
+  if (lid >= 0) {
+    current->min_lid = min(current->min_lid, lid);
+    current->max_lid = max(current->max_lid, lid);
+  }
+  lines++;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Appends raw bytes: one binary record, which a block never splits.
+ *
+ * @param data The record.
+ * @param size Its size.
+ * @param lid  The ledgerID it logs, or -1 if none.
+ */
+void SegmentLog::append(const void *data, size_t size, int lid) {
+  pthread_mutex_lock(&lock);
+  if (current->data.size() + size > SEG_BLOCK_SIZE &&
+      !current->data.empty()) {
+    hand_off();
+  }
+  const char *p = (const char *)data;
+  current->data.insert(current->data.end(), p, p + size);
+  if (lid >= 0) {
+    current->min_lid = min(current->min_lid, lid);
+    current->max_lid = max(current->max_lid, lid);
+  }
+  lines++;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Appends a bank's record, packed (see pack_log()) to a binary log
+ *        and as its line otherwise, indexed by its ledgerID. A record and
+ *        its extension are one append, so a block never splits them.
+ */
+void SegmentLog::write(const LogRecord &r, const string &line) {
+  if (binary) {
+    LogEntry units[2];
+    append(units, pack_log(r, units) * sizeof(LogEntry), r.lid);
+  } else {
+    append(line, r.lid);
+  }
+}
+
+/**
+ * @brief compresses a block and writes it and its index entry, rotating
+ *        the segment first if it is full or old enough.
+ *
+ * After a failed write the remaining blocks are dropped; close() reports it.
+ */
+void SegmentLog::write_block(SegmentBlock *b) {
+  if (failed) { return; }
+  size_t raw = b->data.size();
+  size_t stored = lz_compress(b->data.data(), raw, packed.data(),
+                              packed.size());
+  const char *bytes = packed.data();
+  if (stored == 0 || stored >= raw) {
+    stored = raw;
+    bytes = b->data.data();
+  }
+  long size = sizeof(BlockHeader) + stored;
+  bool full = offset + size > segment_bytes;
+  bool old = rotate_ms > 0 && now_ns() - opened_ns >= rotate_ms * 1000000L;
+  // a segment always takes at least one block
+  bool empty = offset == (long)sizeof(SegmentHeader);
+  if ((full || old) && !empty && start_segment() != 0) { return; }
+  SegmentEntry e;
+  e.segment = header.segment;
+  e.reserved = 0;
+  e.offset = offset;
+  e.block.raw_size = raw;
+  e.block.stored_size = stored;
+  e.block.min_lid = b->min_lid;
+  e.block.max_lid = b->max_lid;
+  if (write_all(fd, &e.block, sizeof(e.block)) != 0 ||
+      write_all(fd, bytes, stored) != 0 ||
+      write_all(index_fd, &e, sizeof(e)) != 0) {
+    cerr << "[ LOGSEG ] segment " << header.segment << ": " << strerror(errno)
+         << endl;
+    failed = true;
+    return;
+  }
+  offset += size;
+  raw_bytes += raw;
+  stored_bytes += size;
+  blocks++;
+}
+
+/**
+ * @brief compressor thread: writes queued blocks in order until the log is
+ *        closed and the queue is empty.
+ *
+ * With `rotate_ms` it waits for a block no longer than until the open
+ * segment is due. It then takes the partly filled block, if any, so
+ * write_block() rotates the segment on time instead of when the block
+ * fills. With nothing to write it looks again `rotate_ms` later.
+ */
+void *SegmentLog::compress_loop(void *arg) {
+  SegmentLog *s = (SegmentLog *)arg;
+  long rotate_ns = s->rotate_ms * 1000000L;
+  long due_ns = s->opened_ns + rotate_ns;
+  pthread_mutex_lock(&s->lock);
+  while (true) {
+    bool due = false;
+    while (s->queue.empty() && !s->closing && !due) {
+      if (rotate_ns <= 0) {
+        pthread_cond_wait(&s->queued_cond, &s->lock);
+        continue;
+      }
+      struct timespec at = {due_ns / 1000000000L, due_ns % 1000000000L};
+      due = pthread_cond_timedwait(&s->queued_cond, &s->lock, &at) ==
+            ETIMEDOUT;
+    }
+    if (due && s->queue.empty() && !s->current->data.empty()) {
+      s->hand_off();
+    }
+    if (s->queue.empty()) {
+      if (s->closing) { break; }
+      due_ns = now_ns() + rotate_ns;
+      continue;
+    }
+    SegmentBlock *b = s->queue.front();
+    s->queue.pop_front();
+    pthread_mutex_unlock(&s->lock);
+    s->write_block(b);
+    pthread_mutex_lock(&s->lock);
+    s->spare.push_back(b);
+    due_ns = s->opened_ns + rotate_ns;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+/**
+ * @brief Queues the last block, waits for the compressor to write every
+ *        block, syncs the segment and index and logs `[ LOGSEG ] ...` to
+ *        stderr.
+ *
+ * @return 0 if every block was written, -1 otherwise.
+ */
+int SegmentLog::close() {
+  pthread_mutex_lock(&lock);
+  if (!current->data.empty()) { hand_off(); }
+  closing = true;
+  pthread_cond_signal(&queued_cond);
+  pthread_mutex_unlock(&lock);
+  pthread_join(compressor, NULL);
+  opened = false;
+  if (fd >= 0 && fdatasync(fd) != 0) { failed = true; }
+  if (fdatasync(index_fd) != 0) { failed = true; }
+  if (fd >= 0) { ::close(fd); }
+  ::close(index_fd);
+  fd = index_fd = -1;
+  cerr << "[ LOGSEG ] segments: " << segments << " blocks: " << blocks
+       << " lines: " << lines << " raw: " << raw_bytes
+       << " stored: " << stored_bytes << " ("
+       << (stored_bytes > 0 ? raw_bytes * 10 / stored_bytes / 10.0 : 0)
+       << "x) peak queued: " << peak_queued << endl;
+  return failed ? -1 : 0;
+}
+
+/**
+ * @brief Loads a log directory's index and first segment header.
+ *
+ * @param path The directory.
+ * @return 0 on success, -1 if it is not a segmented log.
+ */
+int SegmentReader::open(const char *path) {
+  dir = path;
+  int fd = ::open((dir + "/" + SEG_INDEX).c_str(), O_RDONLY);
+  if (fd < 0) { return -1; }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size % sizeof(SegmentEntry) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  entries.resize(st.st_size / sizeof(SegmentEntry));
+  int status = read_all(fd, entries.data(), st.st_size, 0);
+  ::close(fd);
+  if (status != 0) { return -1; }
+  fd = ::open(segment_path(dir, 0).c_str(), O_RDONLY);
+  if (fd < 0) { return -1; }
+  status = read_all(fd, &header, sizeof(header), 0);
+  ::close(fd);
+  if (status != 0 ||
+      memcmp(header.magic, SEG_MAGIC, sizeof(header.magic)) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reads and decompresses one block.
+ *
+ * @param e   Its index entry.
+ * @param raw Set to its log lines or records.
+ * @return 0 on success, -1 if it cannot be read or is damaged.
+ */
+int SegmentReader::read(const SegmentEntry &e, vector<char> *raw) const {
+  int fd = ::open(segment_path(dir, e.segment).c_str(), O_RDONLY);
+  if (fd < 0) { return -1; }
+  BlockHeader h;
+  vector<char> stored;
+  int status = read_all(fd, &h, sizeof(h), e.offset);
+  if (status == 0 && (h.raw_size != e.block.raw_size ||
+                      h.stored_size != e.block.stored_size)) {
+    status = -1;
+  }
+  if (status == 0) {
+    stored.resize(h.stored_size);
+    status = read_all(fd, stored.data(), h.stored_size, e.offset + sizeof(h));
+  }
+  ::close(fd);
+  if (status != 0) { return -1; }
+  raw->resize(h.raw_size);
+  if (h.stored_size == h.raw_size) {
+    memcpy(raw->data(), stored.data(), h.raw_size);
+    return 0;
+  }
+  return lz_decompress(stored.data(), h.stored_size, raw->data(), h.raw_size);
+}
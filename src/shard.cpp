@@ -0,0 +1,498 @@
+#include "../include/epoch.h"
+#include "../include/shard.h"
+
+#include <errno.h>      /* for errno */
+#include <signal.h>     /* for signal() */
+#include <string.h>     /* for memcpy() and memmove() */
+#include <sys/socket.h> /* for socketpair(), send() and recv() */
+#include <sys/wait.h>   /* for waitpid() */
+#include <unistd.h>     /* for fork() and close() */
+#include <unordered_map>
+
+using namespace std;
+
+int shard_id = -1;
+
+/**
+ * @brief the coordinator's end of one shard process.
+ */
+struct Shard {
+  pid_t pid;
+  int fd;                      // socket to the shard
+  pthread_mutex_t write_lock;  // the router and the vote readers both write
+  vector<ShardMsg> out;        // the router's batch, not yet written
+  pthread_t reader;            // collects the shard's votes and report
+};
+
+/**
+ * @brief a transfer between shards waiting for both votes.
+ */
+struct PreparedTransfer {
+  Ledger entry;
+  int src_vote;  // -1 until the source's shard votes, then 1 yes or 0 no
+  int dst_vote;
+};
+
+// coordinator state
+static Shard *shards = NULL;
+static unordered_map<int, PreparedTransfer> prepared;  // by ledgerID
+// undecided transfers per account, either side
+static unordered_map<int, int> busy;
+static pthread_mutex_t prepared_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prepared_cond = PTHREAD_COND_INITIALIZER;  // decided
+static bool shard_lost = false;  // a shard died, guarded by prepared_lock
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// shard state
+static int shard_fd = -1;
+static pthread_mutex_t vote_lock = PTHREAD_MUTEX_INITIALIZER;
+static char inbox[SHARD_BATCH * sizeof(ShardMsg)];
+static size_t inbox_len = 0;
+
+/**
+ * @brief sends a whole buffer, without raising SIGPIPE if the other end is
+ *        gone.
+ *
+ * @return true on success, false on a send error.
+ */
+static bool send_all(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief receives exactly `size` bytes.
+ *
+ * @return true on success, false on end of file or a receive error.
+ */
+static bool recv_all(int fd, void *data, size_t size) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief returns the shard that owns an account.
+ *
+ * The ID is scrambled by a multiplicative hash and its 32-bit result mapped
+ * onto [0, shards) by a multiply and shift, so runs of consecutive accounts
+ * spread over every shard.
+ */
+int shard_of(int acc) {
+  uint32_t h = (uint32_t)acc * 2654435761u;
+  return (int)(((uint64_t)h * (uint32_t)opts.shards) >> 32);
+}
+
+/**
+ * @brief closes the sockets of the first `n` shards, which makes them end
+ *        their ledgers, and waits for them to exit.
+ */
+static void stop_shards(int n) {
+  for (int s = 0; s < n; s++) {
+    close(shards[s].fd);
+    waitpid(shards[s].pid, NULL, 0);
+    pthread_mutex_destroy(&shards[s].write_lock);
+  }
+  delete[] shards;
+  shards = NULL;
+}
+
+/**
+ * @brief Forks one process per shard, each connected to this one, the
+ *        coordinator, by a Unix socket pair.
+ *
+ * @details
+ * Every shard returns from here with `shard_id` set and goes on to run the
+ * rest of InitBank() on its own accounts; the coordinator returns with
+ * `shard_id` -1. Call before any other thread is started, so each shard
+ * starts from a copy of a single-threaded process.
+ *
+ * @return 0 in every process, -1 in the coordinator if a socket or process
+ * cannot be created; the shards already started are then stopped.
+ */
+int start_shards() {
+  // a shard that dies must not take its peer down with SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  shards = new Shard[opts.shards];
+  cout.flush();
+  cerr.flush();
+  for (int s = 0; s < opts.shards; s++) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      perror("socketpair");
+      stop_shards(s);
+      return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      close(fds[0]);
+      close(fds[1]);
+      stop_shards(s);
+      return -1;
+    }
+    if (pid == 0) {
+      for (int k = 0; k < s; k++) { close(shards[k].fd); }
+      delete[] shards;
+      shards = NULL;
+      close(fds[0]);
+      shard_fd = fds[1];
+      shard_id = s;
+      return 0;
+    }
+    close(fds[1]);
+    shards[s].pid = pid;
+    shards[s].fd = fds[0];
+    pthread_mutex_init(&shards[s].write_lock, NULL);
+  }
+  return 0;
+}
+
+/**
+ * @brief Closes the accounts of a bank that this process does not own: the
+ *        other shards' in a shard, all of them in the coordinator.
+ *
+ * @attention
+ * - Call before the workers start.
+ */
+void shard_claim(Bank *b) {
+  EpochGuard guard;
+  int num = b->accounts.size();
+  for (int i = 0; i < num; i++) {
+    Account *acc = b->accounts.get(i);
+    if (acc == NULL) {
+      i |= SEG_MASK;
+      continue;
+    }
+    if (shard_id < 0 || shard_of(i) != shard_id) { acc->open = 0; }
+  }
+}
+
+/**
+ * @brief writes a shard's pending batch.
+ */
+static void flush(Shard &shard) {
+  if (shard.out.empty()) { return; }
+  pthread_mutex_lock(&shard.write_lock);
+  send_all(shard.fd, shard.out.data(), shard.out.size() * sizeof(ShardMsg));
+  pthread_mutex_unlock(&shard.write_lock);
+  shard.out.clear();
+}
+
+/**
+ * @brief adds an entry to a shard's batch, writing the batch once it holds
+ *        SHARD_BATCH entries.
+ */
+static void queue(int s, const Ledger &entry) {
+  ShardMsg msg = {};
+  msg.kind = SHARD_ENTRY;
+  msg.entry = entry;
+  shards[s].out.push_back(msg);
+  if (shards[s].out.size() == SHARD_BATCH) { flush(shards[s]); }
+}
+
+/**
+ * @brief sends one decision to a shard straight away.
+ */
+static void post(int s, const Ledger &entry, int mode) {
+  ShardMsg msg = {};
+  msg.kind = SHARD_ENTRY;
+  msg.entry = entry;
+  msg.entry.mode = mode;
+  msg.entry.txn = 0;
+  pthread_mutex_lock(&shards[s].write_lock);
+  send_all(shards[s].fd, &msg, sizeof(msg));
+  pthread_mutex_unlock(&shards[s].write_lock);
+}
+
+/**
+ * @brief records a vote and, once both sides of the transfer have voted,
+ *        sends the outcome to every side that voted yes.
+ *
+ * The transfer only leaves `prepared`, and its accounts `busy`, after its
+ * outcome has been sent, so the coordinator cannot route a later entry on
+ * either account, or end a shard's ledger, ahead of it.
+ */
+static void decide(const Ledger &vote, bool yes) {
+  pthread_mutex_lock(&prepared_lock);
+  auto it = prepared.find(vote.ledgerID);
+  if (it == prepared.end()) {
+    pthread_mutex_unlock(&prepared_lock);
+    return;
+  }
+  PreparedTransfer &t = it->second;
+  (vote.mode == PREPARE_SRC ? t.src_vote : t.dst_vote) = yes ? 1 : 0;
+  PreparedTransfer decided = t;
+  pthread_mutex_unlock(&prepared_lock);
+  if (decided.src_vote < 0 || decided.dst_vote < 0) { return; }
+
+  const Ledger &e = decided.entry;
+  bool commit = decided.src_vote == 1 && decided.dst_vote == 1;
+  if (decided.src_vote == 1) {
+    post(shard_of(e.acc), e, commit ? COMMIT_SRC : ABORT_SRC);
+  }
+  if (decided.dst_vote == 1) {
+    post(shard_of(e.other), e, commit ? COMMIT_DST : ABORT_DST);
+  }
+  pthread_mutex_lock(&prepared_lock);
+  prepared.erase(e.ledgerID);
+  for (int acc : {e.acc, e.other}) {
+    if (--busy[acc] == 0) { busy.erase(acc); }
+  }
+  pthread_cond_broadcast(&prepared_cond);
+  pthread_mutex_unlock(&prepared_lock);
+}
+
+/**
+ * @brief waits until no transfer between shards on either account is
+ *        undecided, first writing every shard's batch so the prepares
+ *        that are waited on reach the shards.
+ *
+ * @return false if a shard died while waiting.
+ */
+static bool wait_accounts(int acc, int other) {
+  pthread_mutex_lock(&prepared_lock);
+  bool waits = busy.count(acc) > 0 || busy.count(other) > 0;
+  pthread_mutex_unlock(&prepared_lock);
+  if (!waits) { return true; }
+  for (int s = 0; s < opts.shards; s++) { flush(shards[s]); }
+  pthread_mutex_lock(&prepared_lock);
+  while ((busy.count(acc) > 0 || busy.count(other) > 0) && !shard_lost) {
+    pthread_cond_wait(&prepared_cond, &prepared_lock);
+  }
+  bool ok = !shard_lost;
+  pthread_mutex_unlock(&prepared_lock);
+  return ok;
+}
+
+/**
+ * @brief Reader thread for one shard: handles its votes until it reports
+ *        DONE, then merges its counts and balances into the coordinator's
+ *        bank.
+ *
+ * @param arg The Shard.
+ * @return NULL once the shard has reported or gone away.
+ */
+static void *collect(void *arg) {
+  Shard *shard = (Shard *)arg;
+  ShardMsg msg;
+  while (recv_all(shard->fd, &msg, sizeof(msg))) {
+    if (msg.kind == SHARD_VOTE) {
+      decide(msg.entry, msg.vote != 0);
+      continue;
+    }
+    if (msg.kind != SHARD_DONE) { break; }
+    ReportHeader header;
+    if (!recv_all(shard->fd, &header, sizeof(header)) || header.count < 0) {
+      break;
+    }
+    vector<char> report(sizeof(header) + header.count * sizeof(ReportRecord));
+    memcpy(report.data(), &header, sizeof(header));
+    if (!recv_all(shard->fd, report.data() + sizeof(header),
+                  report.size() - sizeof(header))) {
+      break;
+    }
+    pthread_mutex_lock(&merge_lock);
+    int merged = bank->merge_report(report.data(), report.size());
+    pthread_mutex_unlock(&merge_lock);
+    if (merged != 0) { break; }
+    bank->add_counts(msg.counts[0], msg.counts[1], msg.counts[2]);
+    return NULL;
+  }
+  cerr << "shard " << shard - shards << " lost" << endl;
+  pthread_mutex_lock(&prepared_lock);
+  shard_lost = true;
+  pthread_cond_broadcast(&prepared_cond);
+  pthread_mutex_unlock(&prepared_lock);
+  return NULL;
+}
+
+/**
+ * @brief Coordinator: routes the loaded ledger to the shards, runs two-phase
+ *        commit for transfers between them and collects their results.
+ *
+ * @details
+ * An entry goes to the shard that owns its account, in batches of
+ * SHARD_BATCH per write. A transfer whose destination lives on another
+ * shard becomes two prepares, PREPARE_SRC to the source's shard and
+ * PREPARE_DST to the destination's, and each shard votes once it has run
+ * its side (see Bank::prepare_transfer()). A reader thread per shard
+ * collects votes; the thread that sees a transfer's second vote sends
+ * COMMIT to both sides if both voted yes, and otherwise ABORT to the side
+ * that did.
+ *
+ * An entry on an account with an undecided transfer between shards is not
+ * routed until the outcome has been sent, so it runs after the transfer as
+ * it would in one process; entries on other accounts keep flowing until
+ * then. Transfers denied by a rule go to the source's shard, which logs the
+ * denial. Transfers in currencies other than the base, and scheduled
+ * transfers, are not split: they go to the source's shard as CROSS_SHARD
+ * and fail there with SHARD_REASON (a scheduled one is never scheduled).
+ *
+ * Once every transfer is decided each shard is told the ledger is done and
+ * the next free ledgerID (for the end-of-day jobs). Each shard then sends
+ * its counts and a binary report of its accounts, which are merged into
+ * `bank` for write_final_report(). A shard that dies, or exits with a
+ * non-zero status, sets `exit_status`.
+ *
+ * @attention
+ * - Call in the coordinator after start_shards() and load_ledger().
+ */
+void coordinate() {
+  for (int s = 0; s < opts.shards; s++) {
+    shards[s].out.reserve(SHARD_BATCH);
+    pthread_create(&shards[s].reader, NULL, collect, &shards[s]);
+  }
+  for (const Ledger &e : ledger) {
+    bool transfer = e.mode == T || e.mode == SCHED_AT + T ||
+                    e.mode == SCHED_EVERY + T;
+    int s = shard_of(e.acc);
+    int d = transfer ? shard_of(e.other) : s;
+    if (!wait_accounts(e.acc, transfer ? e.other : e.acc)) { break; }
+    if (d == s || e.rule != 0) {
+      queue(s, e);
+      continue;
+    }
+    if (e.mode != T || e.cur != 0 || e.to != 0) {
+      Ledger r = e;
+      r.mode = CROSS_SHARD;
+      queue(s, r);
+      continue;
+    }
+    pthread_mutex_lock(&prepared_lock);
+    prepared[e.ledgerID] = {e, -1, -1};
+    busy[e.acc]++;
+    busy[e.other]++;
+    pthread_mutex_unlock(&prepared_lock);
+    Ledger p = e;
+    p.mode = PREPARE_SRC;
+    queue(s, p);
+    p.mode = PREPARE_DST;
+    p.txn = 0;
+    queue(d, p);
+  }
+  ledger.clear();
+  for (int s = 0; s < opts.shards; s++) { flush(shards[s]); }
+  // every outcome must reach the shards before their ledgers end
+  pthread_mutex_lock(&prepared_lock);
+  while (!prepared.empty() && !shard_lost) {
+    pthread_cond_wait(&prepared_cond, &prepared_lock);
+  }
+  pthread_mutex_unlock(&prepared_lock);
+  Ledger end;
+  end.ledgerID = next_ledgerID;
+  for (int s = 0; s < opts.shards; s++) {
+    ShardMsg msg = {};
+    msg.kind = SHARD_END;
+    msg.entry = end;
+    pthread_mutex_lock(&shards[s].write_lock);
+    send_all(shards[s].fd, &msg, sizeof(msg));
+    pthread_mutex_unlock(&shards[s].write_lock);
+  }
+  for (int s = 0; s < opts.shards; s++) {
+    pthread_join(shards[s].reader, NULL);
+    close(shards[s].fd);
+    int status;
+    if (waitpid(shards[s].pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      exit_status = 1;
+    }
+    pthread_mutex_destroy(&shards[s].write_lock);
+  }
+  if (shard_lost) { exit_status = 1; }
+  delete[] shards;
+  shards = NULL;
+}
+
+/**
+ * @brief Receives the entries the coordinator has sent this shard so far,
+ *        waiting for at least one message.
+ *
+ * @param batch Receives the entries.
+ * @param next Receives the next free ledgerID once the ledger is done.
+ * @return false once the coordinator has ended the ledger (or gone away),
+ * true while more may follow.
+ */
+bool shard_receive(vector<Ledger> &batch, int *next) {
+  ssize_t n;
+  do {
+    n = recv(shard_fd, inbox + inbox_len, sizeof(inbox) - inbox_len, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    *next = next_ledgerID;
+    return false;
+  }
+  inbox_len += n;
+  size_t at = 0;
+  for (; inbox_len - at >= sizeof(ShardMsg); at += sizeof(ShardMsg)) {
+    ShardMsg msg;
+    memcpy(&msg, inbox + at, sizeof(msg));
+    if (msg.kind == SHARD_END) {
+      *next = msg.entry.ledgerID;
+      return false;
+    }
+    batch.push_back(msg.entry);
+  }
+  memmove(inbox, inbox + at, inbox_len - at);
+  inbox_len -= at;
+  return true;
+}
+
+/**
+ * @brief Sends this shard's vote on a prepared transfer to the coordinator.
+ *
+ * @attention
+ * - Thread safe: workers vote concurrently.
+ *
+ * @param entry The PREPARE_SRC or PREPARE_DST entry that was run.
+ * @param yes Whether this side can go ahead.
+ */
+void shard_vote(const Ledger &entry, bool yes) {
+  ShardMsg msg = {};
+  msg.kind = SHARD_VOTE;
+  msg.vote = yes ? 1 : 0;
+  msg.entry = entry;
+  pthread_mutex_lock(&vote_lock);
+  send_all(shard_fd, &msg, sizeof(msg));
+  pthread_mutex_unlock(&vote_lock);
+}
+
+/**
+ * @brief Sends this shard's counts and a binary report of its accounts to
+ *        the coordinator, in place of a final report.
+ *
+ * @attention
+ * - Call once the workers and end-of-day jobs are done.
+ *
+ * @param last_ledgerID The last ledger entry reflected in the balances.
+ * @return 0 on success, -1 on a write error.
+ */
+int shard_finish(int last_ledgerID) {
+  ShardMsg msg = {};
+  msg.kind = SHARD_DONE;
+  bank->counts(&msg.counts[0], &msg.counts[1], &msg.counts[2]);
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int result = -1;
+  if (send_all(shard_fd, &msg, sizeof(msg)) &&
+      bank->write_report(shard_fd, REPORT_BIN, threads, last_ledgerID) == 0) {
+    result = 0;
+  }
+  close(shard_fd);
+  shard_fd = -1;
+  return result;
+}
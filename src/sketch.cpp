@@ -0,0 +1,168 @@
+#include "../include/sketch.h"
+
+#include <string.h>  /* for memset() */
+#include <algorithm> /* for sort() */
+#include <iostream>  /* for cerr */
+#include <sstream>
+
+using namespace std;
+
+// sketch owned by the calling thread
+static thread_local ThreadSketch *local_sketch = NULL;
+
+/**
+ * @brief 64-bit finalizer (splitmix64); each sketch row uses 16 bits of it.
+ */
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/**
+ * @brief Construct a new AccessSketch.
+ */
+AccessSketch::AccessSketch() {
+  pthread_mutex_init(&lock, NULL);
+}
+
+/**
+ * @brief Destroy the AccessSketch object and every thread's sketch.
+ */
+AccessSketch::~AccessSketch() {
+  for (ThreadSketch *s : sketches) { delete s; }
+  pthread_mutex_destroy(&lock);
+}
+
+/**
+ * @brief creates and registers the calling thread's sketch.
+ */
+ThreadSketch *AccessSketch::attach() {
+  ThreadSketch *s = new ThreadSketch;
+  memset(s, 0, sizeof(*s));
+  pthread_mutex_lock(&lock);
+  sketches.push_back(s);
+  pthread_mutex_unlock(&lock);
+  return s;
+}
+
+/**
+ * @brief updates or admits a heavy-hitter candidate whose estimate beat the
+ *        list's floor, evicting the smallest when the list is full.
+ */
+void AccessSketch::promote(ThreadSketch *s, int acc, uint32_t est) {
+  int low = 0;
+  for (int i = 0; i < s->num_top; i++) {
+    if (s->top[i].acc == acc) {
+      s->top[i].est = est;
+      low = -1;
+      break;
+    }
+    if (s->top[i].est < s->top[low].est) { low = i; }
+  }
+  if (low >= 0) {
+    if (s->num_top < SKETCH_CANDIDATES) {
+      low = s->num_top++;
+    }
+    s->top[low] = {acc, est};
+  }
+  if (s->num_top < SKETCH_CANDIDATES) { return; }
+  uint32_t floor = s->top[0].est;
+  for (int i = 1; i < s->num_top; i++) {
+    if (s->top[i].est < floor) { floor = s->top[i].est; }
+  }
+  s->floor = floor;
+}
+
+/**
+ * @brief Counts one access to an account in the calling thread's sketch.
+ *
+ * @param acc The account accessed.
+ */
+void AccessSketch::touch(int acc) {
+  ThreadSketch *s = local_sketch;
+  if (s == NULL) { s = local_sketch = attach(); }
+  uint64_t h = mix64((uint32_t)acc);
+  uint32_t est = UINT32_MAX;
+  for (int r = 0; r < SKETCH_DEPTH; r++, h >>= 16) {
+    uint32_t c = ++s->counts[r][h & (SKETCH_WIDTH - 1)];
+    if (c < est) { est = c; }
+  }
+  s->total++;
+  if (est > s->floor) { promote(s, acc, est); }
+}
+
+/**
+ * @brief Merges the sketches and prints the top accounts to stderr.
+ *
+ * @details
+ * Prints the total number of accesses, then one line per account
+ *   `[ TOP ] #{rank} Acc: {acc} ~{estimate} ({share}%)`
+ * and the share of all accesses that the top 1, 10 (when `k` > 10) and `k`
+ * accounts take, which summarizes how skewed the ledger was. Call after the
+ * workers have joined.
+ *
+ * @param k How many accounts to list.
+ */
+void AccessSketch::report(int k) {
+  static uint32_t merged[SKETCH_DEPTH][SKETCH_WIDTH];
+  memset(merged, 0, sizeof(merged));
+  long total = 0;
+  vector<int> candidates;
+  for (ThreadSketch *s : sketches) {
+    for (int r = 0; r < SKETCH_DEPTH; r++) {
+      for (int i = 0; i < SKETCH_WIDTH; i++) {
+        merged[r][i] += s->counts[r][i];
+      }
+    }
+    total += s->total;
+    for (int i = 0; i < s->num_top; i++) {
+      candidates.push_back(s->top[i].acc);
+    }
+  }
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+
+  vector<SketchCandidate> ranked;
+  for (int acc : candidates) {
+    uint64_t h = mix64((uint32_t)acc);
+    uint32_t est = UINT32_MAX;
+    for (int r = 0; r < SKETCH_DEPTH; r++, h >>= 16) {
+      uint32_t c = merged[r][h & (SKETCH_WIDTH - 1)];
+      if (c < est) { est = c; }
+    }
+    ranked.push_back({acc, est});
+  }
+  sort(ranked.begin(), ranked.end(),
+       [](const SketchCandidate &a, const SketchCandidate &b) {
+         return a.est != b.est ? a.est > b.est : a.acc < b.acc;
+       });
+  if ((int)ranked.size() > k) { ranked.resize(k); }
+
+  ostringstream out;
+  out << fixed;
+  out.precision(2);
+  out << "[ TOP ] accesses: " << total << "\n";
+  long running = 0, top1 = 0, top10 = 0;
+  for (size_t i = 0; i < ranked.size(); i++) {
+    running += ranked[i].est;
+    if (i == 0) { top1 = running; }
+    if (i < 10) { top10 = running; }
+    out << "[ TOP ] #" << i + 1 << " Acc: " << ranked[i].acc << " ~"
+        << ranked[i].est << " ("
+        << (total > 0 ? ranked[i].est * 100.0 / total : 0) << "%)\n";
+  }
+  if (total > 0) {
+    out << "[ TOP ] share of accesses: top 1 " << top1 * 100.0 / total << "%";
+    if (ranked.size() > 10) {
+      out << ", top 10 " << top10 * 100.0 / total << "%";
+    }
+    out << ", top " << ranked.size() << " " << running * 100.0 / total
+        << "%\n";
+  }
+  cerr << out.str();
+}
@@ -0,0 +1,130 @@
+#include "../include/table.h"
+#include "../include/epoch.h"
+
+using namespace std;
+
+/**
+ * @brief allocates an empty directory with room for `capacity` segments.
+ */
+Directory *AccountTable::new_directory(int capacity) {
+  Directory *d = new Directory;
+  d->capacity = capacity;
+  d->segs = new atomic<Account *>[capacity];
+  for (int i = 0; i < capacity; i++) {
+    d->segs[i] = NULL;
+  }
+  return d;
+}
+
+/**
+ * @brief frees a directory (not the segments it points to).
+ */
+void AccountTable::free_directory(void *d) {
+  Directory *dir = (Directory *)d;
+  delete[] dir->segs;
+  delete dir;
+}
+
+/**
+ * @brief Construct an empty AccountTable.
+ */
+AccountTable::AccountTable() {
+  pthread_mutex_init(&grow_lock, NULL);
+  num = 0;
+  dir = new_directory(1);
+}
+
+/**
+ * @brief Destroy the AccountTable object.
+ *
+ * @details
+ * Destroys the lock of every allocated account slot, frees version chains,
+ * foreign currency balances, the segments and the current directory.
+ * Directories retired by grow() belong to the epoch domain.
+ */
+AccountTable::~AccountTable() {
+  Directory *d = dir;
+  for (int s = 0; s < d->capacity; s++) {
+    Account *seg = d->segs[s];
+    if (seg == NULL) { continue; }
+    for (int i = 0; i < SEG_SIZE; i++) {
+      pthread_mutex_destroy(&seg[i].lock);
+      delete[] seg[i].wallet;
+      Version *v = seg[i].versions;
+      while (v != NULL) {
+        Version *older = v->older;
+        delete v;
+        v = older;
+      }
+    }
+    delete[] seg;
+  }
+  free_directory(d);
+  pthread_mutex_destroy(&grow_lock);
+}
+
+/**
+ * @brief Grows the table so that account IDs [0, n) are in range and the
+ *        segment holding ID n - 1 has slots.
+ *
+ * @details
+ * Only that one segment is allocated, so the directory stays sparse and a
+ * high account ID costs one segment rather than every segment below it.
+ * A new segment is initialised (closed, zero balance, no limit, fresh
+ * lock) before it is published. When the directory is full a copy with
+ * twice the capacity is published and the old one is retired to the epoch
+ * domain, because concurrent readers may still be using it. The new size
+ * is published last, so any reader that sees an ID in range also sees the
+ * directory that covers it.
+ *
+ * @param n One past the account ID that needs a slot.
+ * @return true on success, false if n exceeds MAX_ACCOUNTS.
+ */
+bool AccountTable::grow(int n) {
+  if (n > MAX_ACCOUNTS) { return false; }
+  if (n <= 0) { return true; }
+  {
+    EpochGuard guard;
+    if (get(n - 1) != NULL) { return true; }
+  }
+
+  pthread_mutex_lock(&grow_lock);
+  int s = (n - 1) >> SEG_SHIFT;
+  Directory *d = dir.load(memory_order_relaxed);
+  // replace the directory when it cannot hold the segment
+  if (s >= d->capacity) {
+    int cap = d->capacity;
+    while (cap <= s) { cap *= 2; }
+    Directory *bigger = new_directory(cap);
+    for (int i = 0; i < d->capacity; i++) {
+      bigger->segs[i].store(d->segs[i].load(memory_order_relaxed),
+                            memory_order_relaxed);
+    }
+    dir.store(bigger, memory_order_release);
+    epochs.retire(d, free_directory);
+    d = bigger;
+  }
+  // allocate and publish the segment if it is missing
+  if (d->segs[s].load(memory_order_relaxed) == NULL) {
+    Account *seg = new Account[SEG_SIZE];
+    for (int i = 0; i < SEG_SIZE; i++) {
+      seg[i].accountID = (s << SEG_SHIFT) + i;
+      seg[i].open = 0;
+      seg[i].balance = 0;
+      seg[i].held = 0;
+      seg[i].limit = 0;
+      seg[i].versions = NULL;
+      seg[i].wallet = NULL;
+      seg[i].pending = 0;
+      seg[i].lsn = 0;
+      seg[i].untrimmed = 0;
+      pthread_mutex_init(&seg[i].lock, NULL);
+    }
+    d->segs[s].store(seg, memory_order_release);
+  }
+  if (n > num.load(memory_order_relaxed)) {
+    num.store(n, memory_order_release);
+  }
+  pthread_mutex_unlock(&grow_lock);
+  return true;
+}
@@ -0,0 +1,177 @@
+#include "../include/wheel.h"
+
+#include <limits.h> /* for LONG_MAX */
+#include <string.h> /* for memset() */
+#include <bit>
+
+using namespace std;
+
+/**
+ * @brief Construct a new TimingWheel.
+ *
+ * @param start The current time, in ticks.
+ */
+TimingWheel::TimingWheel(long start) : now(start), pending(0) {
+  memset(slots, 0, sizeof(slots));
+  memset(occupied, 0, sizeof(occupied));
+}
+
+/**
+ * @brief Destroy the TimingWheel object and every timer still in it.
+ */
+TimingWheel::~TimingWheel() {
+  for (int l = 0; l < WHEEL_LEVELS; l++) {
+    for (int s = 0; s < WHEEL_SIZE; s++) {
+      Timer *t = slots[l][s];
+      while (t != NULL) {
+        Timer *next = t->next;
+        delete t;
+        t = next;
+      }
+    }
+  }
+}
+
+/**
+ * @brief links a timer into the slot for its distance from `now`.
+ *
+ * Timers further away than the wheel spans are parked in the farthest slot
+ * of the top level and placed again when it cascades.
+ *
+ * @return false if the timer is already due and was not linked.
+ */
+bool TimingWheel::link(Timer *t) {
+  long delta = t->expires - now;
+  if (delta <= 0) { return false; }
+  long span = 1L << (WHEEL_BITS * WHEEL_LEVELS);
+  long at = delta < span ? t->expires : now + span - 1;
+  int level = 0;
+  while (level < WHEEL_LEVELS - 1 &&
+         at - now >= 1L << (WHEEL_BITS * (level + 1))) {
+    level++;
+  }
+  int slot = (at >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+  t->level = level;
+  t->slot = slot;
+  t->prev = NULL;
+  t->next = slots[level][slot];
+  if (t->next != NULL) { t->next->prev = t; }
+  slots[level][slot] = t;
+  occupied[level] |= 1UL << slot;
+  pending++;
+  return true;
+}
+
+/**
+ * @brief unlinks a timer from its slot.
+ */
+void TimingWheel::unlink(Timer *t) {
+  if (t->prev != NULL) {
+    t->prev->next = t->next;
+  } else {
+    slots[t->level][t->slot] = t->next;
+  }
+  if (t->next != NULL) { t->next->prev = t->prev; }
+  if (slots[t->level][t->slot] == NULL) {
+    occupied[t->level] &= ~(1UL << t->slot);
+  }
+  t->level = -1;
+  t->prev = t->next = NULL;
+  pending--;
+}
+
+/**
+ * @brief the first tick after `now` at which an occupied slot is due to
+ *        expire (level 0) or cascade (higher levels).
+ */
+long TimingWheel::next_event() {
+  long best = LONG_MAX;
+  for (int l = 0; l < WHEEL_LEVELS; l++) {
+    if (occupied[l] == 0) { continue; }
+    int shift = WHEEL_BITS * l;
+    long cur = now >> shift;
+    // bit i of the rotated mask is the slot i + 1 steps ahead
+    uint64_t ahead = rotr(occupied[l], (int)((cur + 1) & (WHEEL_SIZE - 1)));
+    long tick = (cur + 1 + countr_zero(ahead)) << shift;
+    if (tick < best) { best = tick; }
+  }
+  return best;
+}
+
+/**
+ * @brief Adds a timer to the wheel.
+ *
+ * @param t A timer that is not in a wheel, with `expires` set.
+ * @return true if the timer was added, false if it is already due (at or
+ * before the current time), in which case the caller fires it.
+ */
+bool TimingWheel::insert(Timer *t) {
+  return link(t);
+}
+
+/**
+ * @brief Removes a timer before it expires. Does nothing if the timer is
+ *        not in the wheel.
+ */
+void TimingWheel::remove(Timer *t) {
+  if (t->level >= 0) { unlink(t); }
+}
+
+/**
+ * @brief Moves the clock forward and collects the timers that expire.
+ *
+ * @details
+ * The clock jumps from one due slot to the next; at each, higher levels
+ * cascade first (top down) so their timers reach level 0 before it
+ * expires. A time at or before the current one does nothing.
+ *
+ * @param to The new current time.
+ * @return The expired timers, linked through `next` in expiry order (no
+ * particular order within one tick), or NULL. They are no longer in the
+ * wheel and belong to the caller.
+ */
+Timer *TimingWheel::advance(long to) {
+  Timer *head = NULL;
+  Timer **tail = &head;
+  while (pending > 0) {
+    long tick = next_event();
+    if (tick > to) { break; }
+    now = tick;
+    for (int l = WHEEL_LEVELS - 1; l >= 0; l--) {
+      int shift = WHEEL_BITS * l;
+      if ((now & ((1L << shift) - 1)) != 0) { continue; }
+      int s = (now >> shift) & (WHEEL_SIZE - 1);
+      Timer *t = slots[l][s];
+      slots[l][s] = NULL;
+      occupied[l] &= ~(1UL << s);
+      while (t != NULL) {
+        Timer *next = t->next;
+        pending--;
+        t->level = -1;
+        t->prev = NULL;
+        if (l == 0 || !link(t)) {
+          *tail = t;
+          tail = &t->next;
+        }
+        t = next;
+      }
+    }
+  }
+  if (to > now) { now = to; }
+  *tail = NULL;
+  return head;
+}
+
+/**
+ * @brief Lists the timers in the wheel, in no particular order. They stay
+ *        in the wheel.
+ *
+ * @param out Receives the timers.
+ */
+void TimingWheel::list(vector<Timer *> &out) {
+  for (int l = 0; l < WHEEL_LEVELS; l++) {
+    for (int s = 0; s < WHEEL_SIZE; s++) {
+      for (Timer *t = slots[l][s]; t != NULL; t = t->next) { out.push_back(t); }
+    }
+  }
+}
@@ -0,0 +1,325 @@
+#include "../include/bank.h"
+#include "../include/logfmt.h"
+#include "../include/segment.h"
+
+#include <errno.h>    /* for errno */
+#include <fcntl.h>    /* for open() */
+#include <string.h>   /* for memcmp() and memmem() */
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <time.h>     /* for clock_gettime() */
+#include <unistd.h>   /* for write() and sysconf() */
+#include <vector>
+
+using namespace std;
+
+// units one thread renders per round; a round's text is written before
+// the next one starts, so memory stays bounded however long the log is
+const size_t RENDER_CHUNK = 65536;
+// blocks of a segmented log one thread decompresses per round
+const size_t RENDER_BLOCKS = 16;
+
+/**
+ * @brief one render thread's slice of a round and its text.
+ */
+struct RenderChunk {
+  const LogHeader *header;
+  const LogEntry *units;
+  size_t count;  // units in the slice
+  size_t avail;  // units readable from `units`, to the end of the log
+  size_t records;
+  string text;
+  bool ok;
+};
+
+/**
+ * @brief renders the records that start in a slice of units into the
+ *        chunk's text, one line each.
+ *
+ * A slice may start on the extension of a record that began in the one
+ * before, which is skipped, and end on a record whose extension lies in
+ * the next, which is read past the slice.
+ *
+ * @param arg The RenderChunk to fill.
+ * @return NULL when done.
+ */
+static void *render_chunk(void *arg) {
+  RenderChunk *chunk = (RenderChunk *)arg;
+  chunk->text.clear();
+  chunk->records = 0;
+  chunk->ok = true;
+  size_t i = 0;
+  if (chunk->count > 0 && chunk->units[0].op == LOG_EXT_MARK) { i = 1; }
+  while (i < chunk->count) {
+    LogRecord r;
+    size_t used = unpack_log(chunk->units + i, chunk->avail - i, &r);
+    if (used == 0) {
+      chunk->ok = false;
+      return NULL;
+    }
+    chunk->text += render_log(r, *chunk->header);
+    chunk->text += '\n';
+    chunk->records++;
+    i += used;
+  }
+  return NULL;
+}
+
+/**
+ * @brief one render thread's blocks of a segmented log and their text.
+ */
+struct BlockChunk {
+  const SegmentReader *reader;
+  size_t first;  // index entries
+  size_t count;
+  int lid;       // only lines of this ledgerID, all if -1
+  string text;
+  bool ok;
+};
+
+/**
+ * @brief returns the ledgerID a text log line names, or -1.
+ */
+static int line_lid(const char *line, size_t size) {
+  const char *tag = (const char *)memmem(line, size, "LID: ", 5);
+  return tag ? atoi(tag + 5) : -1;
+}
+
+/**
+ * @brief decompresses a chunk's blocks into its text: copied for a text
+ *        log, rendered for a binary one, keeping only the lines of
+ *        `lid` if it is set. Blocks whose ledgerID range excludes `lid`
+ *        are not read at all.
+ *
+ * @param arg The BlockChunk to fill.
+ * @return NULL when done.
+ */
+static void *render_blocks(void *arg) {
+  BlockChunk *chunk = (BlockChunk *)arg;
+  const SegmentHeader &header = chunk->reader->header;
+  vector<char> raw;
+  chunk->text.clear();
+  chunk->ok = true;
+  for (size_t i = chunk->first; i < chunk->first + chunk->count; i++) {
+    const SegmentEntry &e = chunk->reader->entries[i];
+    if (chunk->lid >= 0 &&
+        (chunk->lid < e.block.min_lid || chunk->lid > e.block.max_lid)) {
+      continue;
+    }
+    if (chunk->reader->read(e, &raw) != 0) {
+      chunk->ok = false;
+      return NULL;
+    }
+    if (header.format == LOG_BIN) {
+      const LogEntry *units = (const LogEntry *)raw.data();
+      size_t count = raw.size() / sizeof(LogEntry);
+      for (size_t u = 0; u < count;) {
+        LogRecord r;
+        size_t used = unpack_log(units + u, count - u, &r);
+        if (used == 0) {
+          chunk->ok = false;
+          return NULL;
+        }
+        u += used;
+        if (chunk->lid >= 0 && r.lid != chunk->lid) { continue; }
+        chunk->text += render_log(r, header.log);
+        chunk->text += '\n';
+      }
+    } else if (chunk->lid < 0) {
+      chunk->text.append(raw.data(), raw.size());
+    } else {
+      for (size_t at = 0; at < raw.size();) {
+        const char *line = raw.data() + at;
+        const char *end = (const char *)memchr(line, '\n', raw.size() - at);
+        size_t len = end ? end - line + 1 : raw.size() - at;
+        if (line_lid(line, len) == chunk->lid) { chunk->text.append(line, len); }
+        at += len;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief writes a whole buffer to a file descriptor.
+ *
+ * @return 0 on success, -1 on a write error.
+ */
+static int write_all(int fd, const string &text) {
+  const char *p = text.data();
+  size_t left = text.size();
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return -1;
+    }
+    p += n;
+    left -= n;
+  }
+  return 0;
+}
+
+/**
+ * @brief writes a segmented log (`--log-segments`) to stdout as one text
+ *        log, or only the lines of one ledgerID.
+ *
+ * @details
+ * Rounds of RENDER_BLOCKS blocks per thread, as for a binary log file; a
+ * ledgerID lookup skips the blocks the index rules out.
+ *
+ * @return 0 on success, 1 if the log is damaged or cannot be written.
+ */
+static int render_segments(const char *dir, int threads, int lid) {
+  SegmentReader reader;
+  if (reader.open(dir) != 0) {
+    cerr << dir << ": not a segmented log" << endl;
+    return 1;
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t count = reader.entries.size();
+  vector<BlockChunk> chunks(threads);
+  vector<pthread_t> tids(threads);
+  int status = 0;
+  for (size_t at = 0; at < count && status == 0;) {
+    for (int t = 0; t < threads; t++) {
+      size_t n = min(RENDER_BLOCKS, count - at);
+      chunks[t].reader = &reader;
+      chunks[t].first = at;
+      chunks[t].count = n;
+      chunks[t].lid = lid;
+      at += n;
+      pthread_create(&tids[t], NULL, render_blocks, &chunks[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+      pthread_join(tids[t], NULL);
+      if (status == 0 && !chunks[t].ok) {
+        cerr << dir << ": damaged block" << endl;
+        status = 1;
+      }
+      if (status == 0 && write_all(STDOUT_FILENO, chunks[t].text) != 0) {
+        cerr << "write failed" << endl;
+        status = 1;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long ms = (end.tv_sec - start.tv_sec) * 1000L +
+            (end.tv_nsec - start.tv_nsec) / 1000000;
+  size_t read = 0;
+  for (const SegmentEntry &e : reader.entries) {
+    if (lid < 0 || (lid >= e.block.min_lid && lid <= e.block.max_lid)) {
+      read++;
+    }
+  }
+  cerr << "[ RENDER ] blocks: " << read << " of " << count
+       << " threads: " << threads << " (" << ms << " ms)" << endl;
+  return status;
+}
+
+/**
+ * @brief Renders a binary log (`--log-format bin`) to stdout as the text
+ *        log the same run would have written, or decompresses a segmented
+ *        log directory (`--log-segments`, text or bin).
+ *
+ * @details
+ * The file is mapped and rendered in rounds: each of `threads` threads
+ * unpacks the records starting in RENDER_CHUNK consecutive units and
+ * renders them with render_log(), then the chunks are written in order. `[ RENDER ] records: .. threads: .. (.. ms)`
+ * is logged to stderr.
+ *
+ * With `--lid N` on a segmented log only the lines of ledgerID N are
+ * written, read from the blocks whose index entries may hold it.
+ *
+ * Usage: log_render <binary_log|segment_dir> [threads] [--lid N]
+ *        (threads default: online CPUs)
+ */
+int main(int argc, char *argv[]) {
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int lid = -1;
+  bool usage = argc < 2;
+  for (int i = 2; i < argc && !usage; i++) {
+    if (strcmp(argv[i], "--lid") == 0 && i + 1 < argc) {
+      lid = atoi(argv[++i]);
+      usage = lid < 0;
+    } else if (i == 2 && argv[i][0] != '-') {
+      threads = atoi(argv[i]);
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    cerr << "Usage: " << argv[0]
+         << " <binary_log|segment_dir> [threads] [--lid N]" << endl;
+    return -1;
+  }
+  if (threads < 1) { threads = 1; }
+  int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    cerr << "cannot open " << argv[1] << endl;
+    return 1;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    close(fd);
+    return render_segments(argv[1], threads, lid);
+  }
+  if (lid >= 0) {
+    cerr << "--lid needs a segmented log" << endl;
+    return 1;
+  }
+  size_t size = st.st_size;
+  const char *data = size == 0 ? NULL
+                               : (const char *)mmap(NULL, size, PROT_READ,
+                                                    MAP_PRIVATE, fd, 0);
+  const LogHeader *header = (const LogHeader *)data;
+  if (data == MAP_FAILED || size < sizeof(LogHeader) ||
+      memcmp(header->magic, LOG_MAGIC, sizeof(header->magic)) != 0 ||
+      header->record_size != sizeof(LogEntry) ||
+      (size - sizeof(LogHeader)) % sizeof(LogEntry) != 0) {
+    cerr << argv[1] << ": not a binary log" << endl;
+    return 1;
+  }
+  madvise((void *)data, size, MADV_SEQUENTIAL);
+  const LogEntry *units = (const LogEntry *)(data + sizeof(LogHeader));
+  size_t count = (size - sizeof(LogHeader)) / sizeof(LogEntry);
+  size_t records = 0;
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  vector<RenderChunk> chunks(threads);
+  vector<pthread_t> tids(threads);
+  int status = 0;
+  for (size_t at = 0; at < count && status == 0;) {
+    for (int t = 0; t < threads; t++) {
+      size_t n = min(RENDER_CHUNK, count - at);
+      chunks[t].header = header;
+      chunks[t].units = units + at;
+      chunks[t].count = n;
+      chunks[t].avail = count - at;
+      at += n;
+      pthread_create(&tids[t], NULL, render_chunk, &chunks[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+      pthread_join(tids[t], NULL);
+      records += chunks[t].records;
+      if (status == 0 && !chunks[t].ok) {
+        cerr << argv[1] << ": damaged record" << endl;
+        status = 1;
+      }
+      if (status == 0 && write_all(STDOUT_FILENO, chunks[t].text) != 0) {
+        cerr << "write failed" << endl;
+        status = 1;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long ms = (end.tv_sec - start.tv_sec) * 1000L +
+            (end.tv_nsec - start.tv_nsec) / 1000000;
+  cerr << "[ RENDER ] records: " << records << " threads: " << threads << " ("
+       << ms << " ms)" << endl;
+  munmap((void *)data, size);
+  close(fd);
+  return status;
+}